@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -62,4 +62,7 @@ extern NSString * const CSDocumentPboardType;
 // Open prefs, passing it on to the prefs controller
 - (IBAction) openPreferences:(id)sender;
 
+// Check chosen documents for damage, without opening them
+- (IBAction) verifyDocuments:(id)sender;
+
 @end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -34,43 +34,37 @@
 
 #import "CSAppController.h"
 #import "CSPrefsController.h"
+#import "CSDocContainer.h"
 #import "CSDocument.h"
 #import "CSWinCtrlEntry.h"
 #import "CSWinCtrlMain.h"
-#include <CoreFoundation/CoreFoundation.h>
 
 
 NSString * const CSDocumentPboardType = @"CSDocumentPboardType";
 
 
-@implementation CSAppController
-
-/*
-static CFAllocatorRef ciphSafeCFAllocator;
-static CFAllocatorRef originalCFAllocator;
-
+@interface CSAppController (InternalMethods)
+- (void) addFileMenuItemWithTitle:(NSString *)title action:(SEL)action;
+- (NSArray *) documentExtensions;
+@end
 
-// These are the custom CoreFoundation allocator functions
-void *ciphSafeCFReallocate(void *ptr, CFIndex newsize, CFOptionFlags hint, void *info)
-{
-//   return realloc(ptr, newsize);
-   return CFAllocatorReallocate(originalCFAllocator, ptr, newsize, hint);
-}
 
+@implementation CSAppController
 
-void ciphSafeCFDeallocate(void *ptr, void *info)
-{
-//   free(ptr);
-//   return;
-   CFAllocatorDeallocate(originalCFAllocator, ptr);
-}
-*/
+/*
+ * XXX The default CoreFoundation allocator is left alone; the secrets we own
+ * are kept in CSSecureData, but strings and the like made by the frameworks
+ * come from the ordinary heap.  Sending every CF allocation through the
+ * locked pool isn't workable: it would lock most of the process's memory,
+ * well past what the system lets a process wire down, and CF doesn't say how
+ * big a buffer is when freeing it.
+ */
 
 
 #pragma mark -
 #pragma mark Initialization
 /*
- * Setup up custom allocator stuff
+ * Get the preferences in place before anything else
  */
 + (void) initialize
 {
@@ -79,20 +73,6 @@ void ciphSafeCFDeallocate(void *ptr, void *info)
 #endif
    // Force the prefs controller to load so it does its +initialize thing
    [CSPrefsController sharedPrefsController];
-/*   
-   // Create CoreFoundation custom allocator so we can clear memory on deallocation
-   originalCFAllocator = CFAllocatorGetDefault();
-   CFRetain(originalCFAllocator);
-   CFAllocatorContext originalContext;
-   CFAllocatorGetContext(originalCFAllocator, &originalContext);
-   
-   CFAllocatorContext allocContext;
-   memcpy(&allocContext, &originalContext, sizeof(CFAllocatorContext));
-   allocContext.reallocate = ciphSafeCFReallocate;
-   allocContext.deallocate = ciphSafeCFDeallocate;
-   ciphSafeCFAllocator = CFAllocatorCreate(NULL, &allocContext);
-   CFAllocatorSetDefault(ciphSafeCFAllocator);
-   */
 }
 
 
@@ -107,12 +87,19 @@ void ciphSafeCFDeallocate(void *ptr, void *info)
 
 
 /*
- * Listen for additions to the window menu (to rearrange it), and record
- * the current pasteboard changecount, but one less since we haven't
- * touched it yet
+ * Listen for additions to the window menu (to rearrange it), add the menu
+ * items which came after the nib, and record the current pasteboard
+ * changecount, but one less since we haven't touched it yet
  */
 - (void) applicationDidFinishLaunching:(NSNotification *)aNotification
 {
+   [self addFileMenuItemWithTitle:NSLocalizedString(@"Verify Documents", @"")
+                           action:@selector(verifyDocuments:)];
+   // Handled by the frontmost document
+   [self addFileMenuItemWithTitle:NSLocalizedString(@"Open Backup", @"")
+                           action:@selector(openBackup:)];
+   [self addFileMenuItemWithTitle:NSLocalizedString(@"Compression Benchmark", @"")
+                           action:@selector(runCompressionBenchmark:)];
    [[NSNotificationCenter defaultCenter] addObserver:self
                                             selector:@selector(windowsMenuDidUpdate:)
                                                 name:NSMenuDidAddItemNotification
@@ -334,6 +321,87 @@ void ciphSafeCFDeallocate(void *ptr, void *info)
 }
 
 
+/*
+ * Add an item to the File menu, after Open Recent (or Open, failing that)
+ */
+- (void) addFileMenuItemWithTitle:(NSString *)title action:(SEL)action
+{
+   NSEnumerator *topItemEnumerator = [[[NSApp mainMenu] itemArray] objectEnumerator];
+   id topItem;
+   while((topItem = [topItemEnumerator nextObject]) != nil)
+   {
+      NSMenu *fileMenu = [topItem submenu];
+      NSInteger openIndex = [fileMenu indexOfItemWithTarget:nil andAction:@selector(openDocument:)];
+      if(openIndex >= 0)
+      {
+         NSInteger newIndex = openIndex + 1;
+         if(newIndex < [fileMenu numberOfItems] && [[fileMenu itemAtIndex:newIndex] hasSubmenu])
+            newIndex++;
+         [fileMenu insertItemWithTitle:title action:action keyEquivalent:@"" atIndex:newIndex];
+         return;
+      }
+   }
+}
+
+
+/*
+ * Let the user pick documents, then check each one's checksums (see
+ * CSDocContainer) and report; no passphrase is needed, and nothing is opened
+ */
+- (IBAction) verifyDocuments:(id)sender
+{
+   NSOpenPanel *openPanel = [NSOpenPanel openPanel];
+   [openPanel setCanChooseFiles:YES];
+   [openPanel setCanChooseDirectories:NO];
+   [openPanel setAllowsMultipleSelection:YES];
+   [openPanel setTitle:NSLocalizedString(@"Document Verification", @"")];
+   if([openPanel runModalForTypes:[self documentExtensions]] != NSOKButton)
+      return;
+
+   NSMutableString *report = [NSMutableString stringWithCapacity:100];
+   NSEnumerator *pathEnumerator = [[openPanel filenames] objectEnumerator];
+   id onePath;
+   while((onePath = [pathEnumerator nextObject]) != nil)
+   {
+      NSUInteger missingCount = 0;
+      NSInteger result = [CSDocContainer verifyFileAtPath:onePath missingBlocks:&missingCount];
+      NSString *resultText;
+      if(result == CSDocContainerVerify_Intact)
+         resultText = NSLocalizedString(@"intact", @"");
+      else if(result == CSDocContainerVerify_Damaged)
+         resultText = [NSString stringWithFormat:NSLocalizedString(@"damaged, %lu block(s) lost", @""),
+                                                 (unsigned long) missingCount];
+      else if(result == CSDocContainerVerify_Unchecked)
+         resultText = NSLocalizedString(@"older format, can't be checked", @"");
+      else
+         resultText = NSLocalizedString(@"not a CiphSafe document", @"");
+      [report appendFormat:@"%@: %@\n", [onePath lastPathComponent], resultText];
+   }
+
+   NSAlert *resultAlert = [[[NSAlert alloc] init] autorelease];
+   [resultAlert setMessageText:NSLocalizedString(@"Document Verification", @"")];
+   [resultAlert setInformativeText:report];
+   [resultAlert runModal];
+}
+
+
+/*
+ * Query the bundle information to get the file types we can handle; this way
+ * it isn't hardcoded
+ */
+- (NSArray *) documentExtensions
+{
+   NSArray *docTypes = [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleDocumentTypes"];
+   NSMutableArray *extensionArray = [NSMutableArray arrayWithCapacity:4];
+   NSEnumerator *typeEnumerator = [docTypes objectEnumerator];
+   id typeDictionary;
+   while((typeDictionary = [typeEnumerator nextObject]) != nil)
+      [extensionArray addObjectsFromArray:[typeDictionary objectForKey:@"CFBundleTypeExtensions"]];
+
+   return extensionArray;
+}
+
+
 /*
  * Enable only valid menu items
  */
@@ -0,0 +1,64 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSAuditIndex.h */
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Groups of entries sharing a password, and of entries duplicating another's
+ * account and URL, kept up to date as entries come and go.  Entries are
+ * filed by name under an HMAC-SHA1 of the values, keyed with a secret made
+ * fresh for each index, so no values (passwords in particular) are ever kept
+ * here, and the hashes mean nothing outside this session.
+ */
+@interface CSAuditIndex : NSObject
+{
+   NSMutableData *sessionSecret;               // A CSSecureData, from randomDataOfLength:
+   NSMutableDictionary *namesByPasswordHash;   // NSData -> NSMutableSet of names
+   NSMutableDictionary *namesByRecordHash;     // Same, for account and URL
+}
+
+- (id) init;
+
+// Entries are the model's dictionaries, keyed by CSDocModelKey_*
+- (void) addEntry:(NSDictionary *)entry;
+- (void) removeEntry:(NSDictionary *)entry;
+
+// Arrays of arrays of names, each inner array holding two or more names
+- (NSArray *) reusedPasswordGroups;
+- (NSArray *) duplicateRecordGroups;
+
+// Names of all entries (including the given one) with the given entry's password
+- (NSArray *) namesSharingPasswordWithEntry:(NSDictionary *)entry;
+
+@end
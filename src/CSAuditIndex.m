@@ -0,0 +1,252 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSAuditIndex.m */
+
+#import "CSAuditIndex.h"
+#import "CSDocModel.h"
+#import "CSSecureData.h"
+#import "CSTextArena.h"
+#import "NSData_crypto.h"
+
+// Length of the per-index HMAC key
+static const NSUInteger CSAuditIndexSecretLength = 20;
+
+// Tags starting each hashed message, so the two kinds of hash never collide
+static const char CSAuditIndexTag_Password = 'P';
+static const char CSAuditIndexTag_Record = 'R';
+
+
+@interface CSAuditIndex (InternalMethods)
+- (NSData *) hashOfTag:(char)tag firstString:(NSString *)first secondString:(NSString *)second;
+- (NSData *) passwordHashForEntry:(NSDictionary *)entry;
+- (NSData *) recordHashForEntry:(NSDictionary *)entry;
+- (void) fileName:(NSString *)name underHash:(NSData *)hash inDictionary:(NSMutableDictionary *)hashDict;
+- (void) unfileName:(NSString *)name underHash:(NSData *)hash inDictionary:(NSMutableDictionary *)hashDict;
+- (NSArray *) groupsInDictionary:(NSDictionary *)hashDict;
+@end
+
+
+@implementation CSAuditIndex
+
+- (id) init
+{
+   self = [super init];
+   if(self != nil)
+   {
+      sessionSecret = [[NSData randomDataOfLength:CSAuditIndexSecretLength] retain];
+      if(sessionSecret == nil)
+      {
+         [self release];
+         return nil;
+      }
+      namesByPasswordHash = [[NSMutableDictionary alloc] initWithCapacity:25];
+      namesByRecordHash = [[NSMutableDictionary alloc] initWithCapacity:25];
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Updating
+/*
+ * File the entry's name under its hashes
+ */
+- (void) addEntry:(NSDictionary *)entry
+{
+   NSString *name = [entry objectForKey:CSDocModelKey_Name];
+   [self fileName:name underHash:[self passwordHashForEntry:entry] inDictionary:namesByPasswordHash];
+   [self fileName:name underHash:[self recordHashForEntry:entry] inDictionary:namesByRecordHash];
+}
+
+
+/*
+ * Take the entry's name out from under its hashes; the entry must still hold
+ * the values it was added with
+ */
+- (void) removeEntry:(NSDictionary *)entry
+{
+   NSString *name = [entry objectForKey:CSDocModelKey_Name];
+   [self unfileName:name underHash:[self passwordHashForEntry:entry] inDictionary:namesByPasswordHash];
+   [self unfileName:name underHash:[self recordHashForEntry:entry] inDictionary:namesByRecordHash];
+}
+
+
+#pragma mark -
+#pragma mark Queries
+- (NSArray *) reusedPasswordGroups
+{
+   return [self groupsInDictionary:namesByPasswordHash];
+}
+
+
+- (NSArray *) duplicateRecordGroups
+{
+   return [self groupsInDictionary:namesByRecordHash];
+}
+
+
+- (NSArray *) namesSharingPasswordWithEntry:(NSDictionary *)entry
+{
+   NSData *passwordHash = [self passwordHashForEntry:entry];
+   if(passwordHash == nil)
+      return [NSArray array];
+
+   return [[namesByPasswordHash objectForKey:passwordHash] allObjects];
+}
+
+
+#pragma mark -
+#pragma mark Hashing
+/*
+ * HMAC of the tag and the UTF-8 of both strings, NUL separated; the message is
+ * built in a secure buffer, and only the hash (in a plain NSData, as it's just
+ * a dictionary key) is kept
+ */
+- (NSData *) hashOfTag:(char)tag firstString:(NSString *)first secondString:(NSString *)second
+{
+   NSUInteger firstLength = [first lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+   NSUInteger secondLength = [second lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+   CSSecureData *message = [CSSecureData dataWithLength:firstLength + secondLength + 2];
+   char *messageBytes = [message mutableBytes];
+   messageBytes[0] = tag;
+   [first getBytes:messageBytes + 1
+         maxLength:firstLength
+        usedLength:NULL
+          encoding:NSUTF8StringEncoding
+           options:0
+             range:NSMakeRange(0, [first length])
+    remainingRange:NULL];
+   [second getBytes:messageBytes + firstLength + 2
+          maxLength:secondLength
+         usedLength:NULL
+           encoding:NSUTF8StringEncoding
+            options:0
+              range:NSMakeRange(0, [second length])
+     remainingRange:NULL];
+   NSData *hash = [message HMACSHA1WithKey:sessionSecret];
+   if(hash == nil)
+      return nil;
+
+   return [NSData dataWithBytes:[hash bytes] length:[hash length]];
+}
+
+
+/*
+ * An empty password isn't a reused one, so there's no hash for it
+ */
+- (NSData *) passwordHashForEntry:(NSDictionary *)entry
+{
+   NSString *password = [entry objectForKey:CSDocModelKey_Passwd];
+   if(password == nil || [password length] == 0)
+      return nil;
+
+   return [self hashOfTag:CSAuditIndexTag_Password firstString:password secondString:@""];
+}
+
+
+/*
+ * Account and URL are compared ignoring case, and entries with neither aren't
+ * duplicates of anything
+ */
+- (NSData *) recordHashForEntry:(NSDictionary *)entry
+{
+   NSString *account = [CSTextArena foldedString:[entry objectForKey:CSDocModelKey_Acct]];
+   NSString *url = [CSTextArena foldedString:[entry objectForKey:CSDocModelKey_URL]];
+   if([account length] == 0 && [url length] == 0)
+      return nil;
+
+   return [self hashOfTag:CSAuditIndexTag_Record firstString:account secondString:url];
+}
+
+
+#pragma mark -
+#pragma mark Buckets
+- (void) fileName:(NSString *)name underHash:(NSData *)hash inDictionary:(NSMutableDictionary *)hashDict
+{
+   if(name == nil || hash == nil)
+      return;
+
+   NSMutableSet *names = [hashDict objectForKey:hash];
+   if(names == nil)
+   {
+      names = [[NSMutableSet alloc] initWithCapacity:1];
+      [hashDict setObject:names forKey:hash];
+      [names release];
+   }
+   [names addObject:name];
+}
+
+
+- (void) unfileName:(NSString *)name underHash:(NSData *)hash inDictionary:(NSMutableDictionary *)hashDict
+{
+   if(name == nil || hash == nil)
+      return;
+
+   NSMutableSet *names = [hashDict objectForKey:hash];
+   [names removeObject:name];
+   if(names != nil && [names count] == 0)
+      [hashDict removeObjectForKey:hash];
+}
+
+
+/*
+ * One pass over the buckets, keeping those with more than one name
+ */
+- (NSArray *) groupsInDictionary:(NSDictionary *)hashDict
+{
+   NSMutableArray *groups = [NSMutableArray arrayWithCapacity:10];
+   NSEnumerator *namesEnumerator = [hashDict objectEnumerator];
+   id names;
+   while((names = [namesEnumerator nextObject]) != nil)
+   {
+      if([names count] > 1)
+         [groups addObject:[names allObjects]];
+   }
+
+   return groups;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [sessionSecret release];
+   [namesByPasswordHash release];
+   [namesByRecordHash release];
+   [super dealloc];
+}
+
+@end
@@ -0,0 +1,104 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSBackupStore.h */
+
+#import <Foundation/Foundation.h>
+
+// Keys in the dictionaries returned by -generations
+extern NSString * const CSBackupStoreKey_Generation;   // NSNumber, higher is newer
+extern NSString * const CSBackupStoreKey_Date;         // NSDate
+extern NSString * const CSBackupStoreKey_IsDocument;   // NSNumber (BOOL), a copy of the document file
+extern NSString * const CSBackupStoreKey_EntryCount;   // NSNumber, only for generations of entries
+
+/*
+ * Generational backups of a document, kept in a directory beside it.  Each
+ * generation is a manifest listing chunks of the entries; the chunks are cut
+ * where the content says to (so an edit only changes the chunks around it),
+ * named by a keyed hash of their content, and stored compressed and encrypted,
+ * once each no matter how many generations share them.  A new generation only
+ * costs the chunks which changed.
+ *
+ * A generation can instead be a copy of the document file as it was on disk,
+ * kept before a save replaces a file the store doesn't already hold (the first
+ * save with backups on, or after the file changed behind the store's back).
+ *
+ * Chunks are encrypted with, and named using, the document key, and manifests
+ * are signed with it; after a passphrase change, older generations need the
+ * old passphrase to restore.  Safe to use from any one thread at a time.
+ */
+@interface CSBackupStore : NSObject
+{
+   NSString *storePath;
+}
+
+// Where the backups of the document at the given path go
++ (NSString *) storePathForDocumentAtPath:(NSString *)docPath;
+
+- (id) initWithDocumentPath:(NSString *)docPath;
+
+/*
+ * Back up the given entries (a model's, or a snapshot) as a new generation,
+ * noting the contents of the document file they were just saved as (may be
+ * nil), then prune all but the given number of the newest generations;
+ * returns NO if the new generation couldn't be written
+ */
+- (BOOL) addGenerationWithEntries:(NSArray *)entries
+                     documentData:(NSData *)docData
+                              key:(NSData *)bfKey
+                 compressionCodec:(NSString *)codec
+                            level:(int)level
+               keepingGenerations:(NSUInteger)keepCount;
+
+/*
+ * Before a save replaces it, keep the document file at the given path as a
+ * generation of its own, unless there's no file or the newest generation is
+ * of just what the file holds; returns NO if it couldn't be kept
+ */
+- (BOOL) addGenerationWithDocumentAtPath:(NSString *)docPath
+                                     key:(NSData *)bfKey
+                      keepingGenerations:(NSUInteger)keepCount;
+
+// Dictionaries (see CSBackupStoreKey_*) for each generation, oldest first; no key needed
+- (NSArray *) generations;
+
+/*
+ * Entries of the given generation, or contents of the document file it kept;
+ * nil if it's gone, damaged, of the other sort, or from another key
+ */
+- (NSMutableArray *) entriesOfGeneration:(NSUInteger)generation withKey:(NSData *)bfKey;
+- (NSData *) documentDataOfGeneration:(NSUInteger)generation withKey:(NSData *)bfKey;
+
+// Delete all but the newest generations, and the chunks only they used
+- (void) pruneToGenerations:(NSUInteger)keepCount;
+
+@end
@@ -0,0 +1,671 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSBackupStore.m */
+
+#import "CSBackupStore.h"
+#import "CSDocModel.h"
+#import "CSEntrySerializer.h"
+#import "CSSecureData.h"
+#import "NSData_compress.h"
+#import "NSData_crypto.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+NSString * const CSBackupStoreKey_Generation = @"CSBackupStoreKey_Generation";
+NSString * const CSBackupStoreKey_Date = @"CSBackupStoreKey_Date";
+NSString * const CSBackupStoreKey_IsDocument = @"CSBackupStoreKey_IsDocument";
+NSString * const CSBackupStoreKey_EntryCount = @"CSBackupStoreKey_EntryCount";
+
+/*
+ * The store directory holds "chunks", with each chunk in a subdirectory named
+ * by the first two hex digits of its name, and "generations", one manifest
+ * for each: its HMAC-SHA1, then the property list itself.  A chunk file is an
+ * IV followed by the encrypted, compressed chunk.
+ */
+static NSString * const CSBackupStoreDir_Chunks = @"chunks";
+static NSString * const CSBackupStoreDir_Generations = @"generations";
+static NSString * const CSBackupStoreManifestExtension = @"manifest";
+
+// Keys in a manifest
+static NSString * const CSBackupStoreManifestKey_Version = @"version";
+static NSString * const CSBackupStoreManifestKey_Date = @"date";
+static NSString * const CSBackupStoreManifestKey_EntryCount = @"entryCount";
+static NSString * const CSBackupStoreManifestKey_Chunks = @"chunks";
+static NSString * const CSBackupStoreManifestKey_Kind = @"kind";
+static NSString * const CSBackupStoreManifestKey_DocumentHash = @"documentHash";
+
+// Values for the kind in a manifest
+static NSString * const CSBackupStoreKind_Entries = @"entries";
+static NSString * const CSBackupStoreKind_Document = @"document";
+
+static const NSInteger CSBackupStoreManifestVersion = 2;
+
+// Chunk names are keyed with this, under the document key, so they're good for nothing else
+static NSString * const CSBackupStoreChunkNameLabel = @"CiphSafe backup chunk name";
+// As are manifest signatures with this
+static NSString * const CSBackupStoreManifestLabel = @"CiphSafe backup manifest";
+
+/*
+ * Chunk boundaries come from a gear hash over the content: a boundary falls
+ * where the low bits of the hash are all zero, which happens every 8KB on
+ * average, never closer than 2KB or further than 64KB apart
+ */
+#define CSBACKUPSTORE_MIN_CHUNK (2 * 1024)
+#define CSBACKUPSTORE_MAX_CHUNK (64 * 1024)
+#define CSBACKUPSTORE_CHUNK_MASK ((1U << 13) - 1)
+#define CSBACKUPSTORE_IV_LENGTH 8
+#define CSBACKUPSTORE_MAC_LENGTH 20
+
+static uint32_t gearTable[256];
+
+static NSString *CSBackupStoreHexString(NSData *data);
+
+
+@interface CSBackupStore (InternalMethods)
++ (NSUInteger) lengthOfChunkAtBytes:(const unsigned char *)bytes length:(NSUInteger)length;
++ (NSData *) chunkNameKeyForKey:(NSData *)bfKey;
++ (NSData *) manifestKeyForKey:(NSData *)bfKey;
+- (NSArray *) storeChunksOfData:(NSData *)data
+                            key:(NSData *)bfKey
+               compressionCodec:(NSString *)codec
+                          level:(int)level
+                    fileManager:(NSFileManager *)fileManager;
+- (BOOL) addManifest:(NSDictionary *)manifest
+                 key:(NSData *)bfKey
+  keepingGenerations:(NSUInteger)keepCount
+         fileManager:(NSFileManager *)fileManager;
+- (NSMutableData *) dataOfGeneration:(NSUInteger)generation kind:(NSString *)kind withKey:(NSData *)bfKey;
+- (NSString *) pathForChunkNamed:(NSString *)chunkName;
+- (NSString *) pathForGeneration:(NSUInteger)generation;
+- (NSDictionary *) manifestForGeneration:(NSUInteger)generation withKey:(NSData *)bfKey;
+- (NSArray *) generationNumbers;
+- (BOOL) writeData:(NSData *)data toPath:(NSString *)path;
+@end
+
+
+@implementation CSBackupStore
+
+/*
+ * The gear table only has to be random looking and the same every run, so it
+ * comes from a fixed seed
+ */
++ (void) initialize
+{
+   uint32_t state = 0x43695068;   // "CiPh"
+   NSUInteger index;
+   for(index = 0; index < 256; index++)
+   {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      gearTable[index] = state;
+   }
+}
+
+
++ (NSString *) storePathForDocumentAtPath:(NSString *)docPath
+{
+   return [[docPath stringByDeletingLastPathComponent]
+           stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.backups", [docPath lastPathComponent]]];
+}
+
+
+- (id) initWithDocumentPath:(NSString *)docPath
+{
+   self = [super init];
+   if(self != nil)
+      storePath = [[CSBackupStore storePathForDocumentAtPath:docPath] retain];
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Chunking
+/*
+ * Length of the chunk starting at the given bytes
+ */
++ (NSUInteger) lengthOfChunkAtBytes:(const unsigned char *)bytes length:(NSUInteger)length
+{
+   if(length <= CSBACKUPSTORE_MIN_CHUNK)
+      return length;
+
+   NSUInteger limit = MIN(length, CSBACKUPSTORE_MAX_CHUNK);
+   uint32_t hash = 0;
+   NSUInteger index;
+   // Bytes before the minimum still go into the hash, so a boundary depends only on what's just before it
+   for(index = 0; index < CSBACKUPSTORE_MIN_CHUNK; index++)
+      hash = (hash << 1) + gearTable[bytes[index]];
+   for(; index < limit; index++)
+   {
+      hash = (hash << 1) + gearTable[bytes[index]];
+      if((hash & CSBACKUPSTORE_CHUNK_MASK) == 0)
+         return index + 1;
+   }
+
+   return limit;
+}
+
+
++ (NSData *) chunkNameKeyForKey:(NSData *)bfKey
+{
+   return [[CSBackupStoreChunkNameLabel dataUsingEncoding:NSUTF8StringEncoding] HMACSHA1WithKey:bfKey];
+}
+
+
++ (NSData *) manifestKeyForKey:(NSData *)bfKey
+{
+   return [[CSBackupStoreManifestLabel dataUsingEncoding:NSUTF8StringEncoding] HMACSHA1WithKey:bfKey];
+}
+
+
+#pragma mark -
+#pragma mark Generations
+/*
+ * The entries are chunked in order of their IDs, not as displayed, so a new
+ * sort order doesn't make every chunk new.  The document file's hash is named
+ * like a chunk, so it says nothing without the key either.
+ */
+- (BOOL) addGenerationWithEntries:(NSArray *)entries
+                     documentData:(NSData *)docData
+                              key:(NSData *)bfKey
+                 compressionCodec:(NSString *)codec
+                            level:(int)level
+               keepingGenerations:(NSUInteger)keepCount
+{
+   NSFileManager *fileManager = [[[NSFileManager alloc] init] autorelease];   // defaultManager is main thread only
+   NSArray *sortDescriptors = [NSArray arrayWithObject:[[[NSSortDescriptor alloc]
+                                                         initWithKey:CSDocModelKey_EntryID
+                                                           ascending:YES
+                                                            selector:@selector(compare:)] autorelease]];
+   // serializedData is CSSecureData, cleared when released
+   NSData *serializedData = [CSEntrySerializer serializedDataForEntries:
+                                                  [entries sortedArrayUsingDescriptors:sortDescriptors]];
+   if(serializedData == nil)
+      return NO;
+   NSArray *chunkNames = [self storeChunksOfData:serializedData
+                                             key:bfKey
+                                compressionCodec:codec
+                                           level:level
+                                     fileManager:fileManager];
+   if(chunkNames == nil)
+      return NO;
+
+   NSMutableDictionary *manifest = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                                        CSBackupStoreKind_Entries,
+                                                        CSBackupStoreManifestKey_Kind,
+                                                        [NSNumber numberWithUnsignedInteger:[entries count]],
+                                                        CSBackupStoreManifestKey_EntryCount,
+                                                        chunkNames,
+                                                        CSBackupStoreManifestKey_Chunks,
+                                                        nil];
+   if(docData != nil)
+      [manifest setObject:CSBackupStoreHexString([docData HMACSHA1WithKey:[CSBackupStore chunkNameKeyForKey:bfKey]])
+                   forKey:CSBackupStoreManifestKey_DocumentHash];
+
+   return [self addManifest:manifest key:bfKey keepingGenerations:keepCount fileManager:fileManager];
+}
+
+
+/*
+ * The file is already compressed and encrypted, so its chunks are just
+ * encrypted again, not compressed
+ */
+- (BOOL) addGenerationWithDocumentAtPath:(NSString *)docPath
+                                     key:(NSData *)bfKey
+                      keepingGenerations:(NSUInteger)keepCount
+{
+   NSFileManager *fileManager = [[[NSFileManager alloc] init] autorelease];
+   if(![fileManager fileExistsAtPath:docPath])
+      return YES;
+   NSData *docData = [NSData dataWithContentsOfFile:docPath options:NSMappedRead error:NULL];
+   if(docData == nil)
+      return NO;
+
+   NSString *docHash = CSBackupStoreHexString([docData HMACSHA1WithKey:[CSBackupStore chunkNameKeyForKey:bfKey]]);
+   NSNumber *lastGeneration = [[self generationNumbers] lastObject];
+   if(lastGeneration != nil
+      && [[[self manifestForGeneration:[lastGeneration unsignedIntegerValue] withKey:bfKey]
+           objectForKey:CSBackupStoreManifestKey_DocumentHash] isEqual:docHash])
+      return YES;
+
+   NSArray *chunkNames = [self storeChunksOfData:docData
+                                             key:bfKey
+                                compressionCodec:NSDataCompressionCodecZlib
+                                           level:NSDataCompressionLevelNone
+                                     fileManager:fileManager];
+   if(chunkNames == nil)
+      return NO;
+
+   NSDictionary *manifest = [NSDictionary dictionaryWithObjectsAndKeys:
+                                          CSBackupStoreKind_Document,
+                                          CSBackupStoreManifestKey_Kind,
+                                          docHash,
+                                          CSBackupStoreManifestKey_DocumentHash,
+                                          chunkNames,
+                                          CSBackupStoreManifestKey_Chunks,
+                                          nil];
+
+   return [self addManifest:manifest key:bfKey keepingGenerations:keepCount fileManager:fileManager];
+}
+
+
+/*
+ * Write whichever chunks of the data the store doesn't have yet, returning
+ * the names of them all, in order (nil on failure); a chunk already there
+ * under the same name has the same content
+ *
+ * XXX Chunk lengths follow the content, so the sizes of the chunk files say a
+ * little about where entries start and end
+ */
+- (NSArray *) storeChunksOfData:(NSData *)data
+                            key:(NSData *)bfKey
+               compressionCodec:(NSString *)codec
+                          level:(int)level
+                    fileManager:(NSFileManager *)fileManager
+{
+   NSDictionary *dirAttributes = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:0700]
+                                                             forKey:NSFilePosixPermissions];
+   if(![fileManager createDirectoryAtPath:[storePath stringByAppendingPathComponent:CSBackupStoreDir_Generations]
+              withIntermediateDirectories:YES
+                               attributes:dirAttributes
+                                    error:NULL])
+      return nil;
+
+   NSData *nameKey = [CSBackupStore chunkNameKeyForKey:bfKey];
+   // The compressed chunks are CSSecureData, cleared when released
+   const unsigned char *bytes = [data bytes];
+   NSUInteger length = [data length];
+   NSMutableArray *chunkNames = [NSMutableArray arrayWithCapacity:length / (CSBACKUPSTORE_CHUNK_MASK + 1) + 1];
+   NSUInteger offset = 0;
+   while(offset < length)
+   {
+      NSUInteger chunkLength = [CSBackupStore lengthOfChunkAtBytes:bytes + offset length:length - offset];
+      NSData *chunk = [NSData dataWithBytesNoCopy:(void *) (bytes + offset) length:chunkLength freeWhenDone:NO];
+      NSString *chunkName = CSBackupStoreHexString([chunk HMACSHA1WithKey:nameKey]);
+      NSString *chunkPath = [self pathForChunkNamed:chunkName];
+      if(![fileManager fileExistsAtPath:chunkPath])
+      {
+         NSMutableData *chunkFile = [NSData randomDataOfLength:CSBACKUPSTORE_IV_LENGTH];
+         if(chunkFile == nil)
+            return nil;
+         NSData *ceData = [[chunk compressedDataWithCodec:codec level:level]
+                           blowfishEncryptedDataWithKey:bfKey iv:chunkFile];
+         if(ceData == nil)
+            return nil;
+         [chunkFile appendData:ceData];
+         if(![fileManager createDirectoryAtPath:[chunkPath stringByDeletingLastPathComponent]
+                    withIntermediateDirectories:YES
+                                     attributes:dirAttributes
+                                          error:NULL]
+            || ![self writeData:chunkFile toPath:chunkPath])
+            return nil;
+      }
+      [chunkNames addObject:chunkName];
+      offset += chunkLength;
+   }
+
+   return chunkNames;
+}
+
+
+/*
+ * Date and sign the manifest, write it as the next generation, and prune
+ *
+ * XXX Manifests aren't encrypted, so generations can be listed and pruned
+ * without the key (even one from before a passphrase change); they give
+ * away only when each was made, how many entries it held, and which
+ * chunks generations share.  The signature is only checked when restoring.
+ */
+- (BOOL) addManifest:(NSDictionary *)manifest
+                 key:(NSData *)bfKey
+  keepingGenerations:(NSUInteger)keepCount
+         fileManager:(NSFileManager *)fileManager
+{
+   NSMutableDictionary *datedManifest = [NSMutableDictionary dictionaryWithDictionary:manifest];
+   [datedManifest setObject:[NSNumber numberWithInteger:CSBackupStoreManifestVersion]
+                     forKey:CSBackupStoreManifestKey_Version];
+   [datedManifest setObject:[NSDate date] forKey:CSBackupStoreManifestKey_Date];
+   NSData *plistData = [NSPropertyListSerialization dataFromPropertyList:datedManifest
+                                                                  format:NSPropertyListBinaryFormat_v1_0
+                                                        errorDescription:NULL];
+   NSMutableData *manifestData = [plistData HMACSHA1WithKey:[CSBackupStore manifestKeyForKey:bfKey]];
+   if(plistData == nil || [manifestData length] != CSBACKUPSTORE_MAC_LENGTH)
+      return NO;
+   [manifestData appendData:plistData];
+
+   NSNumber *lastGeneration = [[self generationNumbers] lastObject];
+   NSUInteger generation = (lastGeneration != nil ? [lastGeneration unsignedIntegerValue] + 1 : 1);
+   if(![self writeData:manifestData toPath:[self pathForGeneration:generation]])
+      return NO;
+
+   [self pruneToGenerations:keepCount];
+
+   return YES;
+}
+
+
+- (NSArray *) generations
+{
+   NSArray *generationNumbers = [self generationNumbers];
+   NSMutableArray *generations = [NSMutableArray arrayWithCapacity:[generationNumbers count]];
+   NSEnumerator *generationEnumerator = [generationNumbers objectEnumerator];
+   id oneGeneration;
+   while((oneGeneration = [generationEnumerator nextObject]) != nil)
+   {
+      NSDictionary *manifest = [self manifestForGeneration:[oneGeneration unsignedIntegerValue] withKey:nil];
+      if(manifest != nil)
+      {
+         BOOL isDocument = [[manifest objectForKey:CSBackupStoreManifestKey_Kind]
+                            isEqual:CSBackupStoreKind_Document];
+         NSMutableDictionary *generationInfo = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                                                    oneGeneration,
+                                                                    CSBackupStoreKey_Generation,
+                                                                    [NSNumber numberWithBool:isDocument],
+                                                                    CSBackupStoreKey_IsDocument,
+                                                                    nil];
+         if([manifest objectForKey:CSBackupStoreManifestKey_Date] != nil)
+            [generationInfo setObject:[manifest objectForKey:CSBackupStoreManifestKey_Date]
+                               forKey:CSBackupStoreKey_Date];
+         if(!isDocument && [manifest objectForKey:CSBackupStoreManifestKey_EntryCount] != nil)
+            [generationInfo setObject:[manifest objectForKey:CSBackupStoreManifestKey_EntryCount]
+                               forKey:CSBackupStoreKey_EntryCount];
+         [generations addObject:generationInfo];
+      }
+   }
+
+   return generations;
+}
+
+
+- (NSMutableArray *) entriesOfGeneration:(NSUInteger)generation withKey:(NSData *)bfKey
+{
+   NSMutableData *serializedData = [self dataOfGeneration:generation
+                                                     kind:CSBackupStoreKind_Entries
+                                                  withKey:bfKey];
+   if(serializedData == nil)
+      return nil;
+
+   return [CSEntrySerializer entriesFromData:serializedData];
+}
+
+
+- (NSData *) documentDataOfGeneration:(NSUInteger)generation withKey:(NSData *)bfKey
+{
+   return [self dataOfGeneration:generation kind:CSBackupStoreKind_Document withKey:bfKey];
+}
+
+
+/*
+ * Put the chunks of a generation of the given kind back together, checking
+ * the manifest's signature, and each chunk against its name; either also
+ * catches a generation from another key
+ */
+- (NSMutableData *) dataOfGeneration:(NSUInteger)generation kind:(NSString *)kind withKey:(NSData *)bfKey
+{
+   NSDictionary *manifest = [self manifestForGeneration:generation withKey:bfKey];
+   if(![[manifest objectForKey:CSBackupStoreManifestKey_Kind] isEqual:kind])
+      return nil;
+
+   NSArray *chunkNames = [manifest objectForKey:CSBackupStoreManifestKey_Chunks];
+   NSData *nameKey = [CSBackupStore chunkNameKeyForKey:bfKey];
+   NSMutableData *generationData = [CSSecureData dataWithCapacity:[chunkNames count] * 8192];
+   NSEnumerator *chunkEnumerator = [chunkNames objectEnumerator];
+   id oneChunkName;
+   while((oneChunkName = [chunkEnumerator nextObject]) != nil)
+   {
+      NSData *chunkFile = nil;
+      if([oneChunkName isKindOfClass:[NSString class]] && [oneChunkName length] == 2 * 20)
+         chunkFile = [NSData dataWithContentsOfFile:[self pathForChunkNamed:oneChunkName]];
+      if([chunkFile length] <= CSBACKUPSTORE_IV_LENGTH)
+         return nil;
+
+      NSData *chunkIV = [chunkFile subdataWithRange:NSMakeRange(0, CSBACKUPSTORE_IV_LENGTH)];
+      NSData *ceData = [chunkFile subdataWithRange:NSMakeRange(CSBACKUPSTORE_IV_LENGTH,
+                                                               [chunkFile length] - CSBACKUPSTORE_IV_LENGTH)];
+      NSMutableData *chunk = [[ceData blowfishDecryptedDataWithKey:bfKey iv:chunkIV] uncompressedData];
+      if(chunk == nil || ![CSBackupStoreHexString([chunk HMACSHA1WithKey:nameKey]) isEqualToString:oneChunkName])
+      {
+#if defined(DEBUG)
+         NSLog(@"CSBackupStore dataOfGeneration:kind:withKey: chunk %@ of generation %lu is bad",
+               oneChunkName, (unsigned long) generation);
+#endif
+         return nil;
+      }
+      [generationData appendData:chunk];
+   }
+
+   return generationData;
+}
+
+
+/*
+ * Drop the oldest manifests, then sweep out any chunk no remaining manifest
+ * names
+ */
+- (void) pruneToGenerations:(NSUInteger)keepCount
+{
+   NSFileManager *fileManager = [[NSFileManager alloc] init];
+   NSArray *generationNumbers = [self generationNumbers];
+   NSUInteger index;
+   for(index = 0; index + keepCount < [generationNumbers count]; index++)
+      [fileManager removeItemAtPath:[self pathForGeneration:[[generationNumbers objectAtIndex:index]
+                                                             unsignedIntegerValue]]
+                              error:NULL];
+
+   NSMutableSet *liveChunks = [NSMutableSet setWithCapacity:100];
+   BOOL manifestsReadable = YES;
+   for(; index < [generationNumbers count]; index++)
+   {
+      NSArray *chunkNames = [[self manifestForGeneration:[[generationNumbers objectAtIndex:index]
+                                                          unsignedIntegerValue]
+                                                 withKey:nil]
+                             objectForKey:CSBackupStoreManifestKey_Chunks];
+      if(chunkNames != nil)
+         [liveChunks addObjectsFromArray:chunkNames];
+      else
+         manifestsReadable = NO;
+   }
+
+   // A manifest which can't be read might still name chunks, so sweep nothing
+   if(manifestsReadable)
+   {
+      NSString *chunksPath = [storePath stringByAppendingPathComponent:CSBackupStoreDir_Chunks];
+      NSEnumerator *chunkEnumerator = [fileManager enumeratorAtPath:chunksPath];
+      id oneChunkPath;
+      while((oneChunkPath = [chunkEnumerator nextObject]) != nil)
+      {
+         NSString *chunkName = [oneChunkPath lastPathComponent];
+         if([chunkName length] == 2 * 20 && ![liveChunks containsObject:chunkName])
+            [fileManager removeItemAtPath:[chunksPath stringByAppendingPathComponent:oneChunkPath] error:NULL];
+      }
+   }
+   [fileManager release];
+}
+
+
+#pragma mark -
+#pragma mark Files
+- (NSString *) pathForChunkNamed:(NSString *)chunkName
+{
+   return [[[storePath stringByAppendingPathComponent:CSBackupStoreDir_Chunks]
+            stringByAppendingPathComponent:[chunkName substringToIndex:2]]
+           stringByAppendingPathComponent:chunkName];
+}
+
+
+- (NSString *) pathForGeneration:(NSUInteger)generation
+{
+   NSString *manifestName = [[NSString stringWithFormat:@"%08lu", (unsigned long) generation]
+                             stringByAppendingPathExtension:CSBackupStoreManifestExtension];
+
+   return [[storePath stringByAppendingPathComponent:CSBackupStoreDir_Generations]
+           stringByAppendingPathComponent:manifestName];
+}
+
+
+/*
+ * Read a manifest, checking its signature if given the key
+ */
+- (NSDictionary *) manifestForGeneration:(NSUInteger)generation withKey:(NSData *)bfKey
+{
+   NSData *manifestData = [NSData dataWithContentsOfFile:[self pathForGeneration:generation]];
+   if([manifestData length] <= CSBACKUPSTORE_MAC_LENGTH)
+      return nil;
+
+   NSData *plistData = [manifestData subdataWithRange:NSMakeRange(CSBACKUPSTORE_MAC_LENGTH,
+                                                                  [manifestData length] - CSBACKUPSTORE_MAC_LENGTH)];
+   if(bfKey != nil
+      && ![[plistData HMACSHA1WithKey:[CSBackupStore manifestKeyForKey:bfKey]]
+           isEqualToData:[manifestData subdataWithRange:NSMakeRange(0, CSBACKUPSTORE_MAC_LENGTH)]])
+   {
+#if defined(DEBUG)
+      NSLog(@"CSBackupStore manifestForGeneration:withKey: generation %lu fails its signature",
+            (unsigned long) generation);
+#endif
+      return nil;
+   }
+
+   NSDictionary *manifest = [NSPropertyListSerialization propertyListFromData:plistData
+                                                             mutabilityOption:NSPropertyListImmutable
+                                                                       format:NULL
+                                                             errorDescription:NULL];
+   if(![manifest isKindOfClass:[NSDictionary class]]
+      || [[manifest objectForKey:CSBackupStoreManifestKey_Version] integerValue] != CSBackupStoreManifestVersion
+      || ![[manifest objectForKey:CSBackupStoreManifestKey_Chunks] isKindOfClass:[NSArray class]])
+      return nil;
+
+   return manifest;
+}
+
+
+/*
+ * Numbers of the generations in the store, oldest first
+ */
+- (NSArray *) generationNumbers
+{
+   NSFileManager *fileManager = [[NSFileManager alloc] init];
+   NSArray *manifestNames = [fileManager contentsOfDirectoryAtPath:
+                             [storePath stringByAppendingPathComponent:CSBackupStoreDir_Generations]
+                                                             error:NULL];
+   [fileManager release];
+   NSMutableArray *generationNumbers = [NSMutableArray arrayWithCapacity:[manifestNames count]];
+   NSEnumerator *nameEnumerator = [manifestNames objectEnumerator];
+   id oneName;
+   while((oneName = [nameEnumerator nextObject]) != nil)
+   {
+      if([[oneName pathExtension] isEqualToString:CSBackupStoreManifestExtension])
+      {
+         NSInteger generation = [[oneName stringByDeletingPathExtension] integerValue];
+         if(generation > 0)
+            [generationNumbers addObject:[NSNumber numberWithUnsignedInteger:generation]];
+      }
+   }
+   [generationNumbers sortUsingSelector:@selector(compare:)];
+
+   return generationNumbers;
+}
+
+
+/*
+ * Write to a temporary file beside the target, then rename it into place, as
+ * CSDocSaver does; mkstemp creates it mode 0600, so it's never readable by
+ * anyone else, even for a moment
+ */
+- (BOOL) writeData:(NSData *)data toPath:(NSString *)path
+{
+   NSString *tempTemplate = [[path stringByDeletingLastPathComponent]
+                             stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.XXXXXX",
+                                                                      [path lastPathComponent]]];
+   char *tempPath = strdup([tempTemplate fileSystemRepresentation]);
+   int tempFD = mkstemp(tempPath);
+   if(tempFD == -1)
+   {
+      free(tempPath);
+      return NO;
+   }
+
+   BOOL writeOK = YES;
+   const char *bytes = [data bytes];
+   size_t remaining = [data length];
+   while(writeOK && remaining > 0)
+   {
+      ssize_t written = write(tempFD, bytes, remaining);
+      if(written < 0)
+      {
+         if(errno != EINTR)
+            writeOK = NO;
+      }
+      else
+      {
+         bytes += written;
+         remaining -= written;
+      }
+   }
+   if(writeOK && fsync(tempFD) != 0)
+      writeOK = NO;
+   if(close(tempFD) != 0)
+      writeOK = NO;
+   if(writeOK && rename(tempPath, [path fileSystemRepresentation]) != 0)
+      writeOK = NO;
+   if(!writeOK)
+      unlink(tempPath);
+   free(tempPath);
+
+   return writeOK;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [storePath release];
+   [super dealloc];
+}
+
+@end
+
+
+static NSString *CSBackupStoreHexString(NSData *data)
+{
+   const unsigned char *bytes = [data bytes];
+   NSMutableString *hexString = [NSMutableString stringWithCapacity:[data length] * 2];
+   NSUInteger index;
+   for(index = 0; index < [data length]; index++)
+      [hexString appendFormat:@"%02x", bytes[index]];
+
+   return hexString;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocContainer.h */
+
+#import <Foundation/Foundation.h>
+#import "NSData_crypto.h"
+
+/*
+ * Version numbers for the on-disk document format:
+ *    Legacy   - 8-byte IV followed by the encrypted, compressed archive
+ *    KeyCheck - a header (magic, version, key check) ahead of the same
+ *    Blocks   - a header (magic, version, key check, block count, HMAC,
+ *               checksum) followed by blocks of entries, each compressed and
+ *               encrypted on its own, with its own checksum and HMAC
+ */
+extern const NSInteger CSDocContainerVersion_Legacy;
+extern const NSInteger CSDocContainerVersion_KeyCheck;
+extern const NSInteger CSDocContainerVersion_Blocks;
+
+/*
+ * Results of verifyFileAtPath:missingBlocks:; Unchecked is an older format,
+ * with no checksums to verify
+ */
+extern const NSInteger CSDocContainerVerify_Intact;
+extern const NSInteger CSDocContainerVerify_Damaged;
+extern const NSInteger CSDocContainerVerify_Unchecked;
+extern const NSInteger CSDocContainerVerify_NotDocument;
+
+/*
+ * Reads and writes the on-disk form of a document, everything outside the
+ * compressed archives of entries themselves
+ */
+@interface CSDocContainer : NSObject
+{
+   NSData *fileData;
+   NSInteger version;
+   NSData *keyCheckSalt;
+   NSData *keyCheckValue;
+   NSData *iv;   // Legacy and KeyCheck only
+   NSRange payloadRange;
+   NSUInteger blockCount;
+   BOOL headerIntact;
+   NSRange indexRange;     // Blocks only, length 0 if there's no index section
+   NSData *payloadHash;    // Once the blocks pass a strict scan
+}
+
+/*
+ * Encrypt each of the compressed payload blocks with the given key, returning
+ * the file contents; the compressed index payload (see CSDocIndex), if not
+ * nil, goes in a section after the blocks, tied to them by a hash
+ */
++ (NSData *) containerDataWithPayloadBlocks:(NSArray *)payloadBlocks key:(NSData *)bfKey;
++ (NSData *) containerDataWithPayloadBlocks:(NSArray *)payloadBlocks
+                               indexPayload:(NSData *)indexPayload
+                                        key:(NSData *)bfKey;
+
+/*
+ * Check the checksum of the header and every block of the given file, in one
+ * pass over a mapping of the file, without needing the passphrase;
+ * missingCount (may be NULL) gets how many blocks are damaged or gone
+ */
++ (NSInteger) verifyFileAtPath:(NSString *)path missingBlocks:(NSUInteger *)missingCount;
+
+// Returns nil if the data is obviously not a document
+- (id) initWithData:(NSData *)data;
+
+- (NSInteger) version;
+
+// Quick check whether the key could open this document
+- (BOOL) isPossibleKey:(NSData *)bfKey;
+
+/*
+ * Decrypt the payload, as an array of compressed blocks (just the one for the
+ * older formats), optionally reporting progress (see NSData_crypto.h); nil if
+ * any of it is damaged
+ */
+- (NSArray *) payloadBlocksDecryptedWithKey:(NSData *)bfKey;
+- (NSArray *) payloadBlocksDecryptedWithKey:(NSData *)bfKey
+                           progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                                    context:(void *)context;
+
+/*
+ * Whether the format allows salvaging the intact blocks of a damaged
+ * document, and doing so; missingCount (may be NULL) gets how many blocks
+ * were lost
+ */
+- (BOOL) canRecoverBlocks;
+- (NSArray *) intactPayloadBlocksDecryptedWithKey:(NSData *)bfKey missingBlocks:(NSUInteger *)missingCount;
+
+/*
+ * Decrypt the index section, only if there is one and it was saved along with
+ * exactly these blocks; nil otherwise
+ */
+- (NSMutableData *) indexPayloadDecryptedWithKey:(NSData *)bfKey;
+
+@end
@@ -0,0 +1,855 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocContainer.m */
+
+#import "CSDocContainer.h"
+#import "NSData_compress.h"
+#include <openssl/sha.h>
+
+const NSInteger CSDocContainerVersion_Legacy = 1;
+const NSInteger CSDocContainerVersion_KeyCheck = 2;
+const NSInteger CSDocContainerVersion_Blocks = 3;
+
+const NSInteger CSDocContainerVerify_Intact = 0;
+const NSInteger CSDocContainerVerify_Damaged = 1;
+const NSInteger CSDocContainerVerify_Unchecked = 2;
+const NSInteger CSDocContainerVerify_NotDocument = 3;
+
+/*
+ * Every header starts with the magic and the version (4 bytes, big-endian).
+ * KeyCheck follows that with the key check's salt and value, then the IV,
+ * and the encrypted payload.  Blocks follows it with the key check's salt and
+ * value, the block count (4 bytes, big-endian), an HMAC-SHA1 of everything
+ * before it, and a SHA-1 of everything before that; then come the blocks, and
+ * maybe an index section.
+ *
+ * Every HMAC in a Blocks document is keyed with a MAC key derived from the
+ * document key (see MACKeyForKey:), never the document key itself.
+ */
+static const char containerMagic[] = { 'C', 'i', 'p', 'h', 'S', 'a', 'f', 'e' };
+#define CSDOCCONTAINER_SALT_LENGTH 8
+#define CSDOCCONTAINER_CHECK_LENGTH 8
+#define CSDOCCONTAINER_IV_LENGTH 8
+#define CSDOCCONTAINER_PREFIX_LENGTH (sizeof(containerMagic) + sizeof(uint32_t))
+#define CSDOCCONTAINER_HEADER_LENGTH (CSDOCCONTAINER_PREFIX_LENGTH + CSDOCCONTAINER_SALT_LENGTH \
+                                      + CSDOCCONTAINER_CHECK_LENGTH + CSDOCCONTAINER_IV_LENGTH)
+/*
+ * The Blocks header's HMAC-SHA1 covers everything before it, block count
+ * included, so blocks can't be cut off the end with the count rewritten to
+ * match; the SHA-1 after it covers the lot, HMAC included
+ */
+#define CSDOCCONTAINER_BLOCKS_MACED_LENGTH (CSDOCCONTAINER_PREFIX_LENGTH + CSDOCCONTAINER_SALT_LENGTH \
+                                            + CSDOCCONTAINER_CHECK_LENGTH + sizeof(uint32_t))
+#define CSDOCCONTAINER_BLOCKS_HEADER_LENGTH (CSDOCCONTAINER_BLOCKS_MACED_LENGTH + 2 * SHA_DIGEST_LENGTH)
+
+/*
+ * Each block is the marker, the SHA-1 of the checked part, the HMAC-SHA1 of
+ * the header's salt followed by the checked part, then the checked part: the
+ * block's index and ciphertext length (4 bytes each, big-endian), its IV, and
+ * the ciphertext.  The SHA-1 catches damage without the passphrase, the HMAC
+ * catches tampering with it, and the marker lets a damaged stretch be skipped
+ * over to the next block.  The salt is new with every save, so a block from
+ * another save (or another copy) of the document doesn't pass in this one,
+ * even at the same index.
+ */
+static const char blockMarker[] = { 'C', 'S', 'b', 'k' };
+#define CSDOCCONTAINER_FRAME_SHA_OFFSET sizeof(blockMarker)
+#define CSDOCCONTAINER_FRAME_HMAC_OFFSET (CSDOCCONTAINER_FRAME_SHA_OFFSET + SHA_DIGEST_LENGTH)
+#define CSDOCCONTAINER_FRAME_CHECKED_OFFSET (CSDOCCONTAINER_FRAME_HMAC_OFFSET + SHA_DIGEST_LENGTH)
+#define CSDOCCONTAINER_FRAME_IV_OFFSET (CSDOCCONTAINER_FRAME_CHECKED_OFFSET + 2 * sizeof(uint32_t))
+#define CSDOCCONTAINER_FRAME_HEADER_LENGTH (CSDOCCONTAINER_FRAME_IV_OFFSET + CSDOCCONTAINER_IV_LENGTH)
+
+/*
+ * The index section, if any, follows the last block: the SHA-1 of the checked
+ * part and the HMAC-SHA1 of the salt and checked part (as for a block), then
+ * the checked part, the payload hash (a SHA-1 over every block's SHA-1,
+ * in order), IV, and ciphertext.  After it comes the trailer, the section's
+ * length (4 bytes, big-endian) and the index marker, so it can be found from
+ * the end of the file.
+ */
+static const char indexMarker[] = { 'C', 'S', 'i', 'x' };
+#define CSDOCCONTAINER_INDEX_HMAC_OFFSET SHA_DIGEST_LENGTH
+#define CSDOCCONTAINER_INDEX_CHECKED_OFFSET (CSDOCCONTAINER_INDEX_HMAC_OFFSET + SHA_DIGEST_LENGTH)
+#define CSDOCCONTAINER_INDEX_IV_OFFSET (CSDOCCONTAINER_INDEX_CHECKED_OFFSET + SHA_DIGEST_LENGTH)
+#define CSDOCCONTAINER_INDEX_HEADER_LENGTH (CSDOCCONTAINER_INDEX_IV_OFFSET + CSDOCCONTAINER_IV_LENGTH)
+#define CSDOCCONTAINER_TRAILER_LENGTH (sizeof(uint32_t) + sizeof(indexMarker))
+
+// Goes into the key check along with the salt, so the check is good for nothing else
+static NSString * const CSDocContainerKeyCheckLabel = @"CiphSafe key check";
+
+// The MAC key is the HMAC of this under the document key
+static NSString * const CSDocContainerMACKeyLabel = @"CiphSafe document MAC key";
+
+// Where a block was found in the file
+typedef struct
+{
+   NSUInteger frameOffset;
+   NSUInteger cipherLength;
+   uint32_t index;
+} CSDocContainerBlock;
+
+// Scales one block's decryption progress into that of the whole payload
+typedef struct
+{
+   NSDataCryptoProgressFunction function;
+   void *context;
+   double base;
+   double scale;
+} CSDocContainerProgress;
+
+static BOOL CSDocContainerBlockProgress(double fractionDone, void *context);
+static BOOL CSDocContainerEqualBytes(const void *bytes1, const void *bytes2, NSUInteger length);
+static uint32_t CSDocContainerReadUInt32(const unsigned char *bytes);
+
+
+@interface CSDocContainer (InternalMethods)
++ (NSData *) keyCheckForKey:(NSData *)bfKey salt:(NSData *)salt;
++ (NSData *) MACKeyForKey:(NSData *)bfKey;
+- (BOOL) getIntactBlock:(CSDocContainerBlock *)block atOffset:(NSUInteger)offset;
+- (BOOL) isIndexIntact;
+- (BOOL) isHeaderAuthenticWithKey:(NSData *)bfKey;
+- (NSData *) blocksScannedStrictly:(BOOL)strict missingBlocks:(NSUInteger *)missingCount;
+- (NSMutableData *) decryptBlock:(const CSDocContainerBlock *)block
+                         withKey:(NSData *)bfKey
+                progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                         context:(void *)context;
+@end
+
+
+@implementation CSDocContainer
+
+#pragma mark -
+#pragma mark Writing
+/*
+ * The key check is a truncated HMAC of the salt and label, keyed with the
+ * document key
+ *
+ * XXX This lets a passphrase guess be tested without decrypting anything, but
+ * a guess could already be tested by decrypting the first block and looking
+ * for a compression header, and either way costs the same key derivation
+ */
++ (NSData *) keyCheckForKey:(NSData *)bfKey salt:(NSData *)salt
+{
+   NSMutableData *message = [NSMutableData dataWithData:salt];
+   [message appendData:[CSDocContainerKeyCheckLabel dataUsingEncoding:NSUTF8StringEncoding]];
+   NSMutableData *keyCheck = [message HMACSHA1WithKey:bfKey];
+   [keyCheck setLength:CSDOCCONTAINER_CHECK_LENGTH];
+
+   return keyCheck;
+}
+
+
+/*
+ * The key for the HMACs, so the document key itself only ever keys Blowfish
+ * and the key check
+ */
++ (NSData *) MACKeyForKey:(NSData *)bfKey
+{
+   return [[CSDocContainerMACKeyLabel dataUsingEncoding:NSUTF8StringEncoding] HMACSHA1WithKey:bfKey];
+}
+
+
++ (NSData *) containerDataWithPayloadBlocks:(NSArray *)payloadBlocks key:(NSData *)bfKey
+{
+   return [self containerDataWithPayloadBlocks:payloadBlocks indexPayload:nil key:bfKey];
+}
+
+
+/*
+ * Put the current header on, then encrypt each block with a fresh IV and frame
+ * it with its checksums, then the same for the index
+ */
++ (NSData *) containerDataWithPayloadBlocks:(NSArray *)payloadBlocks
+                               indexPayload:(NSData *)indexPayload
+                                        key:(NSData *)bfKey
+{
+   NSData *salt = [NSData randomDataOfLength:CSDOCCONTAINER_SALT_LENGTH];
+   NSData *macKey = [self MACKeyForKey:bfKey];
+   if(salt == nil || macKey == nil)
+      return nil;
+
+   NSMutableData *containerData = [NSMutableData dataWithCapacity:CSDOCCONTAINER_BLOCKS_HEADER_LENGTH];
+   [containerData appendBytes:containerMagic length:sizeof(containerMagic)];
+   uint32_t valueBE = CFSwapInt32HostToBig(CSDocContainerVersion_Blocks);
+   [containerData appendBytes:&valueBE length:sizeof(valueBE)];
+   [containerData appendData:salt];
+   [containerData appendData:[self keyCheckForKey:bfKey salt:salt]];
+   valueBE = CFSwapInt32HostToBig((uint32_t) [payloadBlocks count]);
+   [containerData appendBytes:&valueBE length:sizeof(valueBE)];
+   NSData *headerMAC = [containerData HMACSHA1WithKey:macKey];
+   if([headerMAC length] != SHA_DIGEST_LENGTH)
+      return nil;
+   [containerData appendData:headerMAC];
+   unsigned char checksum[SHA_DIGEST_LENGTH];
+   SHA1([containerData bytes], [containerData length], checksum);
+   [containerData appendBytes:checksum length:sizeof(checksum)];
+
+   SHA_CTX payloadHashContext;
+   SHA1_Init(&payloadHashContext);
+   uint32_t index;
+   for(index = 0; index < [payloadBlocks count]; index++)
+   {
+      NSData *newIV = [NSData randomDataOfLength:CSDOCCONTAINER_IV_LENGTH];
+      if(newIV == nil)
+         return nil;
+      NSData *ceData = [[payloadBlocks objectAtIndex:index] blowfishEncryptedDataWithKey:bfKey iv:newIV];
+      if(ceData == nil)
+         return nil;
+
+      NSMutableData *checkedPart = [NSMutableData dataWithCapacity:CSDOCCONTAINER_FRAME_HEADER_LENGTH
+                                                                   + [ceData length]];
+      valueBE = CFSwapInt32HostToBig(index);
+      [checkedPart appendBytes:&valueBE length:sizeof(valueBE)];
+      valueBE = CFSwapInt32HostToBig((uint32_t) [ceData length]);
+      [checkedPart appendBytes:&valueBE length:sizeof(valueBE)];
+      [checkedPart appendData:newIV];
+      [checkedPart appendData:ceData];
+      NSData *hmac = [checkedPart HMACSHA1WithKey:macKey prefix:salt];
+      if([hmac length] != SHA_DIGEST_LENGTH)
+         return nil;
+      SHA1([checkedPart bytes], [checkedPart length], checksum);
+      SHA1_Update(&payloadHashContext, checksum, sizeof(checksum));
+      [containerData appendBytes:blockMarker length:sizeof(blockMarker)];
+      [containerData appendBytes:checksum length:sizeof(checksum)];
+      [containerData appendData:hmac];
+      [containerData appendData:checkedPart];
+   }
+   unsigned char payloadHashBytes[SHA_DIGEST_LENGTH];
+   SHA1_Final(payloadHashBytes, &payloadHashContext);
+
+   /*
+    * XXX The index section's length gives away roughly how many entries there
+    * are, but the blocks already say about as much
+    */
+   if(indexPayload != nil)
+   {
+      NSData *newIV = [NSData randomDataOfLength:CSDOCCONTAINER_IV_LENGTH];
+      if(newIV == nil)
+         return nil;
+      NSData *ceData = [indexPayload blowfishEncryptedDataWithKey:bfKey iv:newIV];
+      if(ceData == nil)
+         return nil;
+
+      NSMutableData *checkedPart = [NSMutableData dataWithCapacity:CSDOCCONTAINER_INDEX_HEADER_LENGTH
+                                                                   + [ceData length]];
+      [checkedPart appendBytes:payloadHashBytes length:sizeof(payloadHashBytes)];
+      [checkedPart appendData:newIV];
+      [checkedPart appendData:ceData];
+      NSData *hmac = [checkedPart HMACSHA1WithKey:macKey prefix:salt];
+      if([hmac length] != SHA_DIGEST_LENGTH)
+         return nil;
+      SHA1([checkedPart bytes], [checkedPart length], checksum);
+      [containerData appendBytes:checksum length:sizeof(checksum)];
+      [containerData appendData:hmac];
+      [containerData appendData:checkedPart];
+      valueBE = CFSwapInt32HostToBig((uint32_t) (CSDOCCONTAINER_INDEX_CHECKED_OFFSET + [checkedPart length]));
+      [containerData appendBytes:&valueBE length:sizeof(valueBE)];
+      [containerData appendBytes:indexMarker length:sizeof(indexMarker)];
+   }
+
+   return containerData;
+}
+
+
+#pragma mark -
+#pragma mark Verifying
+/*
+ * The file is mapped, not read in, so only the pages being checked at the
+ * moment take up memory; the pool keeps checking thousands of files in a row
+ * from piling anything up
+ */
++ (NSInteger) verifyFileAtPath:(NSString *)path missingBlocks:(NSUInteger *)missingCount
+{
+   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+   NSInteger result = CSDocContainerVerify_NotDocument;
+   NSUInteger missing = 0;
+   NSData *mappedData = [NSData dataWithContentsOfFile:path options:NSMappedRead error:NULL];
+   CSDocContainer *container = nil;
+   if(mappedData != nil)
+      container = [[CSDocContainer alloc] initWithData:mappedData];
+   if(container != nil)
+   {
+      if([container version] != CSDocContainerVersion_Blocks)
+         result = CSDocContainerVerify_Unchecked;
+      else
+      {
+         [container blocksScannedStrictly:NO missingBlocks:&missing];
+         if(missing == 0 && container->headerIntact && [container isIndexIntact])
+            result = CSDocContainerVerify_Intact;
+         else
+            result = CSDocContainerVerify_Damaged;
+      }
+      [container release];
+   }
+   [pool release];
+
+   if(missingCount != NULL)
+      *missingCount = missing;
+
+   return result;
+}
+
+
+#pragma mark -
+#pragma mark Reading
+/*
+ * Figure out which format the data is in and where the pieces are; a legacy
+ * document has no header, just the IV.  A damaged header on a Blocks document
+ * doesn't keep it from being read, so whatever blocks are intact can be
+ * recovered.
+ */
+- (id) initWithData:(NSData *)data
+{
+   self = [super init];
+   if(self != nil)
+   {
+      fileData = [data retain];
+      keyCheckSalt = nil;
+      keyCheckValue = nil;
+      iv = nil;
+      version = 0;
+      blockCount = 1;
+      headerIntact = YES;
+      indexRange = NSMakeRange(0, 0);
+      payloadHash = nil;
+      const unsigned char *bytes = [data bytes];
+      if([data length] >= CSDOCCONTAINER_PREFIX_LENGTH
+         && memcmp(bytes, containerMagic, sizeof(containerMagic)) == 0)
+      {
+         NSUInteger offset = sizeof(containerMagic);
+         version = CSDocContainerReadUInt32(bytes + offset);
+         offset += sizeof(uint32_t);
+         if((version == CSDocContainerVersion_KeyCheck && [data length] >= CSDOCCONTAINER_HEADER_LENGTH)
+            || (version == CSDocContainerVersion_Blocks && [data length] >= CSDOCCONTAINER_BLOCKS_HEADER_LENGTH))
+         {
+            keyCheckSalt = [[data subdataWithRange:NSMakeRange(offset, CSDOCCONTAINER_SALT_LENGTH)] retain];
+            offset += CSDOCCONTAINER_SALT_LENGTH;
+            keyCheckValue = [[data subdataWithRange:NSMakeRange(offset, CSDOCCONTAINER_CHECK_LENGTH)] retain];
+            offset += CSDOCCONTAINER_CHECK_LENGTH;
+         }
+         else
+            version = 0;
+         if(version == CSDocContainerVersion_KeyCheck)
+         {
+            iv = [[data subdataWithRange:NSMakeRange(offset, CSDOCCONTAINER_IV_LENGTH)] retain];
+            offset += CSDOCCONTAINER_IV_LENGTH;
+         }
+         else if(version == CSDocContainerVersion_Blocks)
+         {
+            blockCount = CSDocContainerReadUInt32(bytes + offset);
+            offset += sizeof(uint32_t) + SHA_DIGEST_LENGTH;   // The HMAC needs the key, so waits
+            unsigned char checksum[SHA_DIGEST_LENGTH];
+            SHA1(bytes, offset, checksum);
+            headerIntact = CSDocContainerEqualBytes(checksum, bytes + offset, SHA_DIGEST_LENGTH);
+            offset += SHA_DIGEST_LENGTH;
+         }
+         payloadRange = NSMakeRange(offset, [data length] - offset);
+         // Take the index section, if the trailer makes sense, off the end
+         if(version == CSDocContainerVersion_Blocks && payloadRange.length >= CSDOCCONTAINER_TRAILER_LENGTH
+            && memcmp(bytes + [data length] - sizeof(indexMarker), indexMarker, sizeof(indexMarker)) == 0)
+         {
+            NSUInteger indexLength = CSDocContainerReadUInt32(bytes + [data length] - CSDOCCONTAINER_TRAILER_LENGTH);
+            if(indexLength > CSDOCCONTAINER_INDEX_HEADER_LENGTH
+               && (indexLength - CSDOCCONTAINER_INDEX_HEADER_LENGTH) % 8 == 0
+               && indexLength <= payloadRange.length - CSDOCCONTAINER_TRAILER_LENGTH)
+            {
+               payloadRange.length -= indexLength + CSDOCCONTAINER_TRAILER_LENGTH;
+               indexRange = NSMakeRange(NSMaxRange(payloadRange), indexLength);
+            }
+         }
+      }
+      else if([data length] >= CSDOCCONTAINER_IV_LENGTH + 8)
+      {
+         version = CSDocContainerVersion_Legacy;
+         iv = [[data subdataWithRange:NSMakeRange(0, CSDOCCONTAINER_IV_LENGTH)] retain];
+         payloadRange = NSMakeRange(CSDOCCONTAINER_IV_LENGTH, [data length] - CSDOCCONTAINER_IV_LENGTH);
+      }
+
+      if(version != CSDocContainerVersion_Legacy && version != CSDocContainerVersion_KeyCheck
+         && version != CSDocContainerVersion_Blocks)
+      {
+#if defined(DEBUG)
+         NSLog(@"CSDocContainer initWithData: not a document, or unknown version %ld", (long) version);
+#endif
+         [self release];
+         self = nil;
+      }
+   }
+
+   return self;
+}
+
+
+- (NSInteger) version
+{
+   return version;
+}
+
+
+/*
+ * With a key check, this is exact (short of a 1 in 2^64 chance); if the header
+ * holding it is damaged, the HMAC of the first intact block does instead.  A
+ * legacy document has none, so decrypt the first block and see if it starts
+ * like compressed data, which rejects almost all wrong keys
+ */
+- (BOOL) isPossibleKey:(NSData *)bfKey
+{
+   if(version == CSDocContainerVersion_Blocks && !headerIntact)
+   {
+      NSData *blocks = [self blocksScannedStrictly:NO missingBlocks:NULL];
+      if([blocks length] < sizeof(CSDocContainerBlock))
+         return NO;
+      CSDocContainerBlock firstBlock = *((const CSDocContainerBlock *) [blocks bytes]);
+      NSData *checkedPart = [NSData dataWithBytesNoCopy:(void *) ([fileData bytes] + firstBlock.frameOffset
+                                                                  + CSDOCCONTAINER_FRAME_CHECKED_OFFSET)
+                                                 length:(CSDOCCONTAINER_FRAME_HEADER_LENGTH
+                                                         - CSDOCCONTAINER_FRAME_CHECKED_OFFSET
+                                                         + firstBlock.cipherLength)
+                                           freeWhenDone:NO];
+      NSData *hmac = [checkedPart HMACSHA1WithKey:[CSDocContainer MACKeyForKey:bfKey] prefix:keyCheckSalt];
+
+      return ([hmac length] == SHA_DIGEST_LENGTH
+              && CSDocContainerEqualBytes([hmac bytes],
+                                          [fileData bytes] + firstBlock.frameOffset
+                                          + CSDOCCONTAINER_FRAME_HMAC_OFFSET,
+                                          SHA_DIGEST_LENGTH));
+   }
+   if(version == CSDocContainerVersion_KeyCheck || version == CSDocContainerVersion_Blocks)
+   {
+      NSData *keyCheck = [CSDocContainer keyCheckForKey:bfKey salt:keyCheckSalt];
+
+      return ([keyCheck length] == CSDOCCONTAINER_CHECK_LENGTH
+              && CSDocContainerEqualBytes([keyCheck bytes], [keyCheckValue bytes], CSDOCCONTAINER_CHECK_LENGTH));
+   }
+
+   NSData *firstBlocks = [fileData subdataWithRange:NSMakeRange(payloadRange.location,
+                                                                MIN(payloadRange.length, 16))];
+   NSData *prefix = [firstBlocks blowfishDecryptedPrefixOfLength:8 withKey:bfKey iv:iv];
+
+   return (prefix != nil && [prefix compressionCodec] != nil);
+}
+
+
+- (NSArray *) payloadBlocksDecryptedWithKey:(NSData *)bfKey
+{
+   return [self payloadBlocksDecryptedWithKey:bfKey progressFunction:NULL context:NULL];
+}
+
+
+/*
+ * Decrypt straight from the file data, rather than copying each block out
+ * first; progress runs over all the blocks by their size.  The header has to
+ * pass its HMAC, so the block count can be trusted.
+ */
+- (NSArray *) payloadBlocksDecryptedWithKey:(NSData *)bfKey
+                           progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                                    context:(void *)context
+{
+   if(version != CSDocContainerVersion_Blocks)
+   {
+      NSData *ceData = [NSData dataWithBytesNoCopy:(void *) ([fileData bytes] + payloadRange.location)
+                                            length:payloadRange.length
+                                      freeWhenDone:NO];
+      NSMutableData *payload = [ceData blowfishDecryptedDataWithKey:bfKey
+                                                                 iv:iv
+                                                   progressFunction:progressFunction
+                                                            context:context];
+      if(payload == nil)
+         return nil;
+
+      return [NSArray arrayWithObject:payload];
+   }
+
+   if(![self isHeaderAuthenticWithKey:bfKey])
+   {
+#if defined(DEBUG)
+      NSLog(@"CSDocContainer payloadBlocksDecryptedWithKey: header HMAC mismatch");
+#endif
+      return nil;
+   }
+   NSData *blocks = [self blocksScannedStrictly:YES missingBlocks:NULL];
+   if(blocks == nil)
+      return nil;
+   NSUInteger foundCount = [blocks length] / sizeof(CSDocContainerBlock);
+   const CSDocContainerBlock *foundBlocks = [blocks bytes];
+   NSMutableArray *payloadBlocks = [NSMutableArray arrayWithCapacity:foundCount];
+   CSDocContainerProgress progress = { progressFunction, context, 0.0, 0.0 };
+   NSUInteger doneLength = 0;
+   NSUInteger index;
+   for(index = 0; index < foundCount; index++)
+   {
+      progress.base = (double) doneLength / (double) MAX(payloadRange.length, 1);
+      progress.scale = (double) foundBlocks[index].cipherLength / (double) MAX(payloadRange.length, 1);
+      NSMutableData *payloadBlock = [self decryptBlock:&foundBlocks[index]
+                                               withKey:bfKey
+                                      progressFunction:(progressFunction != NULL ? CSDocContainerBlockProgress
+                                                                                 : NULL)
+                                               context:&progress];
+      if(payloadBlock == nil)
+         return nil;
+      [payloadBlocks addObject:payloadBlock];
+      doneLength += CSDOCCONTAINER_FRAME_HEADER_LENGTH + foundBlocks[index].cipherLength;
+   }
+
+   return payloadBlocks;
+}
+
+
+- (BOOL) canRecoverBlocks
+{
+   return (version == CSDocContainerVersion_Blocks);
+}
+
+
+/*
+ * Decrypt each block that passes its checks, and count those which don't, or
+ * can't be found at all; the older formats are all one block
+ */
+- (NSArray *) intactPayloadBlocksDecryptedWithKey:(NSData *)bfKey missingBlocks:(NSUInteger *)missingCount
+{
+   NSMutableArray *payloadBlocks = [NSMutableArray arrayWithCapacity:10];
+   NSUInteger missing = 0;
+   if(version != CSDocContainerVersion_Blocks)
+   {
+      NSArray *wholePayload = [self payloadBlocksDecryptedWithKey:bfKey];
+      if(wholePayload != nil)
+         [payloadBlocks addObjectsFromArray:wholePayload];
+      else
+         missing = 1;
+   }
+   else
+   {
+      NSData *blocks = [self blocksScannedStrictly:NO missingBlocks:&missing];
+      NSUInteger foundCount = [blocks length] / sizeof(CSDocContainerBlock);
+      const CSDocContainerBlock *foundBlocks = [blocks bytes];
+      NSUInteger index;
+      for(index = 0; index < foundCount; index++)
+      {
+         NSMutableData *payloadBlock = [self decryptBlock:&foundBlocks[index]
+                                                  withKey:bfKey
+                                         progressFunction:NULL
+                                                  context:NULL];
+         if(payloadBlock != nil)
+            [payloadBlocks addObject:payloadBlock];
+         else
+            missing++;
+      }
+   }
+
+   if(missingCount != NULL)
+      *missingCount = missing;
+
+   return payloadBlocks;
+}
+
+
+/*
+ * The payload hash in the index section has to match the blocks as they are
+ * now, so an index saved with other entries (or surviving damage to them)
+ * is never trusted
+ */
+- (NSMutableData *) indexPayloadDecryptedWithKey:(NSData *)bfKey
+{
+   if(indexRange.length == 0 || ![self isIndexIntact])
+      return nil;
+   if(payloadHash == nil)
+      [self blocksScannedStrictly:YES missingBlocks:NULL];
+   const unsigned char *indexBytes = (const unsigned char *) [fileData bytes] + indexRange.location;
+   if(payloadHash == nil
+      || !CSDocContainerEqualBytes([payloadHash bytes], indexBytes + CSDOCCONTAINER_INDEX_CHECKED_OFFSET,
+                                   SHA_DIGEST_LENGTH))
+   {
+#if defined(DEBUG)
+      NSLog(@"CSDocContainer indexPayloadDecryptedWithKey: index doesn't match the blocks");
+#endif
+      return nil;
+   }
+
+   NSData *checkedPart = [NSData dataWithBytesNoCopy:(void *) (indexBytes + CSDOCCONTAINER_INDEX_CHECKED_OFFSET)
+                                              length:indexRange.length - CSDOCCONTAINER_INDEX_CHECKED_OFFSET
+                                        freeWhenDone:NO];
+   NSData *hmac = [checkedPart HMACSHA1WithKey:[CSDocContainer MACKeyForKey:bfKey] prefix:keyCheckSalt];
+   if([hmac length] != SHA_DIGEST_LENGTH
+      || !CSDocContainerEqualBytes([hmac bytes], indexBytes + CSDOCCONTAINER_INDEX_HMAC_OFFSET, SHA_DIGEST_LENGTH))
+      return nil;
+
+   NSData *indexIV = [NSData dataWithBytes:indexBytes + CSDOCCONTAINER_INDEX_IV_OFFSET
+                                    length:CSDOCCONTAINER_IV_LENGTH];
+   NSData *ceData = [NSData dataWithBytesNoCopy:(void *) (indexBytes + CSDOCCONTAINER_INDEX_HEADER_LENGTH)
+                                         length:indexRange.length - CSDOCCONTAINER_INDEX_HEADER_LENGTH
+                                   freeWhenDone:NO];
+
+   return [ceData blowfishDecryptedDataWithKey:bfKey iv:indexIV];
+}
+
+
+#pragma mark -
+#pragma mark Blocks
+/*
+ * Whether there's a block at the given offset whose SHA-1 matches; fills in
+ * where it is if so
+ */
+- (BOOL) getIntactBlock:(CSDocContainerBlock *)block atOffset:(NSUInteger)offset
+{
+   const unsigned char *bytes = [fileData bytes];
+   NSUInteger end = NSMaxRange(payloadRange);
+   if(offset + CSDOCCONTAINER_FRAME_HEADER_LENGTH > end
+      || memcmp(bytes + offset, blockMarker, sizeof(blockMarker)) != 0)
+      return NO;
+
+   NSUInteger cipherLength = CSDocContainerReadUInt32(bytes + offset + CSDOCCONTAINER_FRAME_CHECKED_OFFSET
+                                                      + sizeof(uint32_t));
+   // Blowfish works in whole 8-byte blocks
+   if(cipherLength == 0 || cipherLength % 8 != 0
+      || cipherLength > end - offset - CSDOCCONTAINER_FRAME_HEADER_LENGTH)
+      return NO;
+
+   unsigned char checksum[SHA_DIGEST_LENGTH];
+   SHA1(bytes + offset + CSDOCCONTAINER_FRAME_CHECKED_OFFSET,
+        CSDOCCONTAINER_FRAME_HEADER_LENGTH - CSDOCCONTAINER_FRAME_CHECKED_OFFSET + cipherLength,
+        checksum);
+   if(!CSDocContainerEqualBytes(checksum, bytes + offset + CSDOCCONTAINER_FRAME_SHA_OFFSET, SHA_DIGEST_LENGTH))
+      return NO;
+
+   block->frameOffset = offset;
+   block->cipherLength = cipherLength;
+   block->index = CSDocContainerReadUInt32(bytes + offset + CSDOCCONTAINER_FRAME_CHECKED_OFFSET);
+
+   return YES;
+}
+
+
+/*
+ * Whether the index section, if there is one, matches its SHA-1
+ */
+- (BOOL) isIndexIntact
+{
+   if(indexRange.length == 0)
+      return YES;
+
+   const unsigned char *indexBytes = (const unsigned char *) [fileData bytes] + indexRange.location;
+   unsigned char checksum[SHA_DIGEST_LENGTH];
+   SHA1(indexBytes + CSDOCCONTAINER_INDEX_CHECKED_OFFSET,
+        indexRange.length - CSDOCCONTAINER_INDEX_CHECKED_OFFSET,
+        checksum);
+
+   return CSDocContainerEqualBytes(checksum, indexBytes, SHA_DIGEST_LENGTH);
+}
+
+
+/*
+ * Whether the (intact) header of a Blocks document passes its HMAC
+ */
+- (BOOL) isHeaderAuthenticWithKey:(NSData *)bfKey
+{
+   if(version != CSDocContainerVersion_Blocks || !headerIntact)
+      return NO;
+
+   NSData *macedPart = [NSData dataWithBytesNoCopy:(void *) [fileData bytes]
+                                            length:CSDOCCONTAINER_BLOCKS_MACED_LENGTH
+                                      freeWhenDone:NO];
+   NSData *hmac = [macedPart HMACSHA1WithKey:[CSDocContainer MACKeyForKey:bfKey]];
+
+   return ([hmac length] == SHA_DIGEST_LENGTH
+           && CSDocContainerEqualBytes([hmac bytes],
+                                       (const unsigned char *) [fileData bytes]
+                                       + CSDOCCONTAINER_BLOCKS_MACED_LENGTH,
+                                       SHA_DIGEST_LENGTH));
+}
+
+
+/*
+ * Walk the blocks in one pass, returning an NSData of CSDocContainerBlock's.
+ * Strictly, anything out of place (damage, blocks missing or out of order)
+ * gives nil; otherwise damaged stretches are skipped up to the next marker
+ * which starts an intact block, and missingCount gets the number of blocks
+ * not found (or, if the header's count can't be trusted, damaged stretches).
+ */
+- (NSData *) blocksScannedStrictly:(BOOL)strict missingBlocks:(NSUInteger *)missingCount
+{
+   if(strict && !headerIntact)
+      return nil;
+
+   const unsigned char *bytes = [fileData bytes];
+   NSUInteger end = NSMaxRange(payloadRange);
+   NSUInteger offset = payloadRange.location;
+   NSMutableData *blocks = [NSMutableData dataWithCapacity:blockCount * sizeof(CSDocContainerBlock)];
+   NSMutableIndexSet *foundIndexes = [NSMutableIndexSet indexSet];
+   NSUInteger damagedStretches = 0;
+   SHA_CTX payloadHashContext;
+   SHA1_Init(&payloadHashContext);
+   BOOL inDamage = NO;
+   while(offset < end)
+   {
+      CSDocContainerBlock oneBlock;
+      if([self getIntactBlock:&oneBlock atOffset:offset])
+      {
+         if(strict && oneBlock.index != [foundIndexes count])
+            return nil;
+         // A stray copy of a block already seen adds nothing
+         if(![foundIndexes containsIndex:oneBlock.index])
+         {
+            [blocks appendBytes:&oneBlock length:sizeof(oneBlock)];
+            [foundIndexes addIndex:oneBlock.index];
+            SHA1_Update(&payloadHashContext, bytes + offset + CSDOCCONTAINER_FRAME_SHA_OFFSET, SHA_DIGEST_LENGTH);
+         }
+         offset += CSDOCCONTAINER_FRAME_HEADER_LENGTH + oneBlock.cipherLength;
+         inDamage = NO;
+      }
+      else
+      {
+         if(strict)
+            return nil;
+         if(!inDamage)
+            damagedStretches++;
+         inDamage = YES;
+         const unsigned char *nextMarker = NULL;
+         if(offset + 1 < end)
+            nextMarker = memchr(bytes + offset + 1, blockMarker[0], end - offset - 1);
+         offset = (nextMarker != NULL ? (NSUInteger) (nextMarker - bytes) : end);
+      }
+   }
+   if(strict && [foundIndexes count] != blockCount)
+      return nil;
+
+   // Only a strict pass has every block in order, so the hash means anything
+   unsigned char payloadHashBytes[SHA_DIGEST_LENGTH];
+   SHA1_Final(payloadHashBytes, &payloadHashContext);
+   if(strict && payloadHash == nil)
+      payloadHash = [[NSData alloc] initWithBytes:payloadHashBytes length:sizeof(payloadHashBytes)];
+
+   if(missingCount != NULL)
+   {
+      if(headerIntact)
+      {
+         NSUInteger foundInRange = [foundIndexes countOfIndexesInRange:NSMakeRange(0, blockCount)];
+         *missingCount = blockCount - foundInRange;
+      }
+      else
+         *missingCount = damagedStretches;
+   }
+
+   return blocks;
+}
+
+
+/*
+ * Check the block's HMAC, then decrypt it straight from the file data into a
+ * new buffer
+ *
+ * XXX The HMAC takes in the header's salt, which is read as it is even when
+ * the header is damaged; if the damage hit the salt, no block passes, and
+ * nothing can be recovered
+ */
+- (NSMutableData *) decryptBlock:(const CSDocContainerBlock *)block
+                         withKey:(NSData *)bfKey
+                progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                         context:(void *)context
+{
+   const unsigned char *frameBytes = (const unsigned char *) [fileData bytes] + block->frameOffset;
+   NSData *checkedPart = [NSData dataWithBytesNoCopy:(void *) (frameBytes + CSDOCCONTAINER_FRAME_CHECKED_OFFSET)
+                                              length:(CSDOCCONTAINER_FRAME_HEADER_LENGTH
+                                                      - CSDOCCONTAINER_FRAME_CHECKED_OFFSET
+                                                      + block->cipherLength)
+                                        freeWhenDone:NO];
+   NSData *hmac = [checkedPart HMACSHA1WithKey:[CSDocContainer MACKeyForKey:bfKey] prefix:keyCheckSalt];
+   if([hmac length] != SHA_DIGEST_LENGTH
+      || !CSDocContainerEqualBytes([hmac bytes], frameBytes + CSDOCCONTAINER_FRAME_HMAC_OFFSET, SHA_DIGEST_LENGTH))
+   {
+#if defined(DEBUG)
+      NSLog(@"CSDocContainer decryptBlock: HMAC mismatch on block %lu", (unsigned long) block->index);
+#endif
+      return nil;
+   }
+
+   NSData *blockIV = [NSData dataWithBytes:frameBytes + CSDOCCONTAINER_FRAME_IV_OFFSET
+                                    length:CSDOCCONTAINER_IV_LENGTH];
+   NSData *ceData = [NSData dataWithBytesNoCopy:(void *) (frameBytes + CSDOCCONTAINER_FRAME_HEADER_LENGTH)
+                                         length:block->cipherLength
+                                   freeWhenDone:NO];
+
+   return [ceData blowfishDecryptedDataWithKey:bfKey
+                                            iv:blockIV
+                              progressFunction:progressFunction
+                                       context:context];
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [fileData release];
+   [keyCheckSalt release];
+   [keyCheckValue release];
+   [iv release];
+   [payloadHash release];
+   [super dealloc];
+}
+
+@end
+
+
+static BOOL CSDocContainerBlockProgress(double fractionDone, void *context)
+{
+   CSDocContainerProgress *progress = context;
+
+   return progress->function(progress->base + progress->scale * fractionDone, progress->context);
+}
+
+
+/*
+ * Compare without stopping at the first difference, so the time taken says
+ * nothing about where a check value went wrong
+ */
+static BOOL CSDocContainerEqualBytes(const void *bytes1, const void *bytes2, NSUInteger length)
+{
+   const unsigned char *first = bytes1;
+   const unsigned char *second = bytes2;
+   unsigned char difference = 0;
+   NSUInteger index;
+   for(index = 0; index < length; index++)
+      difference |= first[index] ^ second[index];
+
+   return (difference == 0);
+}
+
+
+static uint32_t CSDocContainerReadUInt32(const unsigned char *bytes)
+{
+   uint32_t valueBE;
+   memcpy(&valueBE, bytes, sizeof(valueBE));
+
+   return CFSwapInt32BigToHost(valueBE);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocDigest.h */
+
+#import <Foundation/Foundation.h>
+
+// Number of buckets entries are spread over by ID
+extern const NSUInteger CSDocDigestBucketCount;
+
+/*
+ * Content hashes for every entry of a model, by entry ID, and a Merkle-style
+ * summary over them: entries are spread over buckets by ID, each bucket's
+ * hash is the XOR of a hash of each of its entries' ID and content (so it can
+ * be updated as entries come and go), and the summary hash covers all the
+ * bucket hashes.  Two digests with the same bucket hash hold the same entries
+ * in that bucket, so comparing models only has to look inside the buckets
+ * that differ.
+ *
+ * Content hashes are HMAC-SHA1 keyed with a secret made fresh for each run,
+ * so they compare across models within the process but mean nothing outside it.
+ */
+@interface CSDocDigest : NSObject
+{
+   NSMutableDictionary *contentHashes;   // Entry ID -> NSData
+   NSMutableDictionary *namesByID;       // Entry ID -> name
+   NSMutableArray *bucketIDs;            // NSMutableSet of entry IDs, for each bucket
+   unsigned char *bucketHashes;          // CSDocDigestBucketCount hashes, end to end
+}
+
+// Content hash of the given entry (a model dictionary, keyed by CSDocModelKey_*)
++ (NSData *) contentHashOfEntry:(NSDictionary *)entry;
+
+// Bucket holding the given entry ID
++ (NSUInteger) bucketForEntryID:(NSString *)entryID;
+
+- (id) init;
+
+// The entry must still hold the values it was added with when it's removed
+- (void) addEntry:(NSDictionary *)entry;
+- (void) removeEntry:(NSDictionary *)entry;
+
+- (NSUInteger) entryCount;
+- (NSData *) contentHashForEntryID:(NSString *)entryID;
+- (NSString *) nameForEntryID:(NSString *)entryID;
+- (NSData *) hashOfBucket:(NSUInteger)bucket;
+- (NSSet *) entryIDsInBucket:(NSUInteger)bucket;
+- (NSData *) summaryHash;
+
+@end
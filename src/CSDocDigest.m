@@ -0,0 +1,273 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocDigest.m */
+
+#import "CSDocDigest.h"
+#import "CSDocModel.h"
+#import "CSSecureData.h"
+#import "NSData_crypto.h"
+#include <openssl/sha.h>
+#include <stdlib.h>
+#include <string.h>
+
+const NSUInteger CSDocDigestBucketCount = 256;
+
+// Length of the process-wide HMAC key
+static const NSUInteger CSDocDigestSecretLength = 20;
+
+static NSData *processSecret = nil;
+
+static void CSDocDigestAppendField(NSMutableData *message, NSData *field);
+
+
+@interface CSDocDigest (InternalMethods)
++ (NSData *) hashOfEntryID:(NSString *)entryID contentHash:(NSData *)contentHash;
+- (void) toggleEntryID:(NSString *)entryID contentHash:(NSData *)contentHash;
+@end
+
+
+@implementation CSDocDigest
+
++ (void) initialize
+{
+   if(processSecret == nil)
+      processSecret = [[NSData randomDataOfLength:CSDocDigestSecretLength] retain];
+}
+
+
+/*
+ * HMAC over each field, length-prefixed so no two different entries make the
+ * same message; the message is built in a secure buffer, as it holds the
+ * password
+ */
++ (NSData *) contentHashOfEntry:(NSDictionary *)entry
+{
+   NSMutableData *message = [CSSecureData dataWithCapacity:256];
+   NSArray *stringKeys = [NSArray arrayWithObjects:CSDocModelKey_Name, CSDocModelKey_Acct,
+                                                   CSDocModelKey_Passwd, CSDocModelKey_URL,
+                                                   CSDocModelKey_Category, nil];
+   NSEnumerator *keyEnumerator = [stringKeys objectEnumerator];
+   id oneKey;
+   while((oneKey = [keyEnumerator nextObject]) != nil)
+   {
+      NSString *value = [entry objectForKey:oneKey];
+      NSUInteger valueLength = [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+      CSSecureData *field = [CSSecureData dataWithLength:valueLength];
+      [value getBytes:[field mutableBytes]
+            maxLength:valueLength
+           usedLength:NULL
+             encoding:NSUTF8StringEncoding
+              options:0
+                range:NSMakeRange(0, [value length])
+       remainingRange:NULL];
+      CSDocDigestAppendField(message, field);
+   }
+   CSDocDigestAppendField(message, [entry objectForKey:CSDocModelKey_Notes]);
+   NSData *hash = [message HMACSHA1WithKey:processSecret];
+   if(hash == nil)
+      return nil;
+
+   return [NSData dataWithBytes:[hash bytes] length:[hash length]];
+}
+
+
+/*
+ * The first byte of the ID's SHA-1, so buckets fill evenly whatever the IDs
+ * look like
+ */
++ (NSUInteger) bucketForEntryID:(NSString *)entryID
+{
+   const char *idBytes = [entryID UTF8String];
+   unsigned char idHash[SHA_DIGEST_LENGTH];
+   SHA1((const unsigned char *) idBytes, strlen(idBytes), idHash);
+
+   return idHash[0] % CSDocDigestBucketCount;
+}
+
+
+- (id) init
+{
+   self = [super init];
+   if(self != nil)
+   {
+      contentHashes = [[NSMutableDictionary alloc] initWithCapacity:25];
+      namesByID = [[NSMutableDictionary alloc] initWithCapacity:25];
+      bucketIDs = [[NSMutableArray alloc] initWithCapacity:CSDocDigestBucketCount];
+      NSUInteger bucket;
+      for(bucket = 0; bucket < CSDocDigestBucketCount; bucket++)
+         [bucketIDs addObject:[NSMutableSet set]];
+      bucketHashes = calloc(CSDocDigestBucketCount, SHA_DIGEST_LENGTH);
+      if(bucketHashes == NULL)
+      {
+         [self release];
+         return nil;
+      }
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Updating
+- (void) addEntry:(NSDictionary *)entry
+{
+   NSString *entryID = [entry objectForKey:CSDocModelKey_EntryID];
+   NSData *contentHash = [CSDocDigest contentHashOfEntry:entry];
+   if(entryID == nil || contentHash == nil || [contentHashes objectForKey:entryID] != nil)
+      return;
+
+   [contentHashes setObject:contentHash forKey:entryID];
+   [namesByID setObject:[entry objectForKey:CSDocModelKey_Name] forKey:entryID];
+   [[bucketIDs objectAtIndex:[CSDocDigest bucketForEntryID:entryID]] addObject:entryID];
+   [self toggleEntryID:entryID contentHash:contentHash];
+}
+
+
+/*
+ * Uses the hash stored when the entry was added, so this works even if the
+ * entry has since changed
+ */
+- (void) removeEntry:(NSDictionary *)entry
+{
+   NSString *entryID = [entry objectForKey:CSDocModelKey_EntryID];
+   NSData *contentHash = [contentHashes objectForKey:entryID];
+   if(entryID == nil || contentHash == nil)
+      return;
+
+   [self toggleEntryID:entryID contentHash:contentHash];
+   [[bucketIDs objectAtIndex:[CSDocDigest bucketForEntryID:entryID]] removeObject:entryID];
+   [namesByID removeObjectForKey:entryID];
+   [contentHashes removeObjectForKey:entryID];
+}
+
+
+#pragma mark -
+#pragma mark Queries
+- (NSUInteger) entryCount
+{
+   return [contentHashes count];
+}
+
+
+- (NSData *) contentHashForEntryID:(NSString *)entryID
+{
+   return [contentHashes objectForKey:entryID];
+}
+
+
+- (NSString *) nameForEntryID:(NSString *)entryID
+{
+   return [namesByID objectForKey:entryID];
+}
+
+
+- (NSData *) hashOfBucket:(NSUInteger)bucket
+{
+   return [NSData dataWithBytes:bucketHashes + bucket * SHA_DIGEST_LENGTH length:SHA_DIGEST_LENGTH];
+}
+
+
+- (NSSet *) entryIDsInBucket:(NSUInteger)bucket
+{
+   return [bucketIDs objectAtIndex:bucket];
+}
+
+
+/*
+ * SHA-1 over all the bucket hashes
+ */
+- (NSData *) summaryHash
+{
+   NSMutableData *summary = [NSMutableData dataWithLength:SHA_DIGEST_LENGTH];
+   SHA1(bucketHashes, CSDocDigestBucketCount * SHA_DIGEST_LENGTH, [summary mutableBytes]);
+
+   return summary;
+}
+
+
+#pragma mark -
+#pragma mark Buckets
+/*
+ * What an entry contributes to its bucket's hash
+ */
++ (NSData *) hashOfEntryID:(NSString *)entryID contentHash:(NSData *)contentHash
+{
+   NSMutableData *message = [NSMutableData dataWithData:[entryID dataUsingEncoding:NSUTF8StringEncoding]];
+   [message appendData:contentHash];
+   NSMutableData *entryHash = [NSMutableData dataWithLength:SHA_DIGEST_LENGTH];
+   SHA1([message bytes], [message length], [entryHash mutableBytes]);
+
+   return entryHash;
+}
+
+
+/*
+ * XOR the entry's part in or out of its bucket's hash, the same either way
+ */
+- (void) toggleEntryID:(NSString *)entryID contentHash:(NSData *)contentHash
+{
+   const unsigned char *entryHash = [[CSDocDigest hashOfEntryID:entryID contentHash:contentHash] bytes];
+   unsigned char *bucketHash = bucketHashes + [CSDocDigest bucketForEntryID:entryID] * SHA_DIGEST_LENGTH;
+   NSUInteger index;
+   for(index = 0; index < SHA_DIGEST_LENGTH; index++)
+      bucketHash[index] ^= entryHash[index];
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [contentHashes release];
+   [namesByID release];
+   [bucketIDs release];
+   free(bucketHashes);
+   [super dealloc];
+}
+
+@end
+
+
+/*
+ * Append the field's length (4 bytes, big-endian) and then the field itself;
+ * a missing field counts as empty
+ */
+static void CSDocDigestAppendField(NSMutableData *message, NSData *field)
+{
+   uint32_t fieldLength = CFSwapInt32HostToBig((uint32_t) [field length]);
+   [message appendBytes:&fieldLength length:sizeof(fieldLength)];
+   if(field != nil)
+      [message appendData:field];
+}
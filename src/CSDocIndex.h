@@ -0,0 +1,75 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocIndex.h */
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Derived state saved alongside a document's entries (see CSDocContainer), so
+ * opening doesn't have to work it all out again: the order of the entries by
+ * each sortable key, as positions in the order they were saved.  Notes are
+ * left out, since sorting by them means reading rich text, which doesn't
+ * belong on a save thread.
+ *
+ * The name to row table and the category counts aren't saved: the model
+ * builds the first in one pass over the saved order, and counts categories as
+ * it takes in the entries anyway, so neither would save any work.
+ *
+ * Descending order is taken as ascending reversed; entries which compare the
+ * same have no set order either way.
+ */
+@interface CSDocIndex : NSObject
+{
+   NSUInteger entryCount;
+   NSMutableDictionary *sortPermutations;   // Key -> NSData of uint32_t positions
+}
+
+// Work out the index for the given entries, in the order they're being saved
+- (id) initWithEntries:(NSArray *)entries;
+
+// Read an index as written by serializedData; nil if it isn't one, or doesn't hold together
+- (id) initWithSerializedData:(NSData *)serializedData;
+
+/*
+ * Serialized into secure memory, cleared when released: a small header, then
+ * for each key its name and the positions as a plain array of big-endian
+ * uint32_t's
+ */
+- (NSMutableData *) serializedData;
+
+- (NSUInteger) entryCount;
+
+// Positions (uint32_t) of the saved entries in ascending order by the given key, or nil if not indexed
+- (NSData *) sortPermutationForKey:(NSString *)key;
+
+@end
@@ -0,0 +1,303 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocIndex.m */
+
+#import "CSDocIndex.h"
+#import "CSDocModel.h"
+#import "CSSecureData.h"
+#include <stdlib.h>
+
+/*
+ * The serialized form: the magic, then the version, entry count, and key count
+ * (4 bytes each, big-endian), then for each key its UTF-8 name's length (4
+ * bytes, big-endian), the name, and the positions.  An index is only ever a
+ * shortcut, so one that can't be read just means sorting.
+ */
+static const char indexMagic[] = { 'C', 'S', 'i', 'd' };
+static const uint32_t CSDocIndexVersion = 1;
+#define CSDOCINDEX_HEADER_LENGTH (sizeof(indexMagic) + 3 * sizeof(uint32_t))
+
+// One slot while sorting, the entry's value for the key and where it was saved
+typedef struct
+{
+   NSString *value;
+   uint32_t position;
+} CSDocIndexSlot;
+
+static int compareDocIndexSlots(const void *slot1, const void *slot2);
+static void CSDocIndexAppendUInt32(NSMutableData *data, uint32_t value);
+static BOOL CSDocIndexReadUInt32(const unsigned char *bytes, NSUInteger length, NSUInteger *offset,
+                                 uint32_t *value);
+
+
+@interface CSDocIndex (InternalMethods)
++ (NSData *) sortPermutationOfEntries:(NSArray *)entries forKey:(NSString *)key;
+- (BOOL) isPermutation:(NSData *)permutation;
+@end
+
+
+@implementation CSDocIndex
+
+/*
+ * Sort the positions of the entries by the key's values, the same comparison
+ * the model sorts with; nil if there's no memory for it
+ */
++ (NSData *) sortPermutationOfEntries:(NSArray *)entries forKey:(NSString *)key
+{
+   NSUInteger count = [entries count];
+   CSDocIndexSlot *slots = malloc(count * sizeof(CSDocIndexSlot) + 1);
+   if(slots == NULL)
+      return nil;
+   NSUInteger index;
+   for(index = 0; index < count; index++)
+   {
+      slots[index].value = [[entries objectAtIndex:index] objectForKey:key];
+      if(slots[index].value == nil)
+         slots[index].value = @"";
+      slots[index].position = (uint32_t) index;
+   }
+   qsort(slots, count, sizeof(CSDocIndexSlot), compareDocIndexSlots);
+   // The order by password is as sensitive as anything else in the document
+   NSMutableData *permutation = [CSSecureData dataWithLength:count * sizeof(uint32_t)];
+   uint32_t *positions = [permutation mutableBytes];
+   for(index = 0; index < count; index++)
+      positions[index] = slots[index].position;
+   free(slots);
+
+   return permutation;
+}
+
+
+- (id) initWithEntries:(NSArray *)entries
+{
+   self = [super init];
+   if(self != nil)
+   {
+      entryCount = [entries count];
+      sortPermutations = [[NSMutableDictionary alloc] initWithCapacity:5];
+      NSArray *sortableKeys = [NSArray arrayWithObjects:CSDocModelKey_Name, CSDocModelKey_Acct,
+                                                        CSDocModelKey_Passwd, CSDocModelKey_URL,
+                                                        CSDocModelKey_Category, nil];
+      NSEnumerator *keyEnumerator = [sortableKeys objectEnumerator];
+      id oneKey;
+      while((oneKey = [keyEnumerator nextObject]) != nil)
+      {
+         // A key left out is just sorted the slow way on open
+         NSData *permutation = [CSDocIndex sortPermutationOfEntries:entries forKey:oneKey];
+         if(permutation != nil)
+            [sortPermutations setObject:permutation forKey:oneKey];
+      }
+   }
+
+   return self;
+}
+
+
+/*
+ * Read and check everything; the data was encrypted and authenticated with
+ * the document, but a bad permutation would lose entries, so it costs little
+ * to be sure
+ */
+- (id) initWithSerializedData:(NSData *)serializedData
+{
+   self = [super init];
+   if(self != nil)
+   {
+      const unsigned char *bytes = [serializedData bytes];
+      NSUInteger length = [serializedData length];
+      NSUInteger offset = sizeof(indexMagic);
+      uint32_t version = 0;
+      uint32_t savedEntryCount = 0;
+      uint32_t keyCount = 0;
+      sortPermutations = nil;
+      if(length >= CSDOCINDEX_HEADER_LENGTH && memcmp(bytes, indexMagic, sizeof(indexMagic)) == 0
+         && CSDocIndexReadUInt32(bytes, length, &offset, &version) && version == CSDocIndexVersion
+         && CSDocIndexReadUInt32(bytes, length, &offset, &savedEntryCount)
+         && CSDocIndexReadUInt32(bytes, length, &offset, &keyCount))
+      {
+         entryCount = savedEntryCount;
+         sortPermutations = [[NSMutableDictionary alloc] initWithCapacity:MIN(keyCount, 10)];
+      }
+      uint32_t keyIndex;
+      for(keyIndex = 0; sortPermutations != nil && keyIndex < keyCount; keyIndex++)
+      {
+         uint32_t keyLength = 0;
+         NSString *key = nil;
+         NSMutableData *permutation = nil;
+         if(CSDocIndexReadUInt32(bytes, length, &offset, &keyLength) && keyLength <= length - offset)
+         {
+            key = [[[NSString alloc] initWithBytes:bytes + offset
+                                            length:keyLength
+                                          encoding:NSUTF8StringEncoding] autorelease];
+            offset += keyLength;
+         }
+         if(key != nil && entryCount <= (length - offset) / sizeof(uint32_t))
+         {
+            // The order by password is as sensitive as anything else in the document
+            permutation = [CSSecureData dataWithLength:entryCount * sizeof(uint32_t)];
+            uint32_t *positions = [permutation mutableBytes];
+            NSUInteger index;
+            for(index = 0; index < entryCount; index++)
+               CSDocIndexReadUInt32(bytes, length, &offset, &positions[index]);
+         }
+         if(permutation != nil && [self isPermutation:permutation])
+            [sortPermutations setObject:permutation forKey:key];
+         else
+         {
+            [sortPermutations release];
+            sortPermutations = nil;
+         }
+      }
+      if(sortPermutations == nil)
+      {
+#if defined(DEBUG)
+         NSLog(@"CSDocIndex initWithSerializedData: not a usable index");
+#endif
+         [self release];
+         self = nil;
+      }
+   }
+
+   return self;
+}
+
+
+/*
+ * Whether the data holds each position below entryCount exactly once
+ */
+- (BOOL) isPermutation:(NSData *)permutation
+{
+   if([permutation length] != entryCount * sizeof(uint32_t))
+      return NO;
+
+   const uint32_t *positions = [permutation bytes];
+   unsigned char *seen = calloc(entryCount + 1, 1);
+   if(seen == NULL)
+      return NO;
+   BOOL isPermutation = YES;
+   NSUInteger index;
+   for(index = 0; isPermutation && index < entryCount; index++)
+   {
+      if(positions[index] >= entryCount || seen[positions[index]])
+         isPermutation = NO;
+      else
+         seen[positions[index]] = 1;
+   }
+   free(seen);
+
+   return isPermutation;
+}
+
+
+- (NSMutableData *) serializedData
+{
+   NSMutableData *serializedData = [CSSecureData dataWithCapacity:CSDOCINDEX_HEADER_LENGTH
+                                                                  + (entryCount * sizeof(uint32_t) + 32)
+                                                                    * [sortPermutations count]];
+   [serializedData appendBytes:indexMagic length:sizeof(indexMagic)];
+   CSDocIndexAppendUInt32(serializedData, CSDocIndexVersion);
+   CSDocIndexAppendUInt32(serializedData, (uint32_t) entryCount);
+   CSDocIndexAppendUInt32(serializedData, (uint32_t) [sortPermutations count]);
+   NSEnumerator *keyEnumerator = [sortPermutations keyEnumerator];
+   id oneKey;
+   while((oneKey = [keyEnumerator nextObject]) != nil)
+   {
+      NSData *keyData = [oneKey dataUsingEncoding:NSUTF8StringEncoding];
+      CSDocIndexAppendUInt32(serializedData, (uint32_t) [keyData length]);
+      [serializedData appendData:keyData];
+      const uint32_t *positions = [[sortPermutations objectForKey:oneKey] bytes];
+      NSUInteger index;
+      for(index = 0; index < entryCount; index++)
+         CSDocIndexAppendUInt32(serializedData, positions[index]);
+   }
+
+   return serializedData;
+}
+
+
+- (NSUInteger) entryCount
+{
+   return entryCount;
+}
+
+
+- (NSData *) sortPermutationForKey:(NSString *)key
+{
+   return [sortPermutations objectForKey:key];
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [sortPermutations release];
+   [super dealloc];
+}
+
+@end
+
+
+static int compareDocIndexSlots(const void *slot1, const void *slot2)
+{
+   const CSDocIndexSlot *first = slot1;
+   const CSDocIndexSlot *second = slot2;
+
+   return (int) [first->value caseInsensitiveCompare:second->value];
+}
+
+
+static void CSDocIndexAppendUInt32(NSMutableData *data, uint32_t value)
+{
+   uint32_t valueBE = CFSwapInt32HostToBig(value);
+   [data appendBytes:&valueBE length:sizeof(valueBE)];
+}
+
+
+/*
+ * Read the value at the offset, moving past it; NO if it runs off the end
+ */
+static BOOL CSDocIndexReadUInt32(const unsigned char *bytes, NSUInteger length, NSUInteger *offset,
+                                 uint32_t *value)
+{
+   if(*offset > length || length - *offset < sizeof(uint32_t))
+      return NO;
+
+   uint32_t valueBE;
+   memcpy(&valueBE, bytes + *offset, sizeof(valueBE));
+   *value = CFSwapInt32BigToHost(valueBE);
+   *offset += sizeof(uint32_t);
+
+   return YES;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocLoader.h */
+
+#import <Foundation/Foundation.h>
+
+@class CSDocContainer;
+@class CSDocModel;
+
+// The phases of a load, in order
+extern const NSInteger CSDocLoaderPhase_Decrypt;
+extern const NSInteger CSDocLoaderPhase_Inflate;
+extern const NSInteger CSDocLoaderPhase_Unarchive;
+extern const NSInteger CSDocLoaderPhase_Sort;
+
+/*
+ * Builds a model from a document's data on a worker thread, so any number of
+ * documents can load at once without tying up the main thread.  The delegate
+ * hears about progress and the result on the main thread, and hears nothing
+ * further once the load is cancelled.
+ */
+@interface CSDocLoader : NSObject
+{
+   CSDocContainer *container;
+   NSData *bfKey;
+   id delegate;
+   volatile BOOL cancelled;
+   NSInteger lastReportedPercent;
+   BOOL recovering;
+   NSUInteger lostBlockCount;
+}
+
+- (id) initWithContainer:(CSDocContainer *)docContainer key:(NSData *)key delegate:(id)newDelegate;
+
+- (void) start;
+- (void) cancel;
+- (BOOL) isCancelled;
+
+/*
+ * Recovering loads whatever blocks of a damaged document are intact (see
+ * CSDocContainer), skipping the rest; set before starting.  The number of
+ * blocks lost is good once the load finishes.
+ */
+- (void) setRecovering:(BOOL)shouldRecover;
+- (BOOL) isRecovering;
+- (NSUInteger) lostBlockCount;
+
+- (CSDocContainer *) container;
+
+@end
+
+
+@interface NSObject (CSDocLoaderDelegate)
+- (void) docLoader:(CSDocLoader *)loader didReachPhase:(NSInteger)phase progress:(double)progress;
+// model is nil when the document couldn't be read
+- (void) docLoader:(CSDocLoader *)loader didFinishWithModel:(CSDocModel *)model;
+@end
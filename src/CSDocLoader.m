@@ -0,0 +1,277 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocLoader.m */
+
+#import "CSDocLoader.h"
+#import "CSDocContainer.h"
+#import "CSDocIndex.h"
+#import "CSDocModel.h"
+#import "CSEntrySerializer.h"
+#import "NSData_compress.h"
+
+const NSInteger CSDocLoaderPhase_Decrypt = 0;
+const NSInteger CSDocLoaderPhase_Inflate = 1;
+const NSInteger CSDocLoaderPhase_Unarchive = 2;
+const NSInteger CSDocLoaderPhase_Sort = 3;
+
+
+@interface CSDocLoader (InternalMethods)
+- (void) loadOnThread:(id)unused;
+- (BOOL) reportPhase:(NSInteger)phase progress:(double)progress;
+- (void) reportProgressOnMainThread:(NSArray *)phaseAndProgress;
+- (void) reportResultOnMainThread:(id)modelOrNull;
+@end
+
+
+/*
+ * Progress callback for the decryption, on the worker thread
+ */
+static BOOL CSDocLoaderDecryptProgress(double fractionDone, void *context)
+{
+   return [(CSDocLoader *) context reportPhase:CSDocLoaderPhase_Decrypt progress:fractionDone];
+}
+
+
+@implementation CSDocLoader
+
+- (id) initWithContainer:(CSDocContainer *)docContainer key:(NSData *)key delegate:(id)newDelegate
+{
+   self = [super init];
+   if(self != nil)
+   {
+      container = [docContainer retain];
+      bfKey = [key copy];
+      delegate = newDelegate;
+      cancelled = NO;
+      lastReportedPercent = -1;
+      recovering = NO;
+      lostBlockCount = 0;
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Control
+/*
+ * Start loading on a new thread (which keeps us retained until it's done)
+ */
+- (void) start
+{
+   [NSThread detachNewThreadSelector:@selector(loadOnThread:) toTarget:self withObject:nil];
+}
+
+
+/*
+ * Stop as soon as the worker notices; must be called on the main thread, so
+ * nothing more reaches the delegate after this
+ */
+- (void) cancel
+{
+   cancelled = YES;
+   delegate = nil;
+}
+
+
+- (BOOL) isCancelled
+{
+   return cancelled;
+}
+
+
+- (void) setRecovering:(BOOL)shouldRecover
+{
+   recovering = shouldRecover;
+}
+
+
+- (BOOL) isRecovering
+{
+   return recovering;
+}
+
+
+- (NSUInteger) lostBlockCount
+{
+   return lostBlockCount;
+}
+
+
+- (CSDocContainer *) container
+{
+   return container;
+}
+
+
+#pragma mark -
+#pragma mark Worker Thread
+/*
+ * Decrypt, inflate, unarchive, and sort, checking for cancellation between
+ * each (and between blocks); when recovering, a block failing any step is
+ * counted as lost instead of failing the load
+ */
+- (void) loadOnThread:(id)unused
+{
+   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+   CSDocModel *model = nil;
+   if([self reportPhase:CSDocLoaderPhase_Decrypt progress:0.0])
+   {
+      NSArray *payloadBlocks;
+      if(recovering)
+         payloadBlocks = [container intactPayloadBlocksDecryptedWithKey:bfKey missingBlocks:&lostBlockCount];
+      else
+         payloadBlocks = [container payloadBlocksDecryptedWithKey:bfKey
+                                                 progressFunction:CSDocLoaderDecryptProgress
+                                                          context:self];
+      // The decrypted blocks and everything inflated from them are CSSecureData, cleared when released
+      NSMutableArray *uncompressedBlocks = nil;
+      if(payloadBlocks != nil && [self reportPhase:CSDocLoaderPhase_Inflate progress:0.0])
+      {
+         uncompressedBlocks = [NSMutableArray arrayWithCapacity:[payloadBlocks count]];
+         NSUInteger index;
+         for(index = 0; uncompressedBlocks != nil && index < [payloadBlocks count]; index++)
+         {
+            NSMutableData *uncompressedData = [[payloadBlocks objectAtIndex:index] uncompressedData];
+            if(uncompressedData != nil)
+               [uncompressedBlocks addObject:uncompressedData];
+            else if(recovering)
+               lostBlockCount++;
+            else
+               uncompressedBlocks = nil;
+            if(![self reportPhase:CSDocLoaderPhase_Inflate
+                         progress:(double) (index + 1) / (double) [payloadBlocks count]])
+               uncompressedBlocks = nil;
+         }
+      }
+      NSMutableArray *entries = nil;
+      if(uncompressedBlocks != nil && [self reportPhase:CSDocLoaderPhase_Unarchive progress:0.0])
+      {
+         entries = [NSMutableArray arrayWithCapacity:25];
+         NSUInteger index;
+         for(index = 0; entries != nil && index < [uncompressedBlocks count]; index++)
+         {
+            NSMutableArray *blockEntries =
+               [CSEntrySerializer entriesFromData:[uncompressedBlocks objectAtIndex:index]];
+            if(blockEntries != nil)
+               [entries addObjectsFromArray:blockEntries];
+            else if(recovering)
+               lostBlockCount++;
+            else
+               entries = nil;
+            if(![self reportPhase:CSDocLoaderPhase_Unarchive
+                         progress:(double) (index + 1) / (double) [uncompressedBlocks count]])
+               entries = nil;
+         }
+      }
+      // Recovering nothing at all is still a failure
+      if(recovering && [entries count] == 0)
+         entries = nil;
+      // A saved index that matches the blocks spares sorting; recovered entries never match one
+      CSDocIndex *docIndex = nil;
+      if(entries != nil && !recovering)
+      {
+         NSMutableData *uncompressedIndex = [[container indexPayloadDecryptedWithKey:bfKey] uncompressedData];
+         if(uncompressedIndex != nil)
+            docIndex = [[[CSDocIndex alloc] initWithSerializedData:uncompressedIndex] autorelease];
+      }
+      if(entries != nil && [self reportPhase:CSDocLoaderPhase_Sort progress:0.0])
+         model = [[CSDocModel alloc] initWithEntries:entries index:docIndex];
+   }
+#if defined(DEBUG)
+   if(model == nil && !cancelled)
+      NSLog(@"CSDocLoader loadOnThread: failed to load document");
+#endif
+
+   [self performSelectorOnMainThread:@selector(reportResultOnMainThread:)
+                          withObject:(model != nil ? (id) model : (id) [NSNull null])
+                       waitUntilDone:NO];
+   [model release];
+   [pool release];
+}
+
+
+/*
+ * Pass progress along to the main thread, only when the whole percentage
+ * changes; returns NO once cancelled
+ */
+- (BOOL) reportPhase:(NSInteger)phase progress:(double)progress
+{
+   if(cancelled)
+      return NO;
+
+   NSInteger percent = phase * 100 + (NSInteger) (progress * 100.0);
+   if(percent != lastReportedPercent)
+   {
+      lastReportedPercent = percent;
+      NSArray *phaseAndProgress = [NSArray arrayWithObjects:[NSNumber numberWithInteger:phase],
+                                                            [NSNumber numberWithDouble:progress],
+                                                            nil];
+      [self performSelectorOnMainThread:@selector(reportProgressOnMainThread:)
+                             withObject:phaseAndProgress
+                          waitUntilDone:NO];
+   }
+
+   return !cancelled;
+}
+
+
+#pragma mark -
+#pragma mark Main Thread
+- (void) reportProgressOnMainThread:(NSArray *)phaseAndProgress
+{
+   if(!cancelled)
+      [delegate docLoader:self
+            didReachPhase:[[phaseAndProgress objectAtIndex:0] integerValue]
+                 progress:[[phaseAndProgress objectAtIndex:1] doubleValue]];
+}
+
+
+- (void) reportResultOnMainThread:(id)modelOrNull
+{
+   if(!cancelled)
+      [delegate docLoader:self didFinishWithModel:(modelOrNull != [NSNull null] ? modelOrNull : nil)];
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [container release];
+   [bfKey release];
+   [super dealloc];
+}
+
+@end
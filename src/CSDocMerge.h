@@ -0,0 +1,85 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocMerge.h */
+
+#import <Foundation/Foundation.h>
+
+@class CSDocModel;
+
+/*
+ * Keys to the dictionaries in -changes and -conflicts; the values are entries
+ * (as from CSDocModel's entryForEntryID:), or NSNull where the model has no
+ * such entry (or, in conflicts, there is no ancestor)
+ */
+extern NSString * const CSDocMergeKey_EntryID;
+extern NSString * const CSDocMergeKey_LocalEntry;
+extern NSString * const CSDocMergeKey_RemoteEntry;
+extern NSString * const CSDocMergeKey_AncestorEntry;
+
+/*
+ * Works out what it takes to bring the changes made in a remote copy of a
+ * document, since a common ancestor, into the local copy.  Entries are matched
+ * by ID and compared by content hash (see CSDocDigest), and only buckets
+ * where the remote digest differs from the ancestor's are looked into, so the
+ * work goes with the number of entries changed, not the size of the document.
+ *
+ * Entries changed remotely but not locally become additions, changes, or
+ * deletions; entries changed on both sides (differently), or whose names would
+ * clash, are conflicts, left for the user.  Without an ancestor, remote-only
+ * entries are additions and entries differing on the two sides are conflicts.
+ */
+@interface CSDocMerge : NSObject
+{
+   NSMutableArray *additions;   // Remote entries
+   NSMutableArray *changes;     // Dictionaries, keyed by CSDocMergeKey_*
+   NSMutableArray *deletions;   // Local entries
+   NSMutableArray *conflicts;   // Dictionaries, keyed by CSDocMergeKey_*
+}
+
+// Ancestor may be nil
+- (id) initWithAncestor:(CSDocModel *)ancestor local:(CSDocModel *)local remote:(CSDocModel *)remote;
+
+- (NSArray *) additions;
+- (NSArray *) changes;
+- (NSArray *) deletions;
+- (NSArray *) conflicts;
+- (BOOL) hasChanges;
+
+/*
+ * Apply the additions, changes, and deletions (not the conflicts) to the
+ * given model, normally the local one, through its bulk add and change
+ * methods; returns how many couldn't be applied
+ */
+- (NSInteger) applyToModel:(CSDocModel *)model;
+
+@end
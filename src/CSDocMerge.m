@@ -0,0 +1,288 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocMerge.m */
+
+#import "CSDocMerge.h"
+#import "CSDocDigest.h"
+#import "CSDocModel.h"
+
+NSString * const CSDocMergeKey_EntryID = @"CSDocMergeKey_EntryID";
+NSString * const CSDocMergeKey_LocalEntry = @"CSDocMergeKey_LocalEntry";
+NSString * const CSDocMergeKey_RemoteEntry = @"CSDocMergeKey_RemoteEntry";
+NSString * const CSDocMergeKey_AncestorEntry = @"CSDocMergeKey_AncestorEntry";
+
+
+@interface CSDocMerge (InternalMethods)
+- (void) compareEntryID:(NSString *)entryID
+             ofAncestor:(CSDocModel *)ancestor
+                  local:(CSDocModel *)local
+                 remote:(CSDocModel *)remote;
+- (void) addConflictForEntryID:(NSString *)entryID
+                      ancestor:(NSDictionary *)ancestorEntry
+                         local:(NSDictionary *)localEntry
+                        remote:(NSDictionary *)remoteEntry;
+@end
+
+
+@implementation CSDocMerge
+
+/*
+ * Compare the digests bucket by bucket, then entry by entry within the buckets
+ * the remote side changed
+ */
+- (id) initWithAncestor:(CSDocModel *)ancestor local:(CSDocModel *)local remote:(CSDocModel *)remote
+{
+   self = [super init];
+   if(self != nil)
+   {
+      additions = [[NSMutableArray alloc] initWithCapacity:10];
+      changes = [[NSMutableArray alloc] initWithCapacity:10];
+      deletions = [[NSMutableArray alloc] initWithCapacity:10];
+      conflicts = [[NSMutableArray alloc] initWithCapacity:10];
+
+      CSDocDigest *ancestorDigest = [ancestor digest];
+      CSDocDigest *remoteDigest = [remote digest];
+      // Without an ancestor, the local side is the baseline
+      CSDocDigest *baseDigest = (ancestor != nil ? ancestorDigest : [local digest]);
+      NSUInteger bucket;
+      for(bucket = 0; bucket < CSDocDigestBucketCount; bucket++)
+      {
+         if([[remoteDigest hashOfBucket:bucket] isEqualToData:[baseDigest hashOfBucket:bucket]])
+            continue;
+
+         NSMutableSet *entryIDs = [NSMutableSet setWithSet:[remoteDigest entryIDsInBucket:bucket]];
+         if(ancestor != nil)
+            [entryIDs unionSet:[ancestorDigest entryIDsInBucket:bucket]];
+         NSEnumerator *idEnumerator = [entryIDs objectEnumerator];
+         id oneID;
+         while((oneID = [idEnumerator nextObject]) != nil)
+            [self compareEntryID:oneID ofAncestor:ancestor local:local remote:remote];
+      }
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Results
+- (NSArray *) additions
+{
+   return additions;
+}
+
+
+- (NSArray *) changes
+{
+   return changes;
+}
+
+
+- (NSArray *) deletions
+{
+   return deletions;
+}
+
+
+- (NSArray *) conflicts
+{
+   return conflicts;
+}
+
+
+- (BOOL) hasChanges
+{
+   return ([additions count] > 0 || [changes count] > 0 || [deletions count] > 0);
+}
+
+
+/*
+ * Deletions go first, then changes, then additions, so names given up along
+ * the way are free for those after; entries are looked up by ID in the given
+ * model, in case it isn't the local model the merge was worked out against
+ */
+- (NSInteger) applyToModel:(CSDocModel *)model
+{
+   NSInteger failures = 0;
+   CSDocDigest *modelDigest = [model digest];
+
+   NSMutableArray *namesToDelete = [NSMutableArray arrayWithCapacity:[deletions count]];
+   NSEnumerator *entryEnumerator = [deletions objectEnumerator];
+   id oneEntry;
+   while((oneEntry = [entryEnumerator nextObject]) != nil)
+   {
+      NSString *name = [modelDigest nameForEntryID:[oneEntry objectForKey:CSDocModelKey_EntryID]];
+      if(name != nil)
+         [namesToDelete addObject:name];
+      else
+         failures++;
+   }
+   if([namesToDelete count] > 0)
+      failures += [namesToDelete count] - [model deleteEntriesWithNamesInArray:namesToDelete];
+
+   NSEnumerator *changeEnumerator = [changes objectEnumerator];
+   id oneChange;
+   while((oneChange = [changeEnumerator nextObject]) != nil)
+   {
+      NSDictionary *remoteEntry = [oneChange objectForKey:CSDocMergeKey_RemoteEntry];
+      NSString *name = [modelDigest nameForEntryID:[oneChange objectForKey:CSDocMergeKey_EntryID]];
+      if(name == nil || ![model changeEntryWithName:name
+                                            newName:[remoteEntry objectForKey:CSDocModelKey_Name]
+                                            account:[remoteEntry objectForKey:CSDocModelKey_Acct]
+                                           password:[remoteEntry objectForKey:CSDocModelKey_Passwd]
+                                                URL:[remoteEntry objectForKey:CSDocModelKey_URL]
+                                           category:[remoteEntry objectForKey:CSDocModelKey_Category]
+                                          notesRTFD:[remoteEntry objectForKey:CSDocModelKey_Notes]])
+         failures++;
+   }
+
+   NSMutableArray *addedNames = [NSMutableArray arrayWithCapacity:[additions count]];
+   entryEnumerator = [additions objectEnumerator];
+   while((oneEntry = [entryEnumerator nextObject]) != nil)
+   {
+      NSString *name = [oneEntry objectForKey:CSDocModelKey_Name];
+      if([model addBulkEntryWithName:name
+                             account:[oneEntry objectForKey:CSDocModelKey_Acct]
+                            password:[oneEntry objectForKey:CSDocModelKey_Passwd]
+                                 URL:[oneEntry objectForKey:CSDocModelKey_URL]
+                            category:[oneEntry objectForKey:CSDocModelKey_Category]
+                           notesRTFD:[oneEntry objectForKey:CSDocModelKey_Notes]
+                             entryID:[oneEntry objectForKey:CSDocModelKey_EntryID]])
+         [addedNames addObject:name];
+      else
+         failures++;
+   }
+   if([addedNames count] > 0)
+      [model registerAddForNamesInArray:addedNames];
+
+   return failures;
+}
+
+
+#pragma mark -
+#pragma mark Comparing
+/*
+ * Sort out one entry the remote side may have changed; a nil hash means that
+ * side doesn't have the entry
+ */
+- (void) compareEntryID:(NSString *)entryID
+             ofAncestor:(CSDocModel *)ancestor
+                  local:(CSDocModel *)local
+                 remote:(CSDocModel *)remote
+{
+   NSData *ancestorHash = [[ancestor digest] contentHashForEntryID:entryID];
+   NSData *localHash = [[local digest] contentHashForEntryID:entryID];
+   NSData *remoteHash = [[remote digest] contentHashForEntryID:entryID];
+   // Unchanged remotely, nothing to bring over
+   if(ancestorHash != nil && [ancestorHash isEqualToData:remoteHash])
+      return;
+
+   NSDictionary *ancestorEntry = [ancestor entryForEntryID:entryID];
+   NSDictionary *localEntry = [local entryForEntryID:entryID];
+   NSDictionary *remoteEntry = [remote entryForEntryID:entryID];
+   if(remoteHash == nil)
+   {
+      // Deleted remotely; fine unless changed locally
+      if(localHash == nil)
+         return;
+      if([localHash isEqualToData:ancestorHash])
+         [deletions addObject:localEntry];
+      else
+         [self addConflictForEntryID:entryID ancestor:ancestorEntry local:localEntry remote:nil];
+   }
+   else if(localHash == nil)
+   {
+      // Added remotely, unless deleted locally; an added entry mustn't take the name of another
+      NSString *remoteName = [remoteEntry objectForKey:CSDocModelKey_Name];
+      if(ancestorHash != nil)
+         [self addConflictForEntryID:entryID ancestor:ancestorEntry local:nil remote:remoteEntry];
+      else if([local rowForName:remoteName] != -1)
+         [self addConflictForEntryID:entryID
+                            ancestor:nil
+                               local:[local entryForEntryID:[local entryIDForName:remoteName]]
+                              remote:remoteEntry];
+      else
+         [additions addObject:remoteEntry];
+   }
+   else if([localHash isEqualToData:remoteHash])
+      return;   // Same change on both sides
+   else if(ancestorHash != nil && [localHash isEqualToData:ancestorHash])
+   {
+      // Changed remotely only; a rename mustn't take the name of another entry
+      NSString *remoteName = [remoteEntry objectForKey:CSDocModelKey_Name];
+      NSString *clashingID = [local entryIDForName:remoteName];
+      if(clashingID != nil && ![clashingID isEqualToString:entryID])
+         [self addConflictForEntryID:entryID ancestor:ancestorEntry local:localEntry remote:remoteEntry];
+      else
+         [changes addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                                             entryID, CSDocMergeKey_EntryID,
+                                             localEntry, CSDocMergeKey_LocalEntry,
+                                             remoteEntry, CSDocMergeKey_RemoteEntry,
+                                             nil]];
+   }
+   else
+      [self addConflictForEntryID:entryID ancestor:ancestorEntry local:localEntry remote:remoteEntry];
+}
+
+
+- (void) addConflictForEntryID:(NSString *)entryID
+                      ancestor:(NSDictionary *)ancestorEntry
+                         local:(NSDictionary *)localEntry
+                        remote:(NSDictionary *)remoteEntry
+{
+   NSNull *none = [NSNull null];
+   [conflicts addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                                         entryID, CSDocMergeKey_EntryID,
+                                         (localEntry != nil ? (id) localEntry : none),
+                                         CSDocMergeKey_LocalEntry,
+                                         (remoteEntry != nil ? (id) remoteEntry : none),
+                                         CSDocMergeKey_RemoteEntry,
+                                         (ancestorEntry != nil ? (id) ancestorEntry : none),
+                                         CSDocMergeKey_AncestorEntry,
+                                         nil]];
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [additions release];
+   [changes release];
+   [deletions release];
+   [conflicts release];
+   [super dealloc];
+}
+
+@end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -34,6 +34,11 @@
 
 #import <Foundation/Foundation.h>
 
+@class CSAuditIndex;
+@class CSDocDigest;
+@class CSDocIndex;
+@class CSUndoJournal;
+
 /*
  * Identifiers for the table columns as well as keys for each entry;
  * Name, Acct, Passwd, URL, and Category are NSStrings, Notes is NSData
@@ -45,11 +50,24 @@ extern NSString * const CSDocModelKey_URL;
 extern NSString * const CSDocModelKey_Category;
 extern NSString * const CSDocModelKey_Notes;
 
+/*
+ * Not a column; every entry carries an ID (an NSString) which stays the same
+ * through changes and renames, and across copies of the document
+ */
+extern NSString * const CSDocModelKey_EntryID;
+
 // Notifications
 extern NSString * const CSDocModelDidChangeSortNotification;
 extern NSString * const CSDocModelDidAddEntryNotification;
 extern NSString * const CSDocModelDidChangeEntryNotification;
 extern NSString * const CSDocModelDidRemoveEntryNotification;
+extern NSString * const CSDocModelDidChangeRowsNotification;
+
+/*
+ * Posted when an undo (or redo) finds its record already dropped to stay
+ * under the undo memory limit, so nothing was changed
+ */
+extern NSString * const CSDocModelDidLoseUndoNotification;
 
 /*
  * Keys to the dictionaries contained in the userInfo of notifications
@@ -60,6 +78,22 @@ extern NSString * const CSDocModelNotificationInfoKey_ChangedNameFrom;
 extern NSString * const CSDocModelNotificationInfoKey_ChangedNameTo;
 extern NSString * const CSDocModelNotificationInfoKey_DeletedNames;
 
+/*
+ * Keys to the change set in the userInfo of CSDocModelDidChangeRowsNotification, posted once
+ * the entries have been re-sorted after any change; the ...Rows' values are NSIndexSet, with
+ * RemovedRows giving rows from before the change and the rest rows after it.  RowMap is an
+ * NSData holding an NSInteger for each row from before the change, giving its row after the
+ * change (-1 if it was removed).
+ */
+extern NSString * const CSDocModelNotificationInfoKey_InsertedRows;
+extern NSString * const CSDocModelNotificationInfoKey_RemovedRows;
+extern NSString * const CSDocModelNotificationInfoKey_UpdatedRows;
+extern NSString * const CSDocModelNotificationInfoKey_MovedRows;
+extern NSString * const CSDocModelNotificationInfoKey_RowMap;
+
+// Rough size of each separately compressed and encrypted block of entries in a saved document
+extern const NSUInteger CSDocModelBlockTargetSize;
+
 @interface CSDocModel : NSObject
 {
    NSMutableArray *allEntries;     // Of NSMutableDictionary's
@@ -69,18 +103,61 @@ extern NSString * const CSDocModelNotificationInfoKey_DeletedNames;
    NSString *sortKey;
    BOOL sortAscending;
    NSUndoManager *undoManager;
+   CSUndoJournal *undoJournal;
+   // Pending change set, gathered until the next sort
+   NSMutableArray *rowOrderBeforeChange;
+   NSHashTable *entriesUpdatedBeforeSort;
+   // Copy-on-write state while snapshots are out
+   NSInteger snapshotCount;
+   NSHashTable *privateEntries;
+   // Typeahead indexes (CSPrefixIndex) by key, built as needed until the rows change
+   NSMutableDictionary *prefixIndexes;
+   // Search arenas (CSTextArena) by key, NSNull for whole entries, likewise
+   NSMutableDictionary *textArenas;
+   // Reused passwords and duplicate entries, kept up to date with every change
+   CSAuditIndex *auditIndex;
+   // Content hashes by entry ID, for comparing and merging models
+   CSDocDigest *digest;
+   // Sort orders saved with the document (CSDocIndex), good until the first change
+   CSDocIndex *savedIndex;
+   NSArray *savedOrder;
+   // Count of entries in each category, kept up to date with every change
+   NSCountedSet *categoryCounts;
 }
 
 // Initialization
 - (id) init;
+- (id) initWithEntries:(NSMutableArray *)entries;
+- (id) initWithEntries:(NSMutableArray *)entries index:(CSDocIndex *)docIndex;
 - (id) initWithEncryptedData:(NSData *)encryptedData bfKey:(NSData *)bfKey;
 
 // For saving
++ (NSData *) encryptedDataForEntries:(NSArray *)entries
+                             withKey:(NSData *)bfKey
+                    compressionCodec:(NSString *)codec
+                               level:(int)level
+                longDistanceMatching:(BOOL)useLongMode;
 - (NSData *) encryptedDataWithKey:(NSData *)bfKey;
+- (NSData *) encryptedDataWithKey:(NSData *)bfKey
+                 compressionCodec:(NSString *)codec
+                            level:(int)level
+             longDistanceMatching:(BOOL)useLongMode;
+- (NSString *) compressionBenchmarkReport;
+
+/*
+ * Unchanging copies of the entries, for saving and exporting in the
+ * background while editing carries on.  Apart from these, the model belongs
+ * to the main thread; the searches it splits across the processors (see
+ * CSTaskPool) are over before it carries on, so nothing needs locking.
+ */
+- (NSArray *) beginSnapshot;
+- (void) endSnapshot;
 
 // Undo manager access
 - (void) setUndoManager:(NSUndoManager *)newManager;
 - (NSUndoManager *) undoManager;
+- (void) setUndoMemoryLimit:(NSUInteger)newLimit;
+- (NSUInteger) undoMemoryLimit;
 
 // Sorting
 - (void) setSortKey:(NSString *)newSortKey;
@@ -111,6 +188,13 @@ extern NSString * const CSDocModelNotificationInfoKey_DeletedNames;
                           URL:(NSString *)url
                      category:(NSString *)category
                     notesRTFD:(NSData *)notes;
+- (BOOL) addBulkEntryWithName:(NSString *)name
+                      account:(NSString *)account
+                     password:(NSString *)password
+                          URL:(NSString *)url
+                     category:(NSString *)category
+                    notesRTFD:(NSData *)notes
+                      entryID:(NSString *)entryID;
 - (void) registerAddForNamesInArray:(NSArray *)nameArray;
 - (BOOL) changeEntryWithName:(NSString *)name
                      newName:(NSString *)newName
@@ -130,5 +214,23 @@ extern NSString * const CSDocModelNotificationInfoKey_DeletedNames;
 - (NSArray *) rowsMatchingString:(NSString *)findMe
                       ignoreCase:(BOOL)ignoreCase
                           forKey:(NSString *)key;
+- (BOOL) entryAtRow:(NSInteger)row
+      matchesString:(NSString *)findMe
+         ignoreCase:(BOOL)ignoreCase
+             forKey:(NSString *)key;
+
+// Names of all the categories in use, in no particular order
+- (NSArray *) categories;
+
+// Auditing; arrays of arrays of names, each inner array naming two or more entries
+- (NSArray *) reusedPasswordGroups;
+- (NSArray *) duplicateEntryGroups;
+- (NSArray *) namesSharingPasswordWithName:(NSString *)name;
+
+// Entry identity and content, for comparing and merging models (see CSDocMerge)
+- (NSString *) entryIDForName:(NSString *)name;
+- (NSDictionary *) entryForEntryID:(NSString *)entryID;
+- (CSDocDigest *) digest;
+- (NSData *) summaryHash;
 
 @end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -34,6 +34,16 @@
 /* CSDocModel.m */
 
 #import "CSDocModel.h"
+#import "CSAuditIndex.h"
+#import "CSDocContainer.h"
+#import "CSDocDigest.h"
+#import "CSDocIndex.h"
+#import "CSEntrySerializer.h"
+#import "CSPrefixIndex.h"
+#import "CSSecureData.h"
+#import "CSTaskPool.h"
+#import "CSTextArena.h"
+#import "CSUndoJournal.h"
 #import "NSAttributedString_RWDA.h"
 #import "NSData_compress.h"
 #import "NSData_crypto.h"
@@ -45,25 +55,68 @@ NSString * const CSDocModelKey_Passwd = @"password";
 NSString * const CSDocModelKey_URL = @"url";
 NSString * const CSDocModelKey_Category = @"category";
 NSString * const CSDocModelKey_Notes = @"notes";
+NSString * const CSDocModelKey_EntryID = @"entryID";
 
 NSString * const CSDocModelDidChangeSortNotification = @"CSDocModelDidChangeSortNotification";
 NSString * const CSDocModelDidAddEntryNotification = @"CSDocModelDidAddEntryNotification";
 NSString * const CSDocModelDidChangeEntryNotification = @"CSDocModelDidChangeEntryNotification";
 NSString * const CSDocModelDidRemoveEntryNotification = @"CSDocModelDidRemoveEntryNotification";
+NSString * const CSDocModelDidChangeRowsNotification = @"CSDocModelDidChangeRowsNotification";
+NSString * const CSDocModelDidLoseUndoNotification = @"CSDocModelDidLoseUndoNotification";
 
 NSString * const CSDocModelNotificationInfoKey_AddedNames = @"CSDocModelNotificationInfoKey_AddedNames";
 NSString * const CSDocModelNotificationInfoKey_ChangedNameFrom =
    @"CSDocModelNotificationInfoKey_ChangedNameFrom";
 NSString * const CSDocModelNotificationInfoKey_ChangedNameTo = @"CSDocModelNotificationInfoKey_ChangedNameTo";
 NSString * const CSDocModelNotificationInfoKey_DeletedNames = @"CSDocModelNotificationInfoKey_DeletedName";
+NSString * const CSDocModelNotificationInfoKey_InsertedRows = @"CSDocModelNotificationInfoKey_InsertedRows";
+NSString * const CSDocModelNotificationInfoKey_RemovedRows = @"CSDocModelNotificationInfoKey_RemovedRows";
+NSString * const CSDocModelNotificationInfoKey_UpdatedRows = @"CSDocModelNotificationInfoKey_UpdatedRows";
+NSString * const CSDocModelNotificationInfoKey_MovedRows = @"CSDocModelNotificationInfoKey_MovedRows";
+NSString * const CSDocModelNotificationInfoKey_RowMap = @"CSDocModelNotificationInfoKey_RowMap";
+
+// Entries are saved in blocks of about this much serialized data, so damage to one loses only those
+const NSUInteger CSDocModelBlockTargetSize = 64 * 1024;
+
+
+// Rows checked per piece when a search without an arena is split across the processors
+static const NSUInteger CSDocModelSearchGrainRows = 256;
 
 
 // Used to sort the array
 NSInteger sortEntries(id dict1, id dict2, void *context);
 
+/*
+ * A search of the rows without an arena, setting rowMatches[row] for each
+ * matching row
+ */
+typedef struct
+{
+   CSDocModel *model;
+   NSString *findString;
+   BOOL ignoreCase;
+   NSString *key;
+   unsigned char *rowMatches;
+} CSDocModelSearch;
+
+static void CSDocModelSearchRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *searchInfo);
+
 @interface CSDocModel (InternalMethods)
-- (NSString *) nonNilStringFrom:(NSDictionary *)dict forKey:(NSString *)key;
-- (NSData *) nonNilDataFrom:(NSDictionary *)dict forKey:(NSString *)key;
+- (void) registerUndoForJournalRecordID:(NSNumber *)recordID actionName:(NSString *)actionName;
+- (void) noteRowChangesPending;
+- (void) noteEntryUpdated:(NSMutableDictionary *)entry;
+- (void) postRowChangesFromOrder:(NSArray *)oldOrder;
++ (NSUInteger) estimatedSerializedSizeOfEntry:(NSDictionary *)entry;
+- (NSMutableDictionary *) writableEntryAtRow:(NSInteger)row;
+- (NSInteger) sortedRowBeginningWithString:(NSString *)findString
+                                ignoreCase:(BOOL)ignoreCase;
+- (CSPrefixIndex *) prefixIndexForKey:(NSString *)key;
+- (CSTextArena *) textArenaForKey:(NSString *)key;
+- (void) discardSearchCaches;
++ (NSString *) generatedEntryID;
++ (NSString *) legacyEntryIDForName:(NSString *)name;
+- (void) indexEntry:(NSDictionary *)entry;
+- (void) unindexEntry:(NSDictionary *)entry;
 @end
 
 
@@ -95,6 +148,42 @@ static NSArray *keyArray;
 {
    sortKey = CSDocModelKey_Name;
    sortAscending = YES;
+   undoJournal = [[CSUndoJournal alloc] init];
+   rowOrderBeforeChange = nil;
+   // Entries are mutable dictionaries, so they have to be tracked by identity, not hash
+   entriesUpdatedBeforeSort = [[NSHashTable alloc]
+                               initWithOptions:(NSPointerFunctionsOpaqueMemory
+                                                | NSPointerFunctionsOpaquePersonality)
+                                      capacity:25];
+   snapshotCount = 0;
+   privateEntries = [[NSHashTable alloc]
+                     initWithOptions:(NSPointerFunctionsOpaqueMemory | NSPointerFunctionsOpaquePersonality)
+                            capacity:25];
+   prefixIndexes = [[NSMutableDictionary alloc] initWithCapacity:2];
+   textArenas = [[NSMutableDictionary alloc] initWithCapacity:2];
+   auditIndex = [[CSAuditIndex alloc] init];
+   digest = [[CSDocDigest alloc] init];
+   savedIndex = nil;
+   savedOrder = nil;
+   categoryCounts = [[NSCountedSet alloc] initWithCapacity:10];
+   /*
+    * Documents from before entry IDs get them now, kept from the next save on;
+    * they come from the names, so every copy of such a document (and every
+    * open of it) agrees on them, and merging copies matches entries up.  Any
+    * copies of an ID get a new one.
+    */
+   NSEnumerator *entryEnumerator = [allEntries objectEnumerator];
+   id oneEntry;
+   while((oneEntry = [entryEnumerator nextObject]) != nil)
+   {
+      NSString *entryID = [oneEntry objectForKey:CSDocModelKey_EntryID];
+      if(entryID == nil)
+         entryID = [CSDocModel legacyEntryIDForName:[oneEntry objectForKey:CSDocModelKey_Name]];
+      if([digest contentHashForEntryID:entryID] != nil)
+         entryID = [CSDocModel generatedEntryID];
+      [oneEntry setObject:entryID forKey:CSDocModelKey_EntryID];
+      [self indexEntry:oneEntry];
+   }
 }
 
 
@@ -116,6 +205,40 @@ static NSArray *keyArray;
 }
 
 
+/*
+ * Initialize with the given entries, as unarchived from a document
+ */
+- (id) initWithEntries:(NSMutableArray *)entries
+{
+   return [self initWithEntries:entries index:nil];
+}
+
+
+/*
+ * Initialize with the given entries, as unarchived from a document, and the
+ * index saved with them (may be nil), which spares sorting them
+ */
+- (id) initWithEntries:(NSMutableArray *)entries index:(CSDocIndex *)docIndex
+{
+   self = [super init];
+   if(self != nil)
+   {
+      allEntries = [entries retain];
+      entryASCache = [[NSMutableDictionary alloc] initWithCapacity:[allEntries count]];
+      nameRowCache = [[NSMutableDictionary alloc] initWithCapacity:[allEntries count]];
+      [self setupSelf];
+      if(docIndex != nil && [docIndex entryCount] == [allEntries count])
+      {
+         savedIndex = [docIndex retain];
+         savedOrder = [allEntries copy];
+      }
+      [self sortEntries];
+   }
+
+   return self;
+}
+
+
 /*
  * Initialize with the given data encrypted with the given key; if the key
  * doesn't work, releases itself and returns nil
@@ -129,56 +252,56 @@ static NSArray *keyArray;
             (encryptedData == nil ? @"encryptedData" : @""),
             (bfKey == nil ? @"bfKey" : @""));
 #endif
+      [self release];
       return nil;
    }
-   
-   self = [super init];
-   if(self != nil)
+
+   NSMutableArray *entries = nil;
+   CSDocContainer *container = [[CSDocContainer alloc] initWithData:encryptedData];
+   NSArray *payloadBlocks = nil;
+   CSDocIndex *docIndex = nil;
+   if(container != nil && [container isPossibleKey:bfKey])
+      payloadBlocks = [container payloadBlocksDecryptedWithKey:bfKey];
+   if(payloadBlocks != nil)
    {
-      allEntries = nil;
-      // Separate into the IV and compressed & encrypted data
-      NSData *iv = [encryptedData subdataWithRange:NSMakeRange(0, 8)];
-      NSData *ceData = [encryptedData subdataWithRange:NSMakeRange(8, [encryptedData length] - 8)];
-      
-      NSMutableData *decryptedData = [ceData blowfishDecryptedDataWithKey:bfKey iv:iv];
-      if(decryptedData != nil)
+      NSMutableData *uncompressedIndex = [[container indexPayloadDecryptedWithKey:bfKey] uncompressedData];
+      if(uncompressedIndex != nil)
+         docIndex = [[[CSDocIndex alloc] initWithSerializedData:uncompressedIndex] autorelease];
+   }
+   [container release];
+   if(payloadBlocks != nil)
+   {
+      entries = [NSMutableArray arrayWithCapacity:25];
+      NSEnumerator *blockEnumerator = [payloadBlocks objectEnumerator];
+      id oneBlock;
+      while(entries != nil && (oneBlock = [blockEnumerator nextObject]) != nil)
       {
-         NSMutableData *uncompressedData = [decryptedData uncompressedData];
-         // XXX - decryptedData can be zeroed
+         // Both the decrypted blocks and uncompressedData are CSSecureData, cleared when released
+         NSMutableData *uncompressedData = [oneBlock uncompressedData];
+         NSMutableArray *blockEntries = nil;
          if(uncompressedData != nil)
-         {
-            allEntries = [NSUnarchiver unarchiveObjectWithData:uncompressedData];
-            // XXX - uncompressedData can be zeroed
-            if(allEntries != nil)
-            {
-               [allEntries retain];
-               entryASCache = [[NSMutableDictionary alloc] initWithCapacity:[allEntries count]];
-               nameRowCache = [[NSMutableDictionary alloc] initWithCapacity:[allEntries count]];
-               [self setupSelf];
-               [self sortEntries];
-            }
-#if defined(DEBUG)
-            else
-               NSLog(@"CSDocModel initWithEncryptedData:bfKey: unarchiving of uncompressed data failed");
-#endif
-         }
+            blockEntries = [CSEntrySerializer entriesFromData:uncompressedData];
 #if defined(DEBUG)
          else
             NSLog(@"CSDocModel initWithEncryptedData:bfKey: uncompressing of decrypted data failed");
 #endif
+         if(blockEntries != nil)
+            [entries addObjectsFromArray:blockEntries];
+         else
+            entries = nil;
       }
+   }
 #if defined(DEBUG)
-      else
-         NSLog(@"CSDocModel initWithEncryptedData:bfKey: decryption failed");
+   else
+      NSLog(@"CSDocModel initWithEncryptedData:bfKey: decryption failed");
 #endif
-      if(allEntries == nil)
-      {
-         [self release];
-         self = nil;
-      }
+   if(entries == nil)
+   {
+      [self release];
+      return nil;
    }
-   
-   return self;
+
+   return [self initWithEntries:entries index:docIndex];
 }
 
 
@@ -198,21 +321,166 @@ static NSArray *keyArray;
 
 
 /*
- * Get data for the model, encrypted with the given key
+ * Roughly how much an entry adds to the serialized data, close enough to split
+ * entries into blocks without serializing twice
+ */
++ (NSUInteger) estimatedSerializedSizeOfEntry:(NSDictionary *)entry
+{
+   NSUInteger size = 4;
+   NSEnumerator *valueEnumerator = [entry objectEnumerator];
+   id oneValue;
+   while((oneValue = [valueEnumerator nextObject]) != nil)
+      size += [oneValue length] + 4;
+
+   return size;
+}
+
+
+/*
+ * Get data for the given entries (the model's own, or a snapshot), compressed
+ * with the given codec and level (see NSData_compress), then encrypted with the
+ * given key; nothing here touches a model, so it's safe on any thread
+ */
++ (NSData *) encryptedDataForEntries:(NSArray *)entries
+                             withKey:(NSData *)bfKey
+                    compressionCodec:(NSString *)codec
+                               level:(int)level
+                longDistanceMatching:(BOOL)useLongMode
+{
+   NSMutableArray *payloadBlocks = [NSMutableArray arrayWithCapacity:[entries count] / 100 + 1];
+   NSUInteger blockStart = 0;
+   NSUInteger blockSize = 0;
+   NSUInteger index;
+   for(index = 0; index < [entries count]; index++)
+   {
+      blockSize += [self estimatedSerializedSizeOfEntry:[entries objectAtIndex:index]];
+      if(blockSize >= CSDocModelBlockTargetSize || index + 1 == [entries count])
+      {
+         NSArray *blockEntries = [entries subarrayWithRange:NSMakeRange(blockStart, index + 1 - blockStart)];
+         // Both serializedData and compressedData are CSSecureData, cleared when released
+         NSMutableData *serializedData = [CSEntrySerializer serializedDataForEntries:blockEntries];
+         NSMutableData *compressedData = [serializedData compressedDataWithCodec:codec
+                                                                            level:level
+                                                             longDistanceMatching:useLongMode];
+         if(compressedData == nil)
+            return nil;
+         [payloadBlocks addObject:compressedData];
+         blockStart = index + 1;
+         blockSize = 0;
+      }
+   }
+   // An empty document still gets one (empty) block
+   if([payloadBlocks count] == 0)
+   {
+      NSMutableData *compressedData = [[CSEntrySerializer serializedDataForEntries:entries]
+                                       compressedDataWithCodec:codec level:level longDistanceMatching:useLongMode];
+      if(compressedData == nil)
+         return nil;
+      [payloadBlocks addObject:compressedData];
+   }
+
+   // The index is a convenience; a document saves fine without one
+   CSDocIndex *docIndex = [[CSDocIndex alloc] initWithEntries:entries];
+   NSMutableData *indexPayload = [[docIndex serializedData] compressedDataWithCodec:codec level:level];
+   [docIndex release];
+
+   return [CSDocContainer containerDataWithPayloadBlocks:payloadBlocks indexPayload:indexPayload key:bfKey];
+}
+
+
+/*
+ * Get data for the model, encrypted with the given key, compressed with zlib
+ */
+- (NSData *) encryptedDataWithKey:(NSData *)bfKey
+{
+   return [self encryptedDataWithKey:bfKey
+                    compressionCodec:NSDataCompressionCodecZlib
+                               level:NSDataCompressionLevelDefault
+                longDistanceMatching:NO];
+}
+
+
+/*
+ * Get data for the model, compressed with the given codec and level, then
+ * encrypted with the given key
  */
 - (NSData *) encryptedDataWithKey:(NSData *)bfKey
+                 compressionCodec:(NSString *)codec
+                            level:(int)level
+             longDistanceMatching:(BOOL)useLongMode
+{
+   return [CSDocModel encryptedDataForEntries:allEntries
+                                      withKey:bfKey
+                             compressionCodec:codec
+                                        level:level
+                         longDistanceMatching:useLongMode];
+}
+
+
+#pragma mark -
+#pragma mark Snapshots
+/*
+ * Return the entries as they stand now, for saving (or exporting) on another
+ * thread while editing carries on; until the matching endSnapshot, any entry the snapshot
+ * shares is copied before it's changed (see writableEntryAtRow:), so the
+ * snapshot never changes.  The array is mutable only so it archives just like
+ * the model's own.
+ */
+- (NSArray *) beginSnapshot
 {
-   NSData *iv = [NSData randomDataOfLength:8];
-   NSData *archivedData = [NSArchiver archivedDataWithRootObject:allEntries];
-   NSMutableData *compressedData = [archivedData compressedData];
-   // XXX - archivedData can be zeroed
-   NSData *ceData = [compressedData blowfishEncryptedDataWithKey:bfKey iv:iv];
-   // XXX - compressedData can be zeroed
-   NSMutableData *ivAndData = [NSMutableData dataWithCapacity:[iv length] + [ceData length]];
-   [ivAndData appendData:iv];
-   [ivAndData appendData:ceData];
+   snapshotCount++;
+   [privateEntries removeAllObjects];
+
+   return [[allEntries mutableCopy] autorelease];
+}
+
 
-   return ivAndData;
+- (void) endSnapshot
+{
+   NSAssert(snapshotCount > 0, @"endSnapshot without beginSnapshot");
+   snapshotCount--;
+   if(snapshotCount == 0)
+      [privateEntries removeAllObjects];
+}
+
+
+/*
+ * Return the entry at the given row, ready to be changed in place; while a
+ * snapshot is out, an entry it may share is first replaced by a copy.  Entries
+ * already copied, or added since, are known not to be shared.  The copy also
+ * takes the original's place in the pending row order and updated entries, so
+ * the row changes posted after the next sort see the same entry, updated, and
+ * not one removed and another inserted.
+ */
+- (NSMutableDictionary *) writableEntryAtRow:(NSInteger)row
+{
+   NSMutableDictionary *theEntry = [allEntries objectAtIndex:row];
+   if(snapshotCount > 0 && [privateEntries member:theEntry] == nil)
+   {
+      NSMutableDictionary *original = theEntry;
+      theEntry = [[theEntry mutableCopy] autorelease];
+      [allEntries replaceObjectAtIndex:row withObject:theEntry];
+      [privateEntries addObject:theEntry];
+      NSUInteger oldRow = [rowOrderBeforeChange indexOfObjectIdenticalTo:original];
+      if(oldRow != NSNotFound)
+         [rowOrderBeforeChange replaceObjectAtIndex:oldRow withObject:theEntry];
+      if([entriesUpdatedBeforeSort containsObject:original])
+      {
+         [entriesUpdatedBeforeSort removeObject:original];
+         [entriesUpdatedBeforeSort addObject:theEntry];
+      }
+   }
+
+   return theEntry;
+}
+
+
+/*
+ * Run the compression benchmark on the real payload of this document
+ */
+- (NSString *) compressionBenchmarkReport
+{
+   return [[CSEntrySerializer serializedDataForEntries:allEntries] compressionBenchmarkReport];
 }
 
 
@@ -338,53 +606,402 @@ static NSArray *keyArray;
                                 ignoreCase:(BOOL)ignoreCase
                                     forKey:(NSString *)key
 {
-   NSRange searchRange = NSMakeRange(0, [findString length]);
+   NSInteger firstRow = -1;
+   NSUInteger findLength = [findString length];
    NSStringCompareOptions compareOptions = 0;
    if(ignoreCase)
       compareOptions = NSCaseInsensitiveSearch;
-   NSNumber *retval = nil;
-   NSInteger index;
-   for(index = 0; index < [self entryCount] && retval == nil; index++)
+   /*
+    * Rows out of order from a change not yet sorted would throw off the
+    * searches, so those (and the unindexed password column) get a plain scan
+    */
+   BOOL rowsSorted = (rowOrderBeforeChange == nil);
+   CSPrefixIndex *prefixIndex = nil;
+   if(rowsSorted && [key isEqualToString:sortKey] && ![key isEqualToString:CSDocModelKey_Notes])
+      firstRow = [self sortedRowBeginningWithString:findString ignoreCase:ignoreCase];
+   else if(rowsSorted && (prefixIndex = [self prefixIndexForKey:key]) != nil)
    {
-      if([[self stringForKey:key atRow:index] compare:findString
-                                              options:compareOptions
-                                                range:searchRange] == NSOrderedSame)
-         retval = [NSNumber numberWithInteger:index];
+      if(ignoreCase)
+         firstRow = [prefixIndex firstRowWithPrefix:findString];
+      else
+      {
+         // The exact matches are among the ones ignoring case
+         NSRange candidates = [prefixIndex rangeOfIndexesWithPrefix:findString];
+         NSUInteger index;
+         for(index = candidates.location; index < NSMaxRange(candidates); index++)
+         {
+            NSInteger oneRow = [prefixIndex rowAtIndex:index];
+            if((firstRow < 0 || oneRow < firstRow)
+               && [[self stringForKey:key atRow:oneRow] hasPrefix:findString])
+               firstRow = oneRow;
+         }
+      }
+   }
+   else
+   {
+      NSInteger index;
+      for(index = 0; index < [self entryCount] && firstRow < 0; index++)
+      {
+         NSString *oneString = [self stringForKey:key atRow:index];
+         if([oneString length] >= findLength
+            && [oneString compare:findString
+                          options:compareOptions
+                            range:NSMakeRange(0, findLength)] == NSOrderedSame)
+            firstRow = index;
+      }
    }
    
-   return retval;
+   if(firstRow < 0)
+      return nil;
+
+   return [NSNumber numberWithInteger:firstRow];
+}
+
+
+/*
+ * Binary search the sort column for the first row beginning with the given
+ * string; this compares the same way sortEntries() does, so the rows starting
+ * with it (ignoring case) are all together, with ascending sorts wanting the
+ * first row not below it and descending ones the first not above it
+ */
+- (NSInteger) sortedRowBeginningWithString:(NSString *)findString
+                                ignoreCase:(BOOL)ignoreCase
+{
+   NSUInteger findLength = [findString length];
+   NSInteger low = 0;
+   NSInteger high = [self entryCount];
+   while(low < high)
+   {
+      NSInteger middle = low + (high - low) / 2;
+      NSString *middleString = [self stringForKey:sortKey atRow:middle];
+      NSComparisonResult result = [middleString compare:findString
+                                                options:NSCaseInsensitiveSearch
+                                                  range:NSMakeRange(0, MIN([middleString length],
+                                                                           findLength))];
+      if(sortAscending ? (result == NSOrderedAscending) : (result == NSOrderedDescending))
+         low = middle + 1;
+      else
+         high = middle;
+   }
+
+   // The run of rows matching ignoring case starts at low; look along it for an exact match
+   NSInteger row;
+   for(row = low; row < [self entryCount]; row++)
+   {
+      NSString *rowString = [self stringForKey:sortKey atRow:row];
+      if([rowString length] < findLength
+         || [rowString compare:findString
+                       options:NSCaseInsensitiveSearch
+                         range:NSMakeRange(0, findLength)] != NSOrderedSame)
+         break;
+      if(ignoreCase || [rowString hasPrefix:findString])
+         return row;
+   }
+
+   return -1;
+}
+
+
+/*
+ * Return the typeahead index for the given key, building it if needed
+ *
+ * XXX The index keeps folded copies of the column's strings around until the
+ * rows next change, so the password column is never indexed
+ */
+- (CSPrefixIndex *) prefixIndexForKey:(NSString *)key
+{
+   if([key isEqualToString:CSDocModelKey_Passwd])
+      return nil;
+
+   CSPrefixIndex *prefixIndex = [prefixIndexes objectForKey:key];
+   if(prefixIndex == nil)
+   {
+      NSInteger entryCount = [self entryCount];
+      NSMutableArray *columnStrings = [NSMutableArray arrayWithCapacity:entryCount];
+      NSInteger row;
+      for(row = 0; row < entryCount; row++)
+         [columnStrings addObject:[self stringForKey:key atRow:row]];
+      prefixIndex = [[CSPrefixIndex alloc] initWithStrings:columnStrings];
+      if(prefixIndex != nil)
+      {
+         [prefixIndexes setObject:prefixIndex forKey:key];
+         [prefixIndex release];
+      }
+   }
+
+   return prefixIndex;
+}
+
+
+/*
+ * Return the search arena for the given key (nil for whole entries, joined as
+ * entryAtRow:matchesString:ignoreCase:forKey: does), building it if needed
+ */
+- (CSTextArena *) textArenaForKey:(NSString *)key
+{
+   id arenaKey = key;
+   if(arenaKey == nil)
+      arenaKey = [NSNull null];
+   CSTextArena *textArena = [textArenas objectForKey:arenaKey];
+   if(textArena == nil)
+   {
+      NSInteger entryCount = [self entryCount];
+      NSMutableArray *rowStrings = [NSMutableArray arrayWithCapacity:entryCount];
+      NSInteger row;
+      for(row = 0; row < entryCount; row++)
+      {
+         if(key == nil)
+            [rowStrings addObject:[[self stringArrayForEntryAtRow:row] componentsJoinedByString:@" "]];
+         else
+            [rowStrings addObject:[self stringForKey:key atRow:row]];
+      }
+      textArena = [[CSTextArena alloc] initWithStrings:rowStrings];
+      if(textArena != nil)
+      {
+         [textArenas setObject:textArena forKey:arenaKey];
+         [textArena release];
+      }
+   }
+
+   return textArena;
+}
+
+
+/*
+ * Return a new, unique entry ID
+ */
++ (NSString *) generatedEntryID
+{
+   CFUUIDRef uuid = CFUUIDCreate(kCFAllocatorDefault);
+   NSString *entryID = (NSString *) CFUUIDCreateString(kCFAllocatorDefault, uuid);
+   CFRelease(uuid);
+
+   return [entryID autorelease];
+}
+
+
+/*
+ * Return the entry ID an entry from before IDs gets, the same for the same
+ * name every time; a name-based UUID (version 5, SHA-1, as in RFC 4122), in
+ * the same form as generated ones
+ */
++ (NSString *) legacyEntryIDForName:(NSString *)name
+{
+   NSMutableData *nameData = [NSMutableData dataWithData:[@"CiphSafe legacy entry:"
+                                                         dataUsingEncoding:NSUTF8StringEncoding]];
+   [nameData appendData:[name dataUsingEncoding:NSUTF8StringEncoding]];
+   unsigned char *hashBytes = [[nameData SHA1Hash] mutableBytes];
+   hashBytes[6] = (hashBytes[6] & 0x0F) | 0x50;
+   hashBytes[8] = (hashBytes[8] & 0x3F) | 0x80;
+   CFUUIDBytes uuidBytes;
+   memcpy(&uuidBytes, hashBytes, sizeof(uuidBytes));
+   CFUUIDRef uuid = CFUUIDCreateFromUUIDBytes(kCFAllocatorDefault, uuidBytes);
+   NSString *entryID = (NSString *) CFUUIDCreateString(kCFAllocatorDefault, uuid);
+   CFRelease(uuid);
+
+   return [entryID autorelease];
+}
+
+
+/*
+ * File the entry in the audit index, digest, and category counts
+ */
+- (void) indexEntry:(NSDictionary *)entry
+{
+   [auditIndex addEntry:entry];
+   [digest addEntry:entry];
+   NSString *category = [entry objectForKey:CSDocModelKey_Category];
+   if([category length] > 0)
+      [categoryCounts addObject:category];
+}
+
+
+/*
+ * Take the entry out of the audit index, digest, and category counts, before
+ * it changes or goes
+ */
+- (void) unindexEntry:(NSDictionary *)entry
+{
+   [auditIndex removeEntry:entry];
+   [digest removeEntry:entry];
+   NSString *category = [entry objectForKey:CSDocModelKey_Category];
+   if([category length] > 0)
+      [categoryCounts removeObject:category];
+}
+
+
+/*
+ * Rows are about to change or just moved, so the indexes and arenas built
+ * from them are no good
+ */
+- (void) discardSearchCaches
+{
+   [prefixIndexes removeAllObjects];
+   [textArenas removeAllObjects];
 }
 
 
 /*
  * Return an array (of elements supporting intValue message) of all
- * matching entries
+ * matching entries; without an arena, plain columns are searched across the
+ * processors, the calling thread waiting (so nothing changes meanwhile)
  */
 - (NSArray *) rowsMatchingString:(NSString *)findString
                       ignoreCase:(BOOL)ignoreCase
                           forKey:(NSString *)key
 {
    NSMutableArray *retval = [NSMutableArray arrayWithCapacity:10];
-   NSStringCompareOptions compareOptions = 0;
-   if(ignoreCase)
-      compareOptions = NSCaseInsensitiveSearch;
-   NSInteger index;
-   for(index = 0; index < [self entryCount]; index++)
+   // Case-insensitive searches of sorted rows go through the arena
+   NSIndexSet *matchingRows = nil;
+   if(ignoreCase && rowOrderBeforeChange == nil)
+      matchingRows = [[self textArenaForKey:key] rowsContainingString:findString];
+   if(matchingRows != nil)
    {
-      NSString *stringToSearch;
-      if(key == nil)
-         stringToSearch = [[self stringArrayForEntryAtRow:index] componentsJoinedByString:@" "];
-      else
-         stringToSearch = [self stringForKey:key atRow:index];
-      NSRange searchResult = [stringToSearch rangeOfString:findString options:compareOptions];
-      if(searchResult.location != NSNotFound)
+      NSUInteger index;
+      for(index = [matchingRows firstIndex];
+          index != NSNotFound;
+          index = [matchingRows indexGreaterThanIndex:index])
          [retval addObject:[NSNumber numberWithInteger:index]];
    }
+   else
+   {
+      NSInteger entryCount = [self entryCount];
+      NSMutableData *rowMatches = [NSMutableData dataWithLength:entryCount];
+      CSDocModelSearch search = { self, findString, ignoreCase, key, [rowMatches mutableBytes] };
+      // Notes (and so whole entries) go through the text system, which stays on this thread
+      if(key != nil && ![key isEqualToString:CSDocModelKey_Notes])
+         [[CSTaskPool sharedPool] applyFunction:CSDocModelSearchRows
+                                        toRange:NSMakeRange(0, entryCount)
+                                      grainSize:CSDocModelSearchGrainRows
+                                        context:&search];
+      else
+         CSDocModelSearchRows(0, entryCount, 0, &search);
+      const unsigned char *matchBytes = [rowMatches bytes];
+      NSInteger index;
+      for(index = 0; index < entryCount; index++)
+      {
+         if(matchBytes[index])
+            [retval addObject:[NSNumber numberWithInteger:index]];
+      }
+   }
    
    return retval;
 }
 
 
+/*
+ * Return whether the entry on the given row contains the string in the given key (or
+ * anywhere in the entry for a nil key)
+ */
+- (BOOL) entryAtRow:(NSInteger)row
+      matchesString:(NSString *)findString
+         ignoreCase:(BOOL)ignoreCase
+             forKey:(NSString *)key
+{
+   NSStringCompareOptions compareOptions = 0;
+   NSString *stringToSearch;
+   if(key == nil)
+      stringToSearch = [[self stringArrayForEntryAtRow:row] componentsJoinedByString:@" "];
+   else
+      stringToSearch = [self stringForKey:key atRow:row];
+   // Ignoring case, compare the way CSTextArena does so both agree on what matches
+   if(ignoreCase)
+   {
+      stringToSearch = [CSTextArena foldedString:stringToSearch];
+      findString = [CSTextArena foldedString:findString];
+      compareOptions = NSLiteralSearch;
+   }
+
+   return ([stringToSearch rangeOfString:findString options:compareOptions].location != NSNotFound);
+}
+
+
+/*
+ * Categories come and go with the entries in them; counted as entries change,
+ * so there are no rows to go through here
+ */
+- (NSArray *) categories
+{
+   return [categoryCounts allObjects];
+}
+
+
+#pragma mark -
+#pragma mark Auditing
+/*
+ * Return groups of entries sharing the same (non-empty) password
+ */
+- (NSArray *) reusedPasswordGroups
+{
+   return [auditIndex reusedPasswordGroups];
+}
+
+
+/*
+ * Return groups of entries with the same account and URL, ignoring case
+ */
+- (NSArray *) duplicateEntryGroups
+{
+   return [auditIndex duplicateRecordGroups];
+}
+
+
+/*
+ * Return the names of all entries with the same password as the named one
+ * (itself included), empty if it has no password or doesn't exist
+ */
+- (NSArray *) namesSharingPasswordWithName:(NSString *)name
+{
+   NSDictionary *theEntry = [self findEntryWithName:name];
+   if(theEntry == nil)
+      return [NSArray array];
+
+   return [auditIndex namesSharingPasswordWithEntry:theEntry];
+}
+
+
+#pragma mark -
+#pragma mark Identity
+/*
+ * Return the ID of the named entry, nil if there's no such entry
+ */
+- (NSString *) entryIDForName:(NSString *)name
+{
+   return [[self findEntryWithName:name] objectForKey:CSDocModelKey_EntryID];
+}
+
+
+/*
+ * Return a copy of the entry with the given ID, nil if there's no such entry
+ */
+- (NSDictionary *) entryForEntryID:(NSString *)entryID
+{
+   NSString *name = [digest nameForEntryID:entryID];
+   if(name == nil)
+      return nil;
+
+   return [NSDictionary dictionaryWithDictionary:[self findEntryWithName:name]];
+}
+
+
+/*
+ * Return the content hashes of all entries
+ */
+- (CSDocDigest *) digest
+{
+   return digest;
+}
+
+
+/*
+ * Return a hash covering every entry's ID and content
+ */
+- (NSData *) summaryHash
+{
+   return [digest summaryHash];
+}
+
+
 #pragma mark -
 #pragma mark Configuration
 /*
@@ -394,8 +1011,20 @@ static NSArray *keyArray;
 {
    if(undoManager != newManager)
    {
+      NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
+      if(undoManager != nil)
+         [defaultCenter removeObserver:self
+                                  name:NSUndoManagerDidCloseUndoGroupNotification
+                                object:undoManager];
+      // Records from the old manager will never be asked for again
+      [undoJournal removeAllRecords];
       [undoManager autorelease];
       undoManager = [newManager retain];
+      if(undoManager != nil)
+         [defaultCenter addObserver:self
+                           selector:@selector(undoManagerDidCloseUndoGroup:)
+                               name:NSUndoManagerDidCloseUndoGroupNotification
+                             object:undoManager];
    }
 }
 
@@ -409,6 +1038,34 @@ static NSArray *keyArray;
 }
 
 
+/*
+ * Set the most memory to be held for undo; the oldest undo levels are dropped
+ * (and cleared) when the limit is passed
+ */
+- (void) setUndoMemoryLimit:(NSUInteger)newLimit
+{
+   [undoJournal setByteLimit:newLimit];
+}
+
+
+/*
+ * Return the undo memory limit
+ */
+- (NSUInteger) undoMemoryLimit
+{
+   return [undoJournal byteLimit];
+}
+
+
+/*
+ * Once an undo group is closed, later changes must not be coalesced into it
+ */
+- (void) undoManagerDidCloseUndoGroup:(NSNotification *)notification
+{
+   [undoJournal sealRecords];
+}
+
+
 /*
  * Set by which key to sort (one of the CSDocDictKey_* strings)
  */
@@ -468,7 +1125,7 @@ static NSArray *keyArray;
  * Add a new entry with the given data; returns YES if all went okay, NO if
  * an entry with that name already exists.
  *
- * XXX Note that the name of the added entry will live on in the undo manager
+ * XXX Note that the name of the added entry will live on in the undo journal
  * and is also given to the notification center
  */
 - (BOOL) addEntryWithName:(NSString *)name
@@ -487,11 +1144,8 @@ static NSArray *keyArray;
    if(result)
    {
       if(undoManager != nil)
-      {
-         [undoManager registerUndoWithTarget:self selector:@selector(deleteEntryWithName:) object:name];
-         if(![undoManager isUndoing] && ![undoManager isRedoing])
-            [undoManager setActionName:NSLocalizedString(@"Add", @"")];
-      }
+         [self registerUndoForJournalRecordID:[undoJournal recordAddOfNames:[NSArray arrayWithObject:name]]
+                                   actionName:NSLocalizedString(@"Add", @"")];
 
       NSDictionary *userInfo = [NSDictionary dictionaryWithObject:[NSArray arrayWithObject:name]
                                                            forKey:CSDocModelNotificationInfoKey_AddedNames];
@@ -516,19 +1170,50 @@ static NSArray *keyArray;
                           URL:(NSString *)url
                      category:(NSString *)category
                     notesRTFD:(NSData *)notes
+{
+   return [self addBulkEntryWithName:name
+                             account:account
+                            password:password
+                                 URL:url
+                            category:category
+                           notesRTFD:notes
+                             entryID:nil];
+}
+
+
+/*
+ * As above, giving the new entry the given ID (as when merging in an entry from another copy of the
+ * document); with a nil ID, or one already in use, the entry gets a new one
+ */
+- (BOOL) addBulkEntryWithName:(NSString *)name
+                      account:(NSString *)account
+                     password:(NSString *)password
+                          URL:(NSString *)url
+                     category:(NSString *)category
+                    notesRTFD:(NSData *)notes
+                      entryID:(NSString *)entryID
 {
    // If it already exists, we're outta here
    if([self rowForName:name] != -1)
       return NO;
    
-   [allEntries addObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:
-                                                 name, CSDocModelKey_Name,
-                                                 account, CSDocModelKey_Acct,
-                                                 password, CSDocModelKey_Passwd,
-                                                 url, CSDocModelKey_URL,
-                                                 category, CSDocModelKey_Category,
-                                                 notes, CSDocModelKey_Notes,
-                                                 nil]];
+   [self noteRowChangesPending];
+   NSMutableDictionary *newEntry = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                                          name, CSDocModelKey_Name,
+                                                          account, CSDocModelKey_Acct,
+                                                          password, CSDocModelKey_Passwd,
+                                                          url, CSDocModelKey_URL,
+                                                          category, CSDocModelKey_Category,
+                                                          notes, CSDocModelKey_Notes,
+                                                          nil];
+   if(entryID == nil || [digest contentHashForEntryID:entryID] != nil)
+      entryID = [CSDocModel generatedEntryID];
+   [newEntry setObject:entryID forKey:CSDocModelKey_EntryID];
+   [allEntries addObject:newEntry];
+   // No snapshot out now has it, so it can be changed in place (see writableEntryAtRow:)
+   if(snapshotCount > 0)
+      [privateEntries addObject:newEntry];
+   [self indexEntry:newEntry];
 
    return YES;
 }
@@ -541,13 +1226,8 @@ static NSArray *keyArray;
 - (void) registerAddForNamesInArray:(NSArray *)nameArray
 {
    if(undoManager != nil)
-   {
-      [undoManager registerUndoWithTarget:self
-                                 selector:@selector(deleteEntriesWithNamesInArray:)
-                                   object:nameArray];
-      if(![undoManager isUndoing] && ![undoManager isRedoing])
-         [undoManager setActionName:NSLocalizedString(@"Add", @"")];
-   }
+      [self registerUndoForJournalRecordID:[undoJournal recordAddOfNames:nameArray]
+                                actionName:NSLocalizedString(@"Add", @"")];
 
    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:nameArray
                                                         forKey:CSDocModelNotificationInfoKey_AddedNames];
@@ -564,7 +1244,7 @@ static NSArray *keyArray;
  * if an entry with newName already exists or an entry with the given name
  * doesn't exist
  *
- * XXX Note that the changed entry will live on in the undo manager
+ * XXX Note that the changed fields' old values will live on in the undo journal
  * and both the old and new names are given to the notification center
  */
 - (BOOL) changeEntryWithName:(NSString *)name
@@ -575,43 +1255,46 @@ static NSArray *keyArray;
                     category:(NSString *)category
                    notesRTFD:(NSData *)notes
 {
-   NSMutableDictionary *theEntry = [self findEntryWithName:name];
+   NSInteger row = [self rowForName:name];
    /*
-    * If theEntry is nil, we can't change it...
+    * If there's no entry by that name, we can't change it...
     * Also, if newName is not the same as name, and newName is already present,
     * we can't change
     */
-   if(theEntry == nil || (![name isEqualToString:newName] && [self rowForName:newName] != -1))
+   if(row == -1 || (![name isEqualToString:newName] && [self rowForName:newName] != -1))
       return NO;
 
-   [entryASCache removeObjectForKey:name];
    NSString *realNewName = (newName != nil ? newName : name);
-   if(undoManager != nil)
-   {
-      [[undoManager prepareWithInvocationTarget:self]
-        changeEntryWithName:realNewName
-                    newName:name
-                    account:[self nonNilStringFrom:theEntry forKey:CSDocModelKey_Acct]
-                   password:[self nonNilStringFrom:theEntry forKey:CSDocModelKey_Passwd]
-                        URL:[self nonNilStringFrom:theEntry forKey:CSDocModelKey_URL]
-                   category:[self nonNilStringFrom:theEntry forKey:CSDocModelKey_Category]
-                  notesRTFD:[self nonNilDataFrom:theEntry forKey:CSDocModelKey_Notes]];
-      if(![undoManager isUndoing] && ![undoManager isRedoing])
-         [undoManager setActionName:NSLocalizedString(@"Change", @"")];
-   }
-
+   // dictionaryWithObjectsAndKeys: stops at the first nil, so build it up piece by piece
+   NSMutableDictionary *newValues = [NSMutableDictionary dictionaryWithCapacity:6];
    if(newName != nil)
-      [theEntry setObject:newName forKey:CSDocModelKey_Name];
+      [newValues setObject:newName forKey:CSDocModelKey_Name];
    if(account != nil)
-      [theEntry setObject:account forKey:CSDocModelKey_Acct];
+      [newValues setObject:account forKey:CSDocModelKey_Acct];
    if(password != nil)
-      [theEntry setObject:password forKey:CSDocModelKey_Passwd];
+      [newValues setObject:password forKey:CSDocModelKey_Passwd];
    if(url != nil)
-      [theEntry setObject:url forKey:CSDocModelKey_URL];
+      [newValues setObject:url forKey:CSDocModelKey_URL];
    if(category != nil)
-      [theEntry setObject:category forKey:CSDocModelKey_Category];
+      [newValues setObject:category forKey:CSDocModelKey_Category];
    if(notes != nil)
-      [theEntry setObject:notes forKey:CSDocModelKey_Notes];
+      [newValues setObject:notes forKey:CSDocModelKey_Notes];
+   if(undoManager != nil)
+   {
+      BOOL canCoalesce = (![undoManager isUndoing] && ![undoManager isRedoing]);
+      [self registerUndoForJournalRecordID:[undoJournal recordChangeOfEntry:[allEntries objectAtIndex:row]
+                                                                  withValues:newValues
+                                                                 canCoalesce:canCoalesce]
+                                actionName:NSLocalizedString(@"Change", @"")];
+   }
+
+   [entryASCache removeObjectForKey:name];
+   [self noteRowChangesPending];
+   NSMutableDictionary *theEntry = [self writableEntryAtRow:row];
+   [self noteEntryUpdated:theEntry];
+   [self unindexEntry:theEntry];
+   [theEntry addEntriesFromDictionary:newValues];
+   [self indexEntry:theEntry];
 
    NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:
                                              name, CSDocModelNotificationInfoKey_ChangedNameFrom,
@@ -630,7 +1313,7 @@ static NSArray *keyArray;
  * Delete all entries given by the names in the array; returns number of entries
  * actually deleted (it, obviously, can't delete entries which aren't present).
  *
- * XXX Note that the deleted entries will live on in the undo manager
+ * XXX Note that the deleted entries will live on in the undo journal
  * and the names are also given to the notification center
  */
 - (NSInteger) deleteEntriesWithNamesInArray:(NSArray *)nameArray
@@ -651,32 +1334,25 @@ static NSArray *keyArray;
          [entriesToDelete addObject:theEntry];
    }
 
+   if([entriesToDelete count] > 0)
+      [self noteRowChangesPending];
    NSEnumerator *entryEnumerator = [entriesToDelete objectEnumerator];
    id entryToDelete;
    while((entryToDelete = [entryEnumerator nextObject]) != nil)
    {
       numDeleted++;
       [entryASCache removeObjectForKey:[entryToDelete objectForKey:CSDocModelKey_Name]];
-      // removeObject: is going to release it, so we hold it for a bit here
-      [entryToDelete retain];
-      [allEntries removeObject:entryToDelete];
-      if(undoManager != nil)
-      {
-         id undoInvocation = [undoManager prepareWithInvocationTarget:self];
-         [undoInvocation addEntryWithName:[entryToDelete objectForKey:CSDocModelKey_Name]
-                                  account:[entryToDelete objectForKey:CSDocModelKey_Acct]
-                                 password:[entryToDelete objectForKey:CSDocModelKey_Passwd]
-                                      URL:[entryToDelete objectForKey:CSDocModelKey_URL]
-                                 category:[entryToDelete objectForKey:CSDocModelKey_Category]
-                                notesRTFD:[entryToDelete objectForKey:CSDocModelKey_Notes]];
-         if(![undoManager isUndoing] && ![undoManager isRedoing])
-            [undoManager setActionName:NSLocalizedString(@"Delete", @"")];
-      }
-      [entryToDelete release];
+      [self unindexEntry:entryToDelete];
+      // entriesToDelete keeps hold of it for the journal below
+      [allEntries removeObjectIdenticalTo:entryToDelete];
    }
 
    if(numDeleted > 0)
    {
+      if(undoManager != nil)
+         [self registerUndoForJournalRecordID:[undoJournal recordDeleteOfEntries:entriesToDelete]
+                                   actionName:NSLocalizedString(@"Delete", @"")];
+
       NSDictionary *userInfo = [NSDictionary dictionaryWithObject:nameArray
                                                            forKey:CSDocModelNotificationInfoKey_DeletedNames];
       [[NSNotificationCenter defaultCenter] postNotificationName:CSDocModelDidRemoveEntryNotification
@@ -699,46 +1375,202 @@ static NSArray *keyArray;
 }
 
 
+#pragma mark -
+#pragma mark Undo Support
+/*
+ * Hand a journal record to the undo manager; a nil recordID means nothing new
+ * needs registering (see CSUndoJournal)
+ */
+- (void) registerUndoForJournalRecordID:(NSNumber *)recordID actionName:(NSString *)actionName
+{
+   if(recordID == nil)
+      return;
+
+   [undoManager registerUndoWithTarget:self
+                              selector:@selector(applyUndoJournalRecordWithID:)
+                                object:recordID];
+   if(![undoManager isUndoing] && ![undoManager isRedoing])
+      [undoManager setActionName:actionName];
+}
+
+
+/*
+ * Undo (or redo) the mutation recorded in the journal with the given ID; applying
+ * it records the opposite mutation, which becomes the redo (or undo).  If the
+ * record was dropped to stay under the memory limit, there is nothing left to do
+ * but say so, since the undo manager (and whoever counts changes by it) thinks
+ * something was undone.
+ */
+- (void) applyUndoJournalRecordWithID:(NSNumber *)recordID
+{
+   CSUndoJournalRecord *record = [undoJournal takeRecordWithID:recordID];
+   if(record == nil)
+   {
+      [[NSNotificationCenter defaultCenter] postNotificationName:CSDocModelDidLoseUndoNotification
+                                                          object:self];
+      return;
+   }
+
+   NSInteger recordType = [record recordType];
+   if(recordType == CSUndoJournalRecordType_Add)
+      [self deleteEntriesWithNamesInArray:[record payload]];
+   else if(recordType == CSUndoJournalRecordType_Change)
+   {
+      NSDictionary *oldValues = [record payload];
+      [self changeEntryWithName:[record entryName]
+                        newName:[oldValues objectForKey:CSDocModelKey_Name]
+                        account:[oldValues objectForKey:CSDocModelKey_Acct]
+                       password:[oldValues objectForKey:CSDocModelKey_Passwd]
+                            URL:[oldValues objectForKey:CSDocModelKey_URL]
+                       category:[oldValues objectForKey:CSDocModelKey_Category]
+                      notesRTFD:[oldValues objectForKey:CSDocModelKey_Notes]];
+   }
+   else if(recordType == CSUndoJournalRecordType_Delete)
+   {
+      NSArray *deletedEntries = [record payload];
+      NSMutableArray *nameArray = [NSMutableArray arrayWithCapacity:[deletedEntries count]];
+      NSEnumerator *entryEnumerator = [deletedEntries objectEnumerator];
+      id oneEntry;
+      while((oneEntry = [entryEnumerator nextObject]) != nil)
+      {
+         NSString *entryName = [oneEntry objectForKey:CSDocModelKey_Name];
+         if([self addBulkEntryWithName:entryName
+                               account:[oneEntry objectForKey:CSDocModelKey_Acct]
+                              password:[oneEntry objectForKey:CSDocModelKey_Passwd]
+                                   URL:[oneEntry objectForKey:CSDocModelKey_URL]
+                              category:[oneEntry objectForKey:CSDocModelKey_Category]
+                             notesRTFD:[oneEntry objectForKey:CSDocModelKey_Notes]
+                               entryID:[oneEntry objectForKey:CSDocModelKey_EntryID]])
+            [nameArray addObject:entryName];
+      }
+      if([nameArray count] > 0)
+         [self registerAddForNamesInArray:nameArray];
+   }
+}
+
+
 #pragma mark -
 #pragma mark Miscellaneous
 /*
- * Force the model to perform a sort of the entries
+ * Force the model to perform a sort of the entries, then post the change set covering
+ * everything since the last sort
  */
 - (void) sortEntries
 {
-   [allEntries sortUsingFunction:sortEntries context:self];
+   NSArray *oldOrder = rowOrderBeforeChange;
+   if(oldOrder == nil)
+      oldOrder = [allEntries copy];
+   rowOrderBeforeChange = nil;
+   NSData *permutation = [savedIndex sortPermutationForKey:sortKey];
+   if(permutation != nil)
+   {
+      // Entries are just as they were saved, so the saved order by this key holds
+      const uint32_t *positions = [permutation bytes];
+      NSUInteger count = [savedOrder count];
+      NSUInteger index;
+      for(index = 0; index < count; index++)
+         [allEntries replaceObjectAtIndex:index
+                               withObject:[savedOrder objectAtIndex:positions[sortAscending ? index
+                                                                                            : count - index - 1]]];
+   }
+   else
+      [allEntries sortUsingFunction:sortEntries context:self];
+   [self discardSearchCaches];
    [nameRowCache removeAllObjects];
    NSInteger row;
    NSInteger entryCount = [self entryCount];
    for(row = 0; row < entryCount; row++)
       [nameRowCache setObject:[NSNumber numberWithInteger:row]
                        forKey:[self stringForKey:CSDocModelKey_Name atRow:row]];
+   [self postRowChangesFromOrder:oldOrder];
+   [oldOrder release];
+   [entriesUpdatedBeforeSort removeAllObjects];
 }
 
 
 /*
- * Return a valid string (empty, @"", if necessary)
+ * Remember the row order from before a change, unless we already have it from an
+ * earlier change not yet followed by a sort
  */
-- (NSString *) nonNilStringFrom:(NSDictionary *)dict forKey:(NSString *)key
+- (void) noteRowChangesPending
 {
-   NSString *result = [dict objectForKey:key];
-   if(result == nil)
-      result = @"";
-   
-   return result;
+   if(rowOrderBeforeChange == nil)
+      rowOrderBeforeChange = [allEntries mutableCopy];
+   [self discardSearchCaches];
+   [savedIndex release];
+   savedIndex = nil;
+   [savedOrder release];
+   savedOrder = nil;
 }
 
 
 /*
- * Return valid data (empty if necessary)
+ * Note that the given entry is about to have its contents changed
  */
-- (NSData *) nonNilDataFrom:(NSDictionary *)dict forKey:(NSString *)key
+- (void) noteEntryUpdated:(NSMutableDictionary *)entry
 {
-   NSData *result = [dict objectForKey:key];
-   if(result == nil)
-      result = [NSData data];
-   
-   return result;
+   [entriesUpdatedBeforeSort addObject:entry];
+}
+
+
+/*
+ * Work out which rows were inserted, removed, updated, and moved between the given
+ * order and the current one, and post CSDocModelDidChangeRowsNotification with them
+ */
+- (void) postRowChangesFromOrder:(NSArray *)oldOrder
+{
+   NSInteger oldCount = [oldOrder count];
+   NSInteger newCount = [allEntries count];
+   // Map from entry (by identity) to its new row
+   CFMutableDictionaryRef newRowForEntry = CFDictionaryCreateMutable(NULL, newCount, NULL, NULL);
+   NSMutableIndexSet *insertedRows = [NSMutableIndexSet indexSet];
+   NSMutableIndexSet *updatedRows = [NSMutableIndexSet indexSet];
+   NSMutableIndexSet *movedRows = [NSMutableIndexSet indexSet];
+   NSMutableIndexSet *removedRows = [NSMutableIndexSet indexSet];
+   NSInteger row;
+   for(row = 0; row < newCount; row++)
+   {
+      id oneEntry = [allEntries objectAtIndex:row];
+      CFDictionarySetValue(newRowForEntry, oneEntry, (const void *) (row + 1));
+      if([entriesUpdatedBeforeSort containsObject:oneEntry])
+         [updatedRows addIndex:row];
+   }
+   NSMutableData *rowMap = [NSMutableData dataWithLength:oldCount * sizeof(NSInteger)];
+   NSInteger *newRowForOldRow = [rowMap mutableBytes];
+   for(row = 0; row < oldCount; row++)
+   {
+      // Values are stored off by one, so a missing entry (NULL) reads as -1
+      NSInteger newRow = (NSInteger) CFDictionaryGetValue(newRowForEntry, [oldOrder objectAtIndex:row]) - 1;
+      newRowForOldRow[row] = newRow;
+      if(newRow < 0)
+         [removedRows addIndex:row];
+      else
+      {
+         if(newRow != row)
+            [movedRows addIndex:newRow];
+         // Seen in the old order, so no longer a candidate for insertion
+         CFDictionaryRemoveValue(newRowForEntry, [oldOrder objectAtIndex:row]);
+      }
+   }
+   // Whatever is left in the map wasn't around before
+   for(row = 0; row < newCount; row++)
+   {
+      if(CFDictionaryContainsKey(newRowForEntry, [allEntries objectAtIndex:row]))
+         [insertedRows addIndex:row];
+   }
+   CFRelease(newRowForEntry);
+   [updatedRows removeIndexes:insertedRows];
+
+   NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:
+                                             insertedRows, CSDocModelNotificationInfoKey_InsertedRows,
+                                             removedRows, CSDocModelNotificationInfoKey_RemovedRows,
+                                             updatedRows, CSDocModelNotificationInfoKey_UpdatedRows,
+                                             movedRows, CSDocModelNotificationInfoKey_MovedRows,
+                                             rowMap, CSDocModelNotificationInfoKey_RowMap,
+                                             nil];
+   [[NSNotificationCenter defaultCenter] postNotificationName:CSDocModelDidChangeRowsNotification
+                                                       object:self
+                                                     userInfo:userInfo];
 }
 
 
@@ -754,10 +1586,21 @@ static NSArray *keyArray;
     * CFString being more difficult to look into than, say, NSData, we can't
     * clear it out.
     */
+   [self setUndoManager:nil];
+   [undoJournal release];
+   [rowOrderBeforeChange release];
+   [entriesUpdatedBeforeSort release];
+   [privateEntries release];
+   [prefixIndexes release];
+   [textArenas release];
+   [auditIndex release];
+   [digest release];
+   [savedIndex release];
+   [savedOrder release];
+   [categoryCounts release];
    [allEntries release];
    [entryASCache release];
    [nameRowCache release];
-   [undoManager release];
    [super dealloc];
 }
 
@@ -804,3 +1647,21 @@ NSInteger sortEntries(id dict1, id dict2, void *context)
 }
 
 @end
+
+
+/*
+ * Check the rows [firstRow, endRow) for the search string
+ */
+static void CSDocModelSearchRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *searchInfo)
+{
+   CSDocModelSearch *search = searchInfo;
+   NSUInteger row;
+   for(row = firstRow; row < endRow; row++)
+   {
+      if([search->model entryAtRow:row
+                     matchesString:search->findString
+                        ignoreCase:search->ignoreCase
+                            forKey:search->key])
+         search->rowMatches[row] = 1;
+   }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocSaver.h */
+
+#import <Foundation/Foundation.h>
+
+@class CSBackupStore;
+
+/*
+ * Saves a snapshot of a document's entries (see -[CSDocModel beginSnapshot]) on
+ * a worker thread: archive, compress, encrypt, then write to a temporary file
+ * beside the document and rename it into place, then back it up if asked (the
+ * file being replaced first, if the backups don't already hold it).
+ * The delegate, retained until then, hears about the result on the main thread.
+ */
+@interface CSDocSaver : NSObject
+{
+   NSArray *entries;
+   NSData *bfKey;
+   NSString *codec;
+   int level;
+   BOOL longDistanceMatching;
+   NSString *path;
+   NSDictionary *fileAttributes;
+   NSUInteger generation;
+   id delegate;
+   NSConditionLock *finishedLock;
+   BOOL succeeded;
+   NSDate *fileModificationDate;
+   CSBackupStore *backupStore;
+   NSUInteger backupGenerations;
+   BOOL backupSucceeded;
+}
+
+- (id) initWithEntries:(NSArray *)snapshot
+                   key:(NSData *)key
+      compressionCodec:(NSString *)codecName
+                 level:(int)codecLevel
+  longDistanceMatching:(BOOL)useLongMode
+                  path:(NSString *)filePath
+        fileAttributes:(NSDictionary *)attributes
+            generation:(NSUInteger)saveGeneration
+              delegate:(id)newDelegate;
+
+// Once saved, add the snapshot to the store as a generation (see CSBackupStore); set before starting
+- (void) setBackupStore:(CSBackupStore *)store keepingGenerations:(NSUInteger)keepCount;
+
+- (void) start;
+
+// Block until the save is done, then report it to the delegate right away
+- (void) waitUntilFinished;
+
+- (BOOL) succeeded;
+// Whether backing up went through (YES if there was no backing up to do)
+- (BOOL) backupSucceeded;
+- (NSUInteger) generation;
+- (NSDate *) fileModificationDate;
+
+@end
+
+
+@interface NSObject (CSDocSaverDelegate)
+- (void) docSaverDidFinish:(CSDocSaver *)saver;
+@end
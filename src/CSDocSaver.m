@@ -0,0 +1,291 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSDocSaver.m */
+
+#import "CSDocSaver.h"
+#import "CSBackupStore.h"
+#import "CSDocModel.h"
+#include <copyfile.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Conditions for finishedLock
+enum
+{
+   CSDocSaverCondition_Running = 0,
+   CSDocSaverCondition_Finished = 1
+};
+
+
+@interface CSDocSaver (InternalMethods)
+- (void) saveOnThread:(id)unused;
+- (BOOL) writeData:(NSData *)fileData;
+- (void) finishOnMainThread;
+@end
+
+
+@implementation CSDocSaver
+
+- (id) initWithEntries:(NSArray *)snapshot
+                   key:(NSData *)key
+      compressionCodec:(NSString *)codecName
+                 level:(int)codecLevel
+  longDistanceMatching:(BOOL)useLongMode
+                  path:(NSString *)filePath
+        fileAttributes:(NSDictionary *)attributes
+            generation:(NSUInteger)saveGeneration
+              delegate:(id)newDelegate
+{
+   self = [super init];
+   if(self != nil)
+   {
+      entries = [snapshot retain];
+      bfKey = [key copy];
+      codec = [codecName copy];
+      level = codecLevel;
+      longDistanceMatching = useLongMode;
+      path = [filePath copy];
+      fileAttributes = [attributes retain];
+      generation = saveGeneration;
+      delegate = [newDelegate retain];
+      finishedLock = [[NSConditionLock alloc] initWithCondition:CSDocSaverCondition_Running];
+      succeeded = NO;
+      fileModificationDate = nil;
+      backupStore = nil;
+      backupGenerations = 0;
+      backupSucceeded = YES;
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Control
+- (void) setBackupStore:(CSBackupStore *)store keepingGenerations:(NSUInteger)keepCount
+{
+   [store retain];
+   [backupStore release];
+   backupStore = store;
+   backupGenerations = keepCount;
+}
+
+
+/*
+ * Start saving on a new thread (which keeps us retained until it's done)
+ */
+- (void) start
+{
+   [NSThread detachNewThreadSelector:@selector(saveOnThread:) toTarget:self withObject:nil];
+}
+
+
+/*
+ * Main thread only
+ */
+- (void) waitUntilFinished
+{
+   [finishedLock lockWhenCondition:CSDocSaverCondition_Finished];
+   [finishedLock unlock];
+   [self finishOnMainThread];
+}
+
+
+- (BOOL) succeeded
+{
+   return succeeded;
+}
+
+
+- (BOOL) backupSucceeded
+{
+   return backupSucceeded;
+}
+
+
+- (NSUInteger) generation
+{
+   return generation;
+}
+
+
+- (NSDate *) fileModificationDate
+{
+   return fileModificationDate;
+}
+
+
+#pragma mark -
+#pragma mark Worker Thread
+- (void) saveOnThread:(id)unused
+{
+   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+   NSData *fileData = [CSDocModel encryptedDataForEntries:entries
+                                                  withKey:bfKey
+                                         compressionCodec:codec
+                                                    level:level
+                                     longDistanceMatching:longDistanceMatching];
+   // A failed backup doesn't fail the save, but the delegate hears of it
+   if(fileData != nil && backupStore != nil)
+      backupSucceeded = [backupStore addGenerationWithDocumentAtPath:path
+                                                                 key:bfKey
+                                                  keepingGenerations:backupGenerations];
+   if(fileData != nil)
+      succeeded = [self writeData:fileData];
+   if(succeeded && backupStore != nil)
+      backupSucceeded = ([backupStore addGenerationWithEntries:entries
+                                                  documentData:fileData
+                                                           key:bfKey
+                                              compressionCodec:codec
+                                                         level:level
+                                            keepingGenerations:backupGenerations]
+                         && backupSucceeded);
+#if defined(DEBUG)
+   if(!backupSucceeded)
+      NSLog(@"CSDocSaver saveOnThread: failed to back up %@", path);
+   if(!succeeded)
+      NSLog(@"CSDocSaver saveOnThread: failed to save %@", path);
+#endif
+   [finishedLock lock];
+   [finishedLock unlockWithCondition:CSDocSaverCondition_Finished];
+   [self performSelectorOnMainThread:@selector(finishOnMainThread) withObject:nil waitUntilDone:NO];
+   [pool release];
+}
+
+
+/*
+ * Write to a temporary file beside the document (mkstemp creates it mode
+ * 0600), then rename it over the document, so the document on disk is always
+ * either the old version or the new one.  A symlinked document is written
+ * where the link points, keeping the link, and the old file's ACL and
+ * extended attributes are carried over to the new one, as a safe save by
+ * NSDocument would.
+ */
+- (BOOL) writeData:(NSData *)fileData
+{
+   NSString *targetPath = [path stringByResolvingSymlinksInPath];
+   NSString *tempTemplate = [[targetPath stringByDeletingLastPathComponent]
+                             stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.XXXXXX",
+                                                                      [targetPath lastPathComponent]]];
+   char *tempPath = strdup([tempTemplate fileSystemRepresentation]);
+   int tempFD = mkstemp(tempPath);
+   if(tempFD == -1)
+   {
+      free(tempPath);
+      return NO;
+   }
+
+   BOOL writeOK = YES;
+   const char *bytes = [fileData bytes];
+   size_t remaining = [fileData length];
+   while(writeOK && remaining > 0)
+   {
+      ssize_t written = write(tempFD, bytes, remaining);
+      if(written < 0)
+      {
+         if(errno != EINTR)
+            writeOK = NO;
+      }
+      else
+      {
+         bytes += written;
+         remaining -= written;
+      }
+   }
+   if(writeOK && fsync(tempFD) != 0)
+      writeOK = NO;
+   if(close(tempFD) != 0)
+      writeOK = NO;
+
+   // A new document has nothing to carry over
+   if(writeOK
+      && copyfile([targetPath fileSystemRepresentation], tempPath, NULL, COPYFILE_ACL | COPYFILE_XATTR) != 0
+      && errno != ENOENT)
+      writeOK = NO;
+   NSFileManager *fileManager = [[NSFileManager alloc] init];   // defaultManager is main thread only
+   if(writeOK && fileAttributes != nil)
+      [fileManager setAttributes:fileAttributes
+                    ofItemAtPath:[fileManager stringWithFileSystemRepresentation:tempPath
+                                                                          length:strlen(tempPath)]
+                           error:NULL];
+   if(writeOK && rename(tempPath, [targetPath fileSystemRepresentation]) != 0)
+      writeOK = NO;
+   if(writeOK)
+      fileModificationDate = [[[fileManager attributesOfItemAtPath:targetPath error:NULL]
+                               fileModificationDate] retain];
+   else
+      unlink(tempPath);
+   [fileManager release];
+   free(tempPath);
+
+   return writeOK;
+}
+
+
+#pragma mark -
+#pragma mark Main Thread
+/*
+ * Tell the delegate, only once, whichever of waitUntilFinished or the worker
+ * gets here first
+ */
+- (void) finishOnMainThread
+{
+   if(delegate != nil)
+   {
+      id finishedDelegate = delegate;
+      delegate = nil;
+      [finishedDelegate docSaverDidFinish:self];
+      [finishedDelegate release];
+   }
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [entries release];
+   [bfKey release];
+   [codec release];
+   [path release];
+   [fileAttributes release];
+   [delegate release];
+   [finishedLock release];
+   [fileModificationDate release];
+   [backupStore release];
+   [super dealloc];
+}
+
+@end
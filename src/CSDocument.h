@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -34,7 +34,10 @@
 
 #import <Cocoa/Cocoa.h>
 
+@class CSDocLoader;
+@class CSDocMerge;
 @class CSDocModel;
+@class CSDocSaver;
 @class CSWinCtrlMain;
 @class CSWinCtrlPassphrase;
 
@@ -46,16 +49,31 @@
    CSWinCtrlPassphrase *passphraseWindowController;
    NSInvocation *getKeyInvocation;
    BOOL exportIsSelectedItemsOnly;
+   CSDocLoader *docLoader;
+   // Background saving
+   CSDocSaver *docSaver;
+   CSDocModel *snapshotModel;
+   id saveDelegate;
+   SEL saveDidSaveSelector;
+   void *saveContextInfo;
+   NSUInteger changeGeneration;
+   BOOL forceSynchronousSave;
+   BOOL undoWasLost;
 }
 
 // Actions from the menu
 - (IBAction) changePassphrase:(id)sender;
 - (IBAction) exportDocument:(id)sender;
 - (IBAction) exportSelectedItems:(id)sender;
+- (IBAction) openBackup:(id)sender;
+- (IBAction) runCompressionBenchmark:(id)sender;
 
 // Return just the main window controller
 - (CSWinCtrlMain *) mainWindowController;
 
+// Whether the document is still being read in the background
+- (BOOL) isLoading;
+
 // Creating new windows
 - (void) openAddEntryWindow;
 - (void) viewEntries:(NSArray *)namesArray;
@@ -65,6 +83,18 @@
 - (BOOL) retrieveEntriesFromPasteboard:(NSPasteboard *)pboard
                               undoName:(NSString *)undoName;
 
+// Generational backups (see CSBackupStore); a restored generation opens as a new document
+- (NSArray *) backupGenerations;
+- (CSDocument *) openBackupGeneration:(NSUInteger)generation error:(NSError **)outError;
+
+/*
+ * Bring in changes from another copy of the document (see CSDocMerge);
+ * outError (may be NULL) gets an error if some changes couldn't be applied
+ */
+- (CSDocMerge *) mergeChangesFromDocument:(CSDocument *)remoteDocument
+                                 ancestor:(CSDocument *)ancestorDocument
+                                    error:(NSError **)outError;
+
 // Category information
 - (NSArray *) categories;
 
@@ -101,5 +131,12 @@
 - (NSArray *) rowsMatchingString:(NSString *)findMe
                       ignoreCase:(BOOL)ignoreCase
                           forKey:(NSString *)key;
+- (BOOL) entryAtRow:(NSInteger)row
+      matchesString:(NSString *)findMe
+         ignoreCase:(BOOL)ignoreCase
+             forKey:(NSString *)key;
+- (NSArray *) reusedPasswordGroups;
+- (NSArray *) duplicateEntryGroups;
+- (NSArray *) namesSharingPasswordWithName:(NSString *)name;
 
 @end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -34,15 +34,23 @@
 /* CSDocument.m */
 
 #import "CSDocument.h"
+#import "CSBackupStore.h"
+#import "CSDocContainer.h"
+#import "CSDocLoader.h"
+#import "CSDocMerge.h"
 #import "CSDocModel.h"
+#import "CSDocSaver.h"
+#import "CSEntrySerializer.h"
 #import "CSPrefsController.h"
 #import "CSAppController.h"
+#import "CSTaskPool.h"
 #import "CSWinCtrlAdd.h"
 #import "CSWinCtrlChange.h"
 #import "CSWinCtrlMain.h"
 #import "CSWinCtrlPassphrase.h"
 #import "NSArray_FOOC.h"
 #import "NSAttributedString_RWDA.h"
+#import "NSData_compress.h"
 
 
 NSString * const CSDocument_Name = @"CiphSafe Document";
@@ -51,8 +59,47 @@ NSString * const CSDocumentXML_RootNode = @"document";
 NSString * const CSDocumentXML_EntryNode = @"entry";
 
 
+// Rows formatted per piece when exporting CSV across the processors
+static const NSUInteger CSDocumentCSVGrainRows = 128;
+
+/*
+ * A CSV export: line i is for entries[i] (from a snapshot), whose notes (as
+ * plain text) are notes[i], and is put in lines[i], retained
+ */
+typedef struct
+{
+   NSArray *entries;
+   NSArray *keys;
+   NSArray *notes;
+   NSData **lines;
+} CSDocumentCSVExport;
+
+// Keys in the dictionary describing an export in progress
+static NSString * const CSDocumentExportKey_Model = @"model";
+static NSString * const CSDocumentExportKey_Entries = @"entries";
+static NSString * const CSDocumentExportKey_Notes = @"notes";
+static NSString * const CSDocumentExportKey_Path = @"path";
+static NSString * const CSDocumentExportKey_IsCSV = @"isCSV";
+static NSString * const CSDocumentExportKey_CSVHeader = @"CSVHeader";
+
+static void CSDocumentCSVLines(NSUInteger firstLine, NSUInteger endLine, NSUInteger worker, void *exportInfo);
+
+
 @interface CSDocument (InternalMethods)
 - (CSDocModel *) model;
+- (void) teardownModel;
+- (void) cancelLoading;
+- (BOOL) getKeyForContainer:(CSDocContainer *)container;
+- (void) startLoadingContainer:(CSDocContainer *)container recovering:(BOOL)recover;
+- (NSString *) preferredCompressionCodec;
+- (BOOL) canSaveInBackgroundToFile:(NSString *)fileName saveOperation:(NSSaveOperationType)saveOperation;
+- (void) saveInBackgroundToFile:(NSString *)fileName
+                       delegate:(id)delegate
+                didSaveSelector:(SEL)didSaveSelector
+                    contextInfo:(void *)contextInfo;
+- (void) finishBackgroundSave;
+- (void) reportBackupFailure;
+- (CSDocument *) openRestoredDocumentData:(NSData *)docData error:(NSError **)outError;
 - (void) setBFKey:(NSMutableData *)newKey;
 - (NSString *) uniqueNameForName:(NSString *)name;
 @end
@@ -72,12 +119,8 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
    [docModel setUndoManager:[self undoManager]];
    NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
    [defaultCenter addObserver:self
-                     selector:@selector(updateViewForNotification:)
-                         name:CSDocModelDidChangeSortNotification
-                       object:docModel];
-   [defaultCenter addObserver:self
-                     selector:@selector(updateViewForNotification:)
-                         name:CSDocModelDidAddEntryNotification
+                     selector:@selector(updateViewForRowChanges:)
+                         name:CSDocModelDidChangeRowsNotification
                        object:docModel];
    [defaultCenter addObserver:self
                      selector:@selector(updateViewForNotification:)
@@ -87,10 +130,29 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
                      selector:@selector(updateViewForNotification:)
                          name:CSDocModelDidRemoveEntryNotification
                        object:docModel];
+   [defaultCenter addObserver:self
+                     selector:@selector(modelDidLoseUndo:)
+                         name:CSDocModelDidLoseUndoNotification
+                       object:docModel];
    [mainWindowController refreshWindow];
 }
 
 
+/*
+ * Stop listening to, and let go of, the current model
+ */
+- (void) teardownModel
+{
+   if(docModel != nil)
+   {
+      [[NSNotificationCenter defaultCenter] removeObserver:self name:nil object:docModel];
+      [docModel setUndoManager:nil];
+      [docModel release];
+      docModel = nil;
+   }
+}
+
+
 - (id) init
 {
    self = [super init];
@@ -126,6 +188,7 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
          didSaveSelector:(SEL)didSaveSelector
              contextInfo:(void *)contextInfo
 {
+   [self finishBackgroundSave];
    [super saveToFile:fileName
        saveOperation:saveOperation
             delegate:delegate
@@ -168,11 +231,226 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
                                             sendToSelector:@selector(getKeyResult:)];
    }
    else
-      [super saveToFile:fileName
-          saveOperation:saveOperation
-               delegate:delegate
-        didSaveSelector:didSaveSelector
-            contextInfo:contextInfo];
+   {
+      // Only one save at a time, so an older one can't land on top of a newer one
+      [self finishBackgroundSave];
+      if([self canSaveInBackgroundToFile:fileName saveOperation:saveOperation])
+         [self saveInBackgroundToFile:fileName
+                             delegate:delegate
+                      didSaveSelector:didSaveSelector
+                          contextInfo:contextInfo];
+      else
+         [super saveToFile:fileName
+             saveOperation:saveOperation
+                  delegate:delegate
+           didSaveSelector:didSaveSelector
+               contextInfo:contextInfo];
+   }
+}
+
+
+/*
+ * Plain saves over the current file go in the background; save as/to, and
+ * saves which must be done before returning (closing on timeout) go through
+ * NSDocument as always
+ */
+- (BOOL) canSaveInBackgroundToFile:(NSString *)fileName saveOperation:(NSSaveOperationType)saveOperation
+{
+   return (saveOperation == NSSaveOperation && !forceSynchronousSave && docLoader == nil
+           && fileName != nil && [self fileURL] != nil
+           && [fileName isEqualToString:[[self fileURL] path]]);
+}
+
+
+/*
+ * Take a snapshot of the model and hand it to a CSDocSaver; editing can go on
+ * meanwhile, as the generation recorded here tells whether the file ends up
+ * holding the latest changes
+ */
+- (void) saveInBackgroundToFile:(NSString *)fileName
+                       delegate:(id)delegate
+                didSaveSelector:(SEL)didSaveSelector
+                    contextInfo:(void *)contextInfo
+{
+   NSDictionary *fileAttributes = [self fileAttributesToWriteToURL:[NSURL fileURLWithPath:fileName]
+                                                             ofType:[self fileType]
+                                                   forSaveOperation:NSSaveOperation
+                                                originalContentsURL:[self fileURL]
+                                                              error:NULL];
+   NSUserDefaults *userDefaults = [NSUserDefaults standardUserDefaults];
+   snapshotModel = [[self model] retain];
+   docSaver = [[CSDocSaver alloc] initWithEntries:[snapshotModel beginSnapshot]
+                                              key:bfKey
+                                 compressionCodec:[self preferredCompressionCodec]
+                                            level:[userDefaults integerForKey:CSPrefDictKey_CompressionLevel]
+                             longDistanceMatching:[userDefaults boolForKey:CSPrefDictKey_CompressionLongRange]
+                                             path:fileName
+                                   fileAttributes:fileAttributes
+                                       generation:changeGeneration
+                                         delegate:self];
+   // canSaveInBackgroundToFile: has made sure this is a plain save over the document
+   if([userDefaults boolForKey:CSPrefDictKey_SaveBackup])
+      [docSaver setBackupStore:[[[CSBackupStore alloc] initWithDocumentPath:fileName] autorelease]
+            keepingGenerations:[userDefaults integerForKey:CSPrefDictKey_BackupGenerations]];
+   saveDelegate = [delegate retain];
+   saveDidSaveSelector = didSaveSelector;
+   saveContextInfo = contextInfo;
+   [docSaver start];
+}
+
+
+/*
+ * The background save is done; the document is only clean if nothing changed
+ * since the snapshot.  Then tell whoever asked for the save, as NSDocument would.
+ */
+- (void) docSaverDidFinish:(CSDocSaver *)saver
+{
+   NSAssert(saver == docSaver, @"unexpected saver");
+
+   BOOL didSave = [saver succeeded];
+   [snapshotModel endSnapshot];
+   [snapshotModel release];
+   snapshotModel = nil;
+   if(didSave)
+   {
+      [self setFileModificationDate:[saver fileModificationDate]];
+      if([saver generation] == changeGeneration)
+         [self updateChangeCount:NSChangeCleared];
+      if(![saver backupSucceeded])
+         [self reportBackupFailure];
+   }
+   else
+      [self presentError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:nil]
+          modalForWindow:[mainWindowController window]
+                delegate:nil
+      didPresentSelector:NULL
+             contextInfo:NULL];
+   [docSaver release];
+   docSaver = nil;
+
+   if(saveDelegate != nil && saveDidSaveSelector != NULL)
+   {
+      // document:didSave:contextInfo:
+      NSMethodSignature *didSaveSig = [saveDelegate methodSignatureForSelector:saveDidSaveSelector];
+      NSInvocation *didSaveInvocation = [NSInvocation invocationWithMethodSignature:didSaveSig];
+      [didSaveInvocation setTarget:saveDelegate];
+      [didSaveInvocation setSelector:saveDidSaveSelector];
+      [didSaveInvocation setArgument:&self atIndex:2];
+      [didSaveInvocation setArgument:&didSave atIndex:3];
+      [didSaveInvocation setArgument:&saveContextInfo atIndex:4];
+      [didSaveInvocation invoke];
+   }
+   [saveDelegate release];
+   saveDelegate = nil;
+   saveDidSaveSelector = NULL;
+   saveContextInfo = NULL;
+}
+
+
+/*
+ * Around a save through NSDocument, back up as a background save does: the
+ * file being replaced, if the backups don't hold it yet, then what was saved.
+ * Only plain saves over the document are backed up; autosaves aren't
+ * generations, and save as/to shouldn't leave backups beside the copy.
+ */
+- (BOOL) writeSafelyToURL:(NSURL *)absoluteURL
+                   ofType:(NSString *)typeName
+         forSaveOperation:(NSSaveOperationType)saveOperation
+                    error:(NSError **)outError
+{
+   NSUserDefaults *userDefaults = [NSUserDefaults standardUserDefaults];
+   CSBackupStore *backupStore = nil;
+   NSUInteger keepCount = [userDefaults integerForKey:CSPrefDictKey_BackupGenerations];
+   BOOL backedUp = YES;
+   if([userDefaults boolForKey:CSPrefDictKey_SaveBackup] && saveOperation == NSSaveOperation
+      && [absoluteURL isFileURL] && bfKey != nil && docLoader == nil)
+   {
+      backupStore = [[[CSBackupStore alloc] initWithDocumentPath:[absoluteURL path]] autorelease];
+      backedUp = [backupStore addGenerationWithDocumentAtPath:[absoluteURL path]
+                                                          key:bfKey
+                                           keepingGenerations:keepCount];
+   }
+
+   if(![super writeSafelyToURL:absoluteURL ofType:typeName forSaveOperation:saveOperation error:outError])
+      return NO;
+
+   if(backupStore != nil)
+   {
+      CSDocModel *model = [self model];
+      NSData *savedData = [NSData dataWithContentsOfURL:absoluteURL options:NSMappedRead error:NULL];
+      backedUp = ([backupStore addGenerationWithEntries:[model beginSnapshot]
+                                            documentData:savedData
+                                                     key:bfKey
+                                        compressionCodec:[self preferredCompressionCodec]
+                                                   level:[userDefaults integerForKey:CSPrefDictKey_CompressionLevel]
+                                      keepingGenerations:keepCount]
+                  && backedUp);
+      [model endSnapshot];
+   }
+   // Not in the middle of the save, but once it's done
+   if(!backedUp)
+      [self performSelector:@selector(reportBackupFailure) withObject:nil afterDelay:0.0];
+
+   return YES;
+}
+
+
+/*
+ * The document was saved, but not backed up; say so, without failing the save
+ */
+- (void) reportBackupFailure
+{
+#if defined(DEBUG)
+   NSLog(@"CSDocument reportBackupFailure: failed to back up %@", [self fileURL]);
+#endif
+   NSBeginAlertSheet(NSLocalizedString(@"Backup Failed", @""),
+                     nil,
+                     nil,
+                     nil,
+                     [mainWindowController window],
+                     nil,
+                     NULL,
+                     NULL,
+                     NULL,
+                     NSLocalizedString(@"The document was saved, but it could not be backed up.", @""));
+}
+
+
+/*
+ * Wait for any background save to be written
+ */
+- (void) finishBackgroundSave
+{
+   if(docSaver != nil)
+      [docSaver waitUntilFinished];
+}
+
+
+/*
+ * Count every change, so a background save knows whether the document changed
+ * while it ran
+ */
+- (void) updateChangeCount:(NSDocumentChangeType)change
+{
+   // An undo which found its record dropped changed nothing, so it can't have brought us back to what's saved
+   if(undoWasLost && (change == NSChangeUndone || change == NSChangeRedone))
+   {
+      change = NSChangeDone;
+      undoWasLost = NO;
+   }
+   if(change != NSChangeCleared)
+      changeGeneration++;
+   [super updateChangeCount:change];
+}
+
+
+/*
+ * The undo in progress did nothing (see CSDocModelDidLoseUndoNotification);
+ * the change count is updated once it's over
+ */
+- (void) modelDidLoseUndo:(NSNotification *)notification
+{
+   undoWasLost = YES;
 }
 
 
@@ -202,7 +480,8 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 
 
 /*
- * For save
+ * For save (other than in the background); the compression codec comes from the
+ * preferences
  */
 - (NSData *) dataOfType:(NSString *)typeName error:(NSError **)outError
 {
@@ -210,53 +489,278 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
             ([NSString stringWithFormat:@"Unknown file type %@", typeName]));
    NSAssert(bfKey != nil, @"key is nil");
 
-   return [[self model] encryptedDataWithKey:bfKey];
+   // Never write out the placeholder shown while loading
+   if(docLoader != nil)
+   {
+      if(outError != NULL)
+         *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:nil];
+      return nil;
+   }
+
+   NSUserDefaults *userDefaults = [NSUserDefaults standardUserDefaults];
+   NSString *codec = [self preferredCompressionCodec];
+
+   return [[self model] encryptedDataWithKey:bfKey
+                            compressionCodec:codec
+                                       level:[userDefaults integerForKey:CSPrefDictKey_CompressionLevel]
+                        longDistanceMatching:[userDefaults boolForKey:CSPrefDictKey_CompressionLongRange]];
+}
+
+
+/*
+ * The compression codec from the preferences, falling back to zlib when the
+ * preferred one isn't built in
+ */
+- (NSString *) preferredCompressionCodec
+{
+   NSString *codec = [[NSUserDefaults standardUserDefaults] stringForKey:CSPrefDictKey_CompressionCodec];
+   if(![NSData isCompressionCodecAvailable:codec])
+      codec = NSDataCompressionCodecZlib;
+
+   return codec;
 }
 
 
 /*
- * For open
+ * Try every codec on this document's entries, as they'd be saved, and show
+ * how each did, to help pick the saving prefs
+ */
+- (IBAction) runCompressionBenchmark:(id)sender
+{
+   // nil if some value can't be serialized, in which case saving fails too
+   NSString *report = [[self model] compressionBenchmarkReport];
+   if(report == nil)
+      report = NSLocalizedString(@"The entries could not be encoded for saving.", @"");
+   NSBeginAlertSheet(NSLocalizedString(@"Compression Benchmark", @""),
+                     nil,
+                     nil,
+                     nil,
+                     [mainWindowController window],
+                     nil,
+                     NULL,
+                     NULL,
+                     NULL,
+                     @"%@",
+                     report);
+}
+
+
+/*
+ * For open; once a passphrase passes the container's quick key check, the real
+ * work happens on a CSDocLoader thread, with an empty placeholder model until
+ * it finishes (see docLoader:didFinishWithModel:)
  */
 - (BOOL) readFromData:(NSData *)data ofType:(NSString *)typeName error:(NSError **)outError
 {
    NSAssert(([typeName isEqualToString:CSDocument_Name] || [typeName isEqualToString:CSDocument_NameUTI]),
             ([NSString stringWithFormat:@"Unknown file type %@", typeName]));
 
+   [self cancelLoading];
    if(docModel != nil)   // This'll happen on revert
    {
       [CSWinCtrlChange closeOpenControllersForDocument:self];
-      [docModel release];
-      docModel = nil;
+      [self teardownModel];
    }
-   
-   // Loop through until we either successfully open it, or the user cancels
-   while(docModel == nil)
+
+   CSDocContainer *container = [[[CSDocContainer alloc] initWithData:data] autorelease];
+   if(container == nil)
    {
-      if(bfKey == nil)
-         [self setBFKey:[passphraseWindowController getEncryptionKeyWithNote:CSPassphraseNote_Load
-                                                            forDocumentNamed:[self displayName]]];
-      if(bfKey != nil)
+      if(outError != NULL)
+         *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+      return NO;
+   }
+
+   if(![self getKeyForContainer:container])
+   {
+      if(outError != NULL)
       {
-         docModel = [[CSDocModel alloc] initWithEncryptedData:data bfKey:bfKey];
-         if(docModel != nil)
-            [self setupModel];
-         else
-            [self setBFKey:nil];
+         /* The error object must be set (even though this isn't a true error) or doing a cancel twice
+         * will cause it to crash in the depths of NSDocumentController code
+         */
+         *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil];
       }
-      else
+      return NO;   // User cancelled
+   }
+
+   [self model];   // Placeholder, until the loader is done
+   [self startLoadingContainer:container recovering:NO];
+
+   return YES;
+}
+
+
+/*
+ * Loop through until we either get a key which looks right, or the user
+ * cancels (returning NO); a key already set is kept if it looks right
+ */
+- (BOOL) getKeyForContainer:(CSDocContainer *)container
+{
+   if(bfKey != nil && ![container isPossibleKey:bfKey])
+      [self setBFKey:nil];
+   while(bfKey == nil)
+   {
+      [self setBFKey:[passphraseWindowController getEncryptionKeyWithNote:CSPassphraseNote_Load
+                                                         forDocumentNamed:[self displayName]]];
+      if(bfKey == nil)
+         return NO;
+      else if(![container isPossibleKey:bfKey])
+         [self setBFKey:nil];
+   }
+
+   return YES;
+}
+
+
+/*
+ * Hand the container to a new loader, with the current key
+ */
+- (void) startLoadingContainer:(CSDocContainer *)container recovering:(BOOL)recover
+{
+   [self cancelLoading];
+   docLoader = [[CSDocLoader alloc] initWithContainer:container key:bfKey delegate:self];
+   [docLoader setRecovering:recover];
+   [docLoader start];
+   [mainWindowController setLoadingPhase:CSDocLoaderPhase_Decrypt progress:0.0];
+}
+
+
+/*
+ * Progress from the loader, shown in the main window
+ */
+- (void) docLoader:(CSDocLoader *)loader didReachPhase:(NSInteger)phase progress:(double)progress
+{
+   [mainWindowController setLoadingPhase:phase progress:progress];
+}
+
+
+/*
+ * The loader is done; swap in the real model, or give up on the document if it
+ * couldn't be read after all.  The quick key check for legacy documents (with
+ * no key check of their own) lets through the odd wrong key, so those ask for
+ * the passphrase again, as opening always did.  A damaged document in the
+ * block format gets the choice of recovering what's intact.
+ */
+- (void) docLoader:(CSDocLoader *)loader didFinishWithModel:(CSDocModel *)model
+{
+   // The loader is only kept alive by the docLoader reference until this returns
+   [[docLoader retain] autorelease];
+   [docLoader release];
+   docLoader = nil;
+   [mainWindowController loadingDidEnd];
+   if(model != nil)
+   {
+      [self teardownModel];
+      docModel = [model retain];
+      [self setupModel];
+      [[self undoManager] removeAllActions];
+      if([loader isRecovering])
       {
-         if(outError != NULL)
-         {
-            /* The error object must be set (even though this isn't a true error) or doing a cancel twice
-            * will cause it to crash in the depths of NSDocumentController code
-            */
-            *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil];
-         }
-         break;   // User cancelled
+         // What was recovered isn't on disk yet, so the document starts out edited
+         [self updateChangeCount:NSChangeDone];
+         NSBeginAlertSheet(NSLocalizedString(@"Document Recovered", @""),
+                           nil,
+                           nil,
+                           nil,
+                           [mainWindowController window],
+                           nil,
+                           NULL,
+                           NULL,
+                           NULL,
+                           [NSString stringWithFormat:
+                                     NSLocalizedString(@"%lu damaged block(s) of entries could not be "
+                                                       @"recovered; save the document to keep the "
+                                                       @"entries which were.", @""),
+                                     (unsigned long) [loader lostBlockCount]]);
       }
    }
+   else if([[loader container] version] == CSDocContainerVersion_Legacy)
+   {
+      [self setBFKey:nil];
+      if([self getKeyForContainer:[loader container]])
+         [self startLoadingContainer:[loader container] recovering:NO];
+      else
+         [self close];
+   }
+   else if([[loader container] canRecoverBlocks] && ![loader isRecovering])
+   {
+      NSBeginAlertSheet(NSLocalizedString(@"Document Damaged", @""),
+                        NSLocalizedString(@"Close", @""),
+                        NSLocalizedString(@"Recover Entries", @""),
+                        nil,
+                        [mainWindowController window],
+                        self,
+                        NULL,
+                        @selector(recoverSheetDidDismiss:returnCode:contextInfo:),
+                        [[loader container] retain],
+                        NSLocalizedString(@"Part of the document is damaged.  The entries in the "
+                                          @"undamaged parts can be recovered.", @""));
+   }
+   else
+   {
+      NSBeginAlertSheet(NSLocalizedString(@"Unable to Open Document", @""),
+                        nil,
+                        nil,
+                        nil,
+                        [mainWindowController window],
+                        self,
+                        NULL,
+                        @selector(loadFailedSheetDidDismiss:returnCode:contextInfo:),
+                        NULL,
+                        NSLocalizedString(@"The document could not be read; it may be damaged, "
+                                          @"or the passphrase may be wrong.", @""));
+   }
+}
+
+
+/*
+ * After the failed load alert, close the document
+ */
+- (void) loadFailedSheetDidDismiss:(NSWindow *)sheet
+                        returnCode:(NSInteger)returnCode
+                       contextInfo:(void *)contextInfo
+{
+   [self close];
+}
+
 
-   return (docModel != nil);
+/*
+ * After the damaged document alert, either load again, recovering what's
+ * intact, or close the document; contextInfo is the retained container
+ */
+- (void) recoverSheetDidDismiss:(NSWindow *)sheet
+                     returnCode:(NSInteger)returnCode
+                    contextInfo:(void *)contextInfo
+{
+   CSDocContainer *container = [(CSDocContainer *) contextInfo autorelease];
+   if(returnCode == NSAlertAlternateReturn && bfKey != nil)
+      [self startLoadingContainer:container recovering:YES];
+   else
+      [self close];
+}
+
+
+/*
+ * Stop any background load in progress
+ */
+- (void) cancelLoading
+{
+   if(docLoader != nil)
+   {
+      [docLoader cancel];
+      [docLoader release];
+      docLoader = nil;
+   }
+}
+
+
+/*
+ * Closing the document cancels any load still going
+ */
+- (void) close
+{
+   [self cancelLoading];
+   [self finishBackgroundSave];
+   [super close];
 }
 
 
@@ -289,7 +793,7 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
    if(![newKey isEqual:bfKey])
    {
       [newKey retain];
-      // XXX - bfKey can be zeroed
+      // Keys come from CSSecureData, so the old one is cleared once fully released
       [bfKey release];
       bfKey = newKey;
    }
@@ -330,7 +834,12 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
       NSInteger saveOption = [[NSUserDefaults standardUserDefaults]
                               integerForKey:CSPrefDictKey_CloseAfterTimeoutSaveOption];
       if(saveOption == CSPrefCloseAfterTimeoutSaveOption_Save)
+      {
+         // The save has to be done before deciding whether the document can close
+         forceSynchronousSave = YES;
          [self saveDocument:self];
+         forceSynchronousSave = NO;
+      }
       else if(saveOption == CSPrefCloseAfterTimeoutSaveOption_Discard)
          [self updateChangeCount:NSChangeCleared];
    }
@@ -343,11 +852,22 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 #pragma mark -
 #pragma mark Queries
 /*
- * Whether or not to keep a backup file (determined by user pref)
+ * NSDocument never keeps a backup copy; with the backup preference on, each
+ * save goes into the document's CSBackupStore as a generation instead (the
+ * file being replaced too, the first time), and Open Backup brings them back
  */
 - (BOOL) keepBackupFile
 {
-   return [[NSUserDefaults standardUserDefaults] boolForKey:CSPrefDictKey_SaveBackup];
+   return NO;
+}
+
+
+/*
+ * Whether the model is still the placeholder shown while loading
+ */
+- (BOOL) isLoading
+{
+   return (docLoader != nil);
 }
 
 
@@ -374,12 +894,12 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
    }
    else
       categories = [NSMutableArray arrayWithCapacity:10];
-   NSInteger index;
-   for(index = 0; index < [self entryCount]; index++)
+   NSEnumerator *categoryEnumerator = [[[self model] categories] objectEnumerator];
+   id oneCategory;
+   while((oneCategory = [categoryEnumerator nextObject]) != nil)
    {
-      NSString *category = [self stringForKey:CSDocModelKey_Category atRow:index];
-      if(category != nil && ([category length] > 0) && ![categories containsObject:category])
-         [categories addObject:category];
+      if(![categories containsObject:oneCategory])
+         [categories addObject:oneCategory];
    }
 
    return [categories sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
@@ -389,9 +909,12 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 #pragma mark -
 #pragma mark Export
 /*
- * Return CSV data for the given rows, wrapped in an NSData
+ * Return CSV data for the given entries (from a snapshot) and their notes as
+ * plain text, wrapped in an NSData; the lines are put together across the
+ * processors (see CSTaskPool).  Touches no document or model, so it's safe
+ * on any thread.
  */
-- (NSData *) generateCSVDataForIndexes:(NSIndexSet *)indexes withHeader:(BOOL)includeHeader
++ (NSData *) CSVDataForEntries:(NSArray *)entries notes:(NSArray *)notes withHeader:(BOOL)includeHeader
 {
    NSMutableData *csvData = [NSMutableData data];
    if(includeHeader)
@@ -403,29 +926,24 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
                                                          NSLocalizedString(CSDocModelKey_Category, @""),
                                                          NSLocalizedString(CSDocModelKey_Notes, @"")]
                            dataUsingEncoding:NSUTF8StringEncoding]];
-   NSInteger rowIndex;
-   for(rowIndex = [indexes firstIndex];
-       rowIndex != NSNotFound;
-       rowIndex = [indexes indexGreaterThanIndex:rowIndex])
+   NSUInteger lineCount = [entries count];
+   NSMutableData *lineData = [NSMutableData dataWithLength:lineCount * sizeof(NSData *)];
+   NSData **lines = [lineData mutableBytes];
+   CSDocumentCSVExport csvExport;
+   csvExport.entries = entries;
+   csvExport.keys = [NSArray arrayWithObjects:CSDocModelKey_Name, CSDocModelKey_Acct, CSDocModelKey_Passwd,
+                                              CSDocModelKey_URL, CSDocModelKey_Category, nil];
+   csvExport.notes = notes;
+   csvExport.lines = lines;
+   [[CSTaskPool sharedPool] applyFunction:CSDocumentCSVLines
+                                  toRange:NSMakeRange(0, lineCount)
+                                grainSize:CSDocumentCSVGrainRows
+                                  context:&csvExport];
+   NSUInteger line;
+   for(line = 0; line < lineCount; line++)
    {
-      NSArray *entryArray = [[self model] stringArrayForEntryAtRow:rowIndex];
-      NSMutableString *entryString = [NSMutableString string];
-      NSEnumerator *arrayEnum = [entryArray objectEnumerator];
-      id entryField;
-      while((entryField = [arrayEnum nextObject]) != nil)
-      {
-         NSMutableString *newString = [NSMutableString stringWithString:entryField];
-         [newString replaceOccurrencesOfString:@"\""
-                                    withString:@"\"\""
-                                       options:0
-                                         range:NSMakeRange(0, [newString length])];
-         if([entryString length] > 0)
-            [entryString appendString:@","];
-         if([newString length] > 0)
-            [entryString appendFormat:@"\"%@\"", newString];
-      }
-      [entryString appendString:@"\n"];
-      [csvData appendData:[entryString dataUsingEncoding:NSUTF8StringEncoding]];
+      [csvData appendData:lines[line]];
+      [lines[line] release];
    }
 
    return csvData;
@@ -433,56 +951,46 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 
 
 /*
- * Return XML data for the document, with the notes field converter to plain text when plainText is YES
+ * Return XML data for the given entries (from a snapshot), with their notes as
+ * plain text; safe on any thread, like the above
  */
-- (NSXMLDocument *) xmlDocumentForIndexes:(NSIndexSet *)indexes plainText:(BOOL)plainText
++ (NSData *) XMLDataForEntries:(NSArray *)entries notes:(NSArray *)notes
 {
    NSXMLElement *rootElement = [NSXMLNode elementWithName:CSDocumentXML_RootNode];
    NSArray *keyArray = [NSArray arrayWithObjects:CSDocModelKey_Name, CSDocModelKey_Acct,
                                                  CSDocModelKey_Passwd, CSDocModelKey_URL,
-                                                 CSDocModelKey_Category, CSDocModelKey_Notes, nil];
-   NSInteger rowIndex;
-   for(rowIndex = [indexes firstIndex];
-       rowIndex != NSNotFound;
-       rowIndex = [indexes indexGreaterThanIndex:rowIndex])
+                                                 CSDocModelKey_Category, nil];
+   NSUInteger index;
+   for(index = 0; index < [entries count]; index++)
    {
+      NSDictionary *entry = [entries objectAtIndex:index];
       NSXMLElement *entryElement = [NSXMLNode elementWithName:CSDocumentXML_EntryNode];
       NSEnumerator *keyEnumerator = [keyArray objectEnumerator];
       id key;
       while((key = [keyEnumerator nextObject]) != nil)
       {
-         NSXMLNode *childElement;
-         if([key isEqualToString:CSDocModelKey_Notes] && !plainText)
-         {
-            childElement = [NSXMLNode elementWithName:key];
-            [childElement setObjectValue:[[self model] RTFDNotesAtRow:rowIndex]];
-         }
-         else
-            childElement = [NSXMLNode elementWithName:key
-                                          stringValue:[[self model] stringForKey:key atRow:rowIndex]];
-         [entryElement addChild:childElement];
+         NSString *value = [entry objectForKey:key];
+         [entryElement addChild:[NSXMLNode elementWithName:key stringValue:(value != nil ? value : @"")]];
       }
+      [entryElement addChild:[NSXMLNode elementWithName:CSDocModelKey_Notes
+                                            stringValue:[notes objectAtIndex:index]]];
       [rootElement addChild:entryElement];
    }
    NSXMLDocument *xmlDoc = [[NSXMLDocument alloc] initWithRootElement:rootElement];
    [xmlDoc setVersion:@"1.0"];
    [xmlDoc setCharacterEncoding:@"UTF-8"];
+   NSData *xmlData = [xmlDoc XMLDataWithOptions:NSXMLNodePrettyPrint];
+   [xmlDoc release];
 
-   return [xmlDoc autorelease];
+   return xmlData;
 }
 
 
 /*
- * Return data representation of the given entries as XML
- */
-- (NSData *) generateXMLDataForIndexes:(NSIndexSet *)indexes
-{
-   return [[self xmlDocumentForIndexes:indexes plainText:YES] XMLDataWithOptions:NSXMLNodePrettyPrint];
-}
-
-
-/*
- * Handle the actual export
+ * Handle the actual export: the entries to export come from a snapshot of the
+ * model (see CSDocModel), and their notes are turned into text here, as the
+ * text system stays on the main thread; the rest, and the writing, happens on
+ * a thread of its own, so editing can carry on meanwhile
  */
 - (void) exportPanelDidEnd:(NSSavePanel *)sheet
                 returnCode:(NSInteger)returnCode
@@ -495,21 +1003,86 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
          entriesToExport = [mainWindowController selectedRowIndexes];
       else
          entriesToExport = [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, [self entryCount])];
-      NSData *myData = nil;
-      if([mainWindowController exportType] == CSWinCtrlMainExportType_CSV)
-         myData = [self generateCSVDataForIndexes:entriesToExport
-                                       withHeader:[mainWindowController exportCSVHeader]];
-      else
-         myData = [self generateXMLDataForIndexes:entriesToExport];
-      NSDictionary *fileAttr = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:0600]
-                                                           forKey:NSFilePosixPermissions];
-      [[NSFileManager defaultManager] createFileAtPath:[sheet filename]
-                                              contents:myData
-                                            attributes:fileAttr];
+      CSDocModel *model = [self model];
+      NSArray *snapshot = [model beginSnapshot];
+      NSArray *entries = [snapshot objectsAtIndexes:entriesToExport];
+      NSMutableArray *notes = [NSMutableArray arrayWithCapacity:[entries count]];
+      NSInteger row;
+      for(row = [entriesToExport firstIndex]; row != NSNotFound; row = [entriesToExport indexGreaterThanIndex:row])
+         [notes addObject:[model stringForKey:CSDocModelKey_Notes atRow:row]];
+      NSDictionary *exportJob = [NSDictionary dictionaryWithObjectsAndKeys:
+                                                 model, CSDocumentExportKey_Model,
+                                                 entries, CSDocumentExportKey_Entries,
+                                                 notes, CSDocumentExportKey_Notes,
+                                                 [sheet filename], CSDocumentExportKey_Path,
+                                                 [NSNumber numberWithBool:
+                                                            ([mainWindowController exportType]
+                                                             == CSWinCtrlMainExportType_CSV)],
+                                                 CSDocumentExportKey_IsCSV,
+                                                 [NSNumber numberWithBool:[mainWindowController exportCSVHeader]],
+                                                 CSDocumentExportKey_CSVHeader,
+                                                 nil];
+      [NSThread detachNewThreadSelector:@selector(exportOnThread:) toTarget:self withObject:exportJob];
    }
 }
 
 
+/*
+ * Put the export together and write it, readable only by the owner, then
+ * finish up on the main thread; only the job is touched here
+ */
+- (void) exportOnThread:(NSDictionary *)exportJob
+{
+   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+   NSArray *entries = [exportJob objectForKey:CSDocumentExportKey_Entries];
+   NSArray *notes = [exportJob objectForKey:CSDocumentExportKey_Notes];
+   BOOL includeHeader = [[exportJob objectForKey:CSDocumentExportKey_CSVHeader] boolValue];
+   NSData *exportData;
+   if([[exportJob objectForKey:CSDocumentExportKey_IsCSV] boolValue])
+      exportData = [CSDocument CSVDataForEntries:entries notes:notes withHeader:includeHeader];
+   else
+      exportData = [CSDocument XMLDataForEntries:entries notes:notes];
+   NSDictionary *fileAttr = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:0600]
+                                                        forKey:NSFilePosixPermissions];
+   NSFileManager *fileManager = [[NSFileManager alloc] init];   // defaultManager is main thread only
+   BOOL exported = [fileManager createFileAtPath:[exportJob objectForKey:CSDocumentExportKey_Path]
+                                        contents:exportData
+                                      attributes:fileAttr];
+   [fileManager release];
+   [self performSelectorOnMainThread:@selector(exportDidFinish:)
+                          withObject:[NSArray arrayWithObjects:exportJob,
+                                                               [NSNumber numberWithBool:exported],
+                                                               nil]
+                       waitUntilDone:NO];
+   [pool release];
+}
+
+
+/*
+ * Let the snapshot go, and say so if the file couldn't be written; the
+ * argument is the job and whether it was written
+ */
+- (void) exportDidFinish:(NSArray *)jobAndResult
+{
+   NSDictionary *exportJob = [jobAndResult objectAtIndex:0];
+   [[exportJob objectForKey:CSDocumentExportKey_Model] endSnapshot];
+   if(![[jobAndResult objectAtIndex:1] boolValue])
+      NSBeginAlertSheet(NSLocalizedString(@"Export Failed", @""),
+                        nil,
+                        nil,
+                        nil,
+                        [self windowForSheet],   // The document may have closed meanwhile
+                        nil,
+                        NULL,
+                        NULL,
+                        NULL,
+                        @"%@",
+                        [NSString stringWithFormat:NSLocalizedString(@"The entries could not be written to %@.",
+                                                                     @""),
+                                  [exportJob objectForKey:CSDocumentExportKey_Path]]);
+}
+
+
 /*
  * Run the save panel for exporting
  */
@@ -561,7 +1134,7 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 {
    /*
     * This generates several pasteboard types:
-    *    CSDocumentPboardType - an archived NSMutableArray (docArray)
+    *    CSDocumentPboardType - the entries of docArray, serialized (see CSEntrySerializer)
     *    NSRTFDPboardType - RTFData, as data
     *    NSRTFPboardType - RTF, as data
     *    NSTabularTextPboardType - simple string, each entry tab-delimited
@@ -609,6 +1182,14 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
       [rtfdStringRows appendAttributedString:attrEOL];
    }
 
+   // Rather than copy entries with a value missing, don't copy
+   NSData *serializedData = [CSEntrySerializer serializedDataForEntries:docArray];
+   if(serializedData == nil)
+   {
+      [rtfdStringRows release];
+      [attrEOL release];
+      return NO;
+   }
    [pboard declareTypes:[NSArray arrayWithObjects:CSDocumentPboardType,
                                                   NSRTFDPboardType,
                                                   NSRTFPboardType,
@@ -616,7 +1197,7 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
                                                   NSStringPboardType,
                                                   nil]
                   owner:nil];
-   [pboard setData:[NSArchiver archivedDataWithRootObject:docArray] forType:CSDocumentPboardType];
+   [pboard setData:serializedData forType:CSDocumentPboardType];
    [pboard setData:[rtfdStringRows RTFDWithDocumentAttributes:NULL] forType:NSRTFDPboardType];
    [pboard setData:[rtfdStringRows RTFWithDocumentAttributes:NULL] forType:NSRTFPboardType];
    [pboard setString:[rtfdStringRows string] forType:NSTabularTextPboardType];
@@ -635,7 +1216,8 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
                               undoName:(NSString *)undoName
 {
    BOOL retval = NO;
-   NSArray *entryArray = [NSUnarchiver unarchiveObjectWithData:[pboard dataForType:CSDocumentPboardType]];
+   // Entries from older versions come archived, which CSEntrySerializer still reads
+   NSArray *entryArray = [CSEntrySerializer entriesFromData:[pboard dataForType:CSDocumentPboardType]];
    if(entryArray != nil && [entryArray count] > 0)
    {
       NSMutableArray *nameArray = [NSMutableArray arrayWithCapacity:[entryArray count]];
@@ -661,6 +1243,211 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 }
 
 
+#pragma mark -
+#pragma mark Backups
+/*
+ * Generations in this document's backup store (see CSBackupStore), oldest first
+ */
+- (NSArray *) backupGenerations
+{
+   if([self fileURL] == nil)
+      return [NSArray array];
+
+   CSBackupStore *backupStore = [[[CSBackupStore alloc] initWithDocumentPath:[[self fileURL] path]]
+                                 autorelease];
+
+   return [backupStore generations];
+}
+
+
+/*
+ * Open the given backup generation as a new, untitled document, leaving this
+ * one alone.  The backup store must have been written with the current
+ * passphrase; a copy of the document file asks for its own passphrase if it
+ * was saved with another.
+ */
+- (CSDocument *) openBackupGeneration:(NSUInteger)generation error:(NSError **)outError
+{
+   NSMutableArray *entries = nil;
+   NSData *docData = nil;
+   if([self fileURL] != nil && bfKey != nil)
+   {
+      CSBackupStore *backupStore = [[[CSBackupStore alloc] initWithDocumentPath:[[self fileURL] path]]
+                                    autorelease];
+      entries = [backupStore entriesOfGeneration:generation withKey:bfKey];
+      if(entries == nil)
+         docData = [backupStore documentDataOfGeneration:generation withKey:bfKey];
+   }
+   if(docData != nil)
+      return [self openRestoredDocumentData:docData error:outError];
+   else if(entries == nil)
+   {
+      if(outError != NULL)
+         *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+      return nil;
+   }
+
+   CSDocument *restoredDocument = [[NSDocumentController sharedDocumentController]
+                                   openUntitledDocumentAndDisplay:YES error:outError];
+   if(restoredDocument == nil)
+      return nil;
+
+   NSMutableArray *nameArray = [NSMutableArray arrayWithCapacity:[entries count]];
+   NSEnumerator *entryEnumerator = [entries objectEnumerator];
+   id entryDictionary;
+   while((entryDictionary = [entryEnumerator nextObject]) != nil)
+   {
+      NSString *name = [entryDictionary objectForKey:CSDocModelKey_Name];
+      if([[restoredDocument model] addBulkEntryWithName:name
+                                                account:[entryDictionary objectForKey:CSDocModelKey_Acct]
+                                               password:[entryDictionary objectForKey:CSDocModelKey_Passwd]
+                                                    URL:[entryDictionary objectForKey:CSDocModelKey_URL]
+                                               category:[entryDictionary objectForKey:CSDocModelKey_Category]
+                                              notesRTFD:[entryDictionary objectForKey:CSDocModelKey_Notes]
+                                                entryID:[entryDictionary objectForKey:CSDocModelKey_EntryID]])
+         [nameArray addObject:name];
+   }
+   [[restoredDocument model] registerAddForNamesInArray:nameArray];
+   [[restoredDocument undoManager] removeAllActions];
+   [restoredDocument updateChangeCount:NSChangeDone];
+
+   return restoredDocument;
+}
+
+
+/*
+ * Load a backed up copy of the document file into a new, untitled document,
+ * trying this document's key first
+ */
+- (CSDocument *) openRestoredDocumentData:(NSData *)docData error:(NSError **)outError
+{
+   CSDocument *restoredDocument = [[[CSDocument alloc] initWithType:[self fileType] error:outError]
+                                   autorelease];
+   if(restoredDocument == nil)
+      return nil;
+
+   [restoredDocument setBFKey:bfKey];
+   if(![restoredDocument readFromData:docData ofType:[self fileType] error:outError])
+      return nil;
+
+   [[NSDocumentController sharedDocumentController] addDocument:restoredDocument];
+   [restoredDocument makeWindowControllers];
+   [restoredDocument showWindows];
+   // Loading is still going, but whatever it loads isn't on disk under any name
+   [restoredDocument updateChangeCount:NSChangeDone];
+
+   return restoredDocument;
+}
+
+
+/*
+ * Ask which generation to restore, newest first, in a sheet
+ */
+- (IBAction) openBackup:(id)sender
+{
+   NSDateFormatter *dateFormatter = [[[NSDateFormatter alloc] init] autorelease];
+   [dateFormatter setFormatterBehavior:NSDateFormatterBehavior10_4];
+   [dateFormatter setDateStyle:NSDateFormatterMediumStyle];
+   [dateFormatter setTimeStyle:NSDateFormatterMediumStyle];
+
+   NSPopUpButton *generationPopUp = [[[NSPopUpButton alloc] initWithFrame:NSMakeRect(0.0, 0.0, 300.0, 26.0)
+                                                                 pullsDown:NO] autorelease];
+   NSEnumerator *generationEnumerator = [[self backupGenerations] reverseObjectEnumerator];
+   NSDictionary *generationInfo;
+   while((generationInfo = [generationEnumerator nextObject]) != nil)
+   {
+      NSString *date = [dateFormatter stringFromDate:[generationInfo objectForKey:CSBackupStoreKey_Date]];
+      NSString *title;
+      if([[generationInfo objectForKey:CSBackupStoreKey_IsDocument] boolValue])
+         title = [NSString stringWithFormat:NSLocalizedString(@"%@, copy of the document file", @""), date];
+      else
+         title = [NSString stringWithFormat:NSLocalizedString(@"%@, %lu entries", @""), date,
+                           (unsigned long) [[generationInfo objectForKey:CSBackupStoreKey_EntryCount]
+                                            unsignedIntegerValue]];
+      // Titles can repeat, which addItemWithTitle: wouldn't allow
+      NSMenuItem *item = [[generationPopUp menu] addItemWithTitle:title action:NULL keyEquivalent:@""];
+      [item setTag:[[generationInfo objectForKey:CSBackupStoreKey_Generation] integerValue]];
+   }
+
+   NSAlert *alert = [[NSAlert alloc] init];
+   [alert setMessageText:NSLocalizedString(@"Restore Backup", @"")];
+   [alert setInformativeText:NSLocalizedString(@"The backup opens as a new, untitled document; this one "
+                                               @"is left as it is.", @"")];
+   [alert addButtonWithTitle:NSLocalizedString(@"Open", @"")];
+   [alert addButtonWithTitle:NSLocalizedString(@"Cancel", @"")];
+   [alert setAccessoryView:generationPopUp];
+   [alert beginSheetModalForWindow:[mainWindowController window]
+                     modalDelegate:self
+                    didEndSelector:@selector(backupSheetDidEnd:returnCode:contextInfo:)
+                       contextInfo:NULL];
+}
+
+
+/*
+ * Open the chosen generation, if not cancelled; the alert is ours to release
+ */
+- (void) backupSheetDidEnd:(NSAlert *)alert returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo
+{
+   [alert autorelease];
+   if(returnCode != NSAlertFirstButtonReturn)
+      return;
+
+   [[alert window] orderOut:self];
+   NSInteger generation = [[(NSPopUpButton *) [alert accessoryView] selectedItem] tag];
+   NSError *error = nil;
+   if([self openBackupGeneration:generation error:&error] == nil && error != nil
+      && !([[error domain] isEqualToString:NSCocoaErrorDomain] && [error code] == NSUserCancelledError))
+      [self presentError:error
+          modalForWindow:[mainWindowController window]
+                delegate:nil
+      didPresentSelector:NULL
+             contextInfo:NULL];
+}
+
+
+#pragma mark -
+#pragma mark Merging
+/*
+ * Bring the changes made in another copy of this document, since the given
+ * common ancestor (which may be nil), into this one as a single undoable
+ * action; conflicts are left alone, for the caller to deal with.  Returns the
+ * merge, or nil if any of the documents is still loading.  Changes which
+ * couldn't be applied (the rest still are) are counted in outError.
+ */
+- (CSDocMerge *) mergeChangesFromDocument:(CSDocument *)remoteDocument
+                                 ancestor:(CSDocument *)ancestorDocument
+                                    error:(NSError **)outError
+{
+   if([self isLoading] || [remoteDocument isLoading] || [ancestorDocument isLoading])
+      return nil;
+
+   CSDocMerge *merge = [[[CSDocMerge alloc] initWithAncestor:[ancestorDocument model]
+                                                       local:[self model]
+                                                      remote:[remoteDocument model]] autorelease];
+   if([merge hasChanges])
+   {
+      NSInteger failures = [merge applyToModel:[self model]];
+      [[self undoManager] setActionName:NSLocalizedString(@"Merge", @"")];
+#if defined(DEBUG)
+      if(failures > 0)
+         NSLog(@"CSDocument mergeChangesFromDocument: %ld changes couldn't be applied", (long) failures);
+#endif
+      if(failures > 0 && outError != NULL)
+      {
+         NSString *description = [NSString stringWithFormat:
+                                           NSLocalizedString(@"%ld change(s) could not be merged.", @""),
+                                           (long) failures];
+         *outError = [NSError errorWithDomain:NSCocoaErrorDomain
+                                         code:NSValidationErrorMinimum
+                                     userInfo:[NSDictionary dictionaryWithObject:description
+                                                                          forKey:NSLocalizedDescriptionKey]];
+      }
+   }
+
+   return merge;
+}
+
+
 #pragma mark -
 #pragma mark Proxied Methods to the Model
 /*
@@ -858,10 +1645,53 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 }
 
 
+/*
+ * Return whether the entry on the given row matches
+ */
+- (BOOL) entryAtRow:(NSInteger)row
+      matchesString:(NSString *)findMe
+         ignoreCase:(BOOL)ignoreCase
+             forKey:(NSString *)key
+{
+   return [[self model] entryAtRow:row
+                     matchesString:findMe
+                        ignoreCase:ignoreCase
+                            forKey:key];
+}
+
+
+/*
+ * Return groups of names of entries sharing a password
+ */
+- (NSArray *) reusedPasswordGroups
+{
+   return [[self model] reusedPasswordGroups];
+}
+
+
+/*
+ * Return groups of names of entries with the same account and URL
+ */
+- (NSArray *) duplicateEntryGroups
+{
+   return [[self model] duplicateEntryGroups];
+}
+
+
+/*
+ * Return the names of entries with the same password as the named one
+ */
+- (NSArray *) namesSharingPasswordWithName:(NSString *)name
+{
+   return [[self model] namesSharingPasswordWithName:name];
+}
+
+
 #pragma mark -
 #pragma mark Miscellaneous
 /*
- * Called on model notifications so we can redo the table view
+ * Called on model change/remove notifications so we can keep change windows in sync; the
+ * table view itself is updated from the change set which follows (see below)
  */
 - (void) updateViewForNotification:(NSNotification *)notification
 {
@@ -892,8 +1722,16 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
             [[changeController window] performClose:self];
       }
    }
-   
-   [mainWindowController refreshWindow];
+}
+
+
+/*
+ * Called when the model has re-sorted after a change; pass the change set along so only
+ * the affected rows need handling
+ */
+- (void) updateViewForRowChanges:(NSNotification *)notification
+{
+   [mainWindowController applyRowChanges:[notification userInfo]];
 }
 
 
@@ -961,7 +1799,9 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 {
    SEL itemAction = [anItem action];
    
-   if(itemAction == @selector(changePassphrase:))
+   if(docLoader != nil && itemAction != @selector(performClose:))
+      return NO;
+   else if(itemAction == @selector(changePassphrase:))
       return (bfKey != nil);
    else if(itemAction == @selector(revertDocumentToSaved:))
    {
@@ -972,8 +1812,10 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
    }
    else if(itemAction == @selector(exportSelectedItems:))
       return ([[[self mainWindowController] selectedRowIndexes] count] > 0);
-   else if(itemAction == @selector(exportDocument:))
+   else if(itemAction == @selector(exportDocument:) || itemAction == @selector(runCompressionBenchmark:))
       return ([self entryCount] > 0);
+   else if(itemAction == @selector(openBackup:))
+      return ([self fileURL] != nil && bfKey != nil && [[self backupGenerations] count] > 0);
    else
       return [super validateUserInterfaceItem:anItem];
 }
@@ -984,9 +1826,12 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
  */
 - (void) dealloc
 {
+   [self cancelLoading];
+   [snapshotModel release];
+   [saveDelegate release];
    [self setBFKey:nil];
    [passphraseWindowController release];
-   [docModel release];
+   [self teardownModel];
    [super dealloc];
 }
 
@@ -1016,3 +1861,44 @@ NSString * const CSDocumentXML_EntryNode = @"entry";
 }
 
 @end
+
+
+/*
+ * Put together the CSV lines [firstLine, endLine), each field quoted (unless
+ * empty) with its quotes doubled
+ */
+static void CSDocumentCSVLines(NSUInteger firstLine, NSUInteger endLine, NSUInteger worker, void *exportInfo)
+{
+   CSDocumentCSVExport *csvExport = exportInfo;
+   NSUInteger line;
+   for(line = firstLine; line < endLine; line++)
+   {
+      NSMutableArray *entryArray = [NSMutableArray arrayWithCapacity:6];
+      NSEnumerator *keyEnumerator = [csvExport->keys objectEnumerator];
+      id oneKey;
+      NSDictionary *entry = [csvExport->entries objectAtIndex:line];
+      while((oneKey = [keyEnumerator nextObject]) != nil)
+      {
+         NSString *value = [entry objectForKey:oneKey];
+         [entryArray addObject:(value != nil ? value : @"")];
+      }
+      [entryArray addObject:[csvExport->notes objectAtIndex:line]];
+      NSMutableString *entryString = [NSMutableString string];
+      NSEnumerator *arrayEnum = [entryArray objectEnumerator];
+      id entryField;
+      while((entryField = [arrayEnum nextObject]) != nil)
+      {
+         NSMutableString *newString = [NSMutableString stringWithString:entryField];
+         [newString replaceOccurrencesOfString:@"\""
+                                    withString:@"\"\""
+                                       options:0
+                                         range:NSMakeRange(0, [newString length])];
+         if([entryString length] > 0)
+            [entryString appendString:@","];
+         if([newString length] > 0)
+            [entryString appendFormat:@"\"%@\"", newString];
+      }
+      [entryString appendString:@"\n"];
+      csvExport->lines[line] = [[entryString dataUsingEncoding:NSUTF8StringEncoding] retain];
+   }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSEntrySerializer.h */
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Reads and writes entries (model dictionaries, keyed by CSDocModelKey_*) in
+ * CiphSafe's own binary format: a magic number and version, then one record
+ * for each entry, each record its length followed by its fields, each field
+ * a tag, a length, and the value (UTF-8 for strings, the RTFD data for
+ * notes).  Lengths and the version are varints.  Fields with unknown tags are
+ * skipped, so later versions can add them.
+ *
+ * Encoding streams straight into the given data, so values are only ever
+ * copied into memory of the caller's choosing (CSSecureData, for a
+ * document); decoding builds each value right from the buffer.
+ */
+@interface CSEntrySerializer : NSObject
+{
+   NSMutableData *outputData;
+}
+
+// Whether the data is in this format (as opposed to an NSArchiver typedstream)
++ (BOOL) isSerializedData:(NSData *)data;
+
+/*
+ * All the given entries, into secure memory, cleared when released; nil if a
+ * string can't be encoded (see appendEntry:)
+ */
++ (NSMutableData *) serializedDataForEntries:(NSArray *)entries;
+
+/*
+ * Entries from the given data, in this format or an archived array of
+ * entries as older versions wrote; nil if the data is neither, or damaged
+ */
++ (NSMutableArray *) entriesFromData:(NSData *)data;
+
+/*
+ * Start a stream of entries at the end of the given data; appending returns
+ * NO, writing nothing, if the entry has a string UTF-8 can't hold (such as
+ * one with a lone surrogate), rather than lose the value
+ */
+- (id) initWithMutableData:(NSMutableData *)data;
+- (BOOL) appendEntry:(NSDictionary *)entry;
+
+@end
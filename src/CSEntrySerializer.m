@@ -0,0 +1,367 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSEntrySerializer.m */
+
+#import "CSEntrySerializer.h"
+#import "CSDocModel.h"
+#import "CSSecureData.h"
+
+static const char serializerMagic[] = { 'C', 'S', 'e', 'n' };
+static const uint64_t CSEntrySerializerVersion = 1;
+
+// Field tags; never reuse a tag for something else
+enum
+{
+   CSEntrySerializerTag_Name = 1,
+   CSEntrySerializerTag_Acct = 2,
+   CSEntrySerializerTag_Passwd = 3,
+   CSEntrySerializerTag_URL = 4,
+   CSEntrySerializerTag_Category = 5,
+   CSEntrySerializerTag_Notes = 6,
+   CSEntrySerializerTag_EntryID = 7
+};
+
+#define CSENTRYSERIALIZER_FIELD_COUNT 7
+#define CSENTRYSERIALIZER_MAX_VARINT_LENGTH 10
+
+static NSString *fieldKeys[CSENTRYSERIALIZER_FIELD_COUNT + 1];
+
+static NSUInteger CSEntrySerializerVarintLength(uint64_t value);
+static void CSEntrySerializerAppendVarint(NSMutableData *data, uint64_t value);
+static BOOL CSEntrySerializerReadVarint(const unsigned char *bytes, NSUInteger length,
+                                        NSUInteger *offset, uint64_t *value);
+
+
+@interface CSEntrySerializer (InternalMethods)
++ (NSMutableArray *) entriesFromSerializedData:(NSData *)data;
++ (NSMutableArray *) entriesFromArchivedData:(NSData *)data;
++ (NSUInteger) encodedLengthOfValue:(id)value;
+- (void) appendValue:(id)value withLength:(NSUInteger)valueLength;
+@end
+
+
+@implementation CSEntrySerializer
+
++ (void) initialize
+{
+   fieldKeys[CSEntrySerializerTag_Name] = CSDocModelKey_Name;
+   fieldKeys[CSEntrySerializerTag_Acct] = CSDocModelKey_Acct;
+   fieldKeys[CSEntrySerializerTag_Passwd] = CSDocModelKey_Passwd;
+   fieldKeys[CSEntrySerializerTag_URL] = CSDocModelKey_URL;
+   fieldKeys[CSEntrySerializerTag_Category] = CSDocModelKey_Category;
+   fieldKeys[CSEntrySerializerTag_Notes] = CSDocModelKey_Notes;
+   fieldKeys[CSEntrySerializerTag_EntryID] = CSDocModelKey_EntryID;
+}
+
+
++ (BOOL) isSerializedData:(NSData *)data
+{
+   return ([data length] >= sizeof(serializerMagic)
+           && memcmp([data bytes], serializerMagic, sizeof(serializerMagic)) == 0);
+}
+
+
++ (NSMutableData *) serializedDataForEntries:(NSArray *)entries
+{
+   NSMutableData *serializedData = [CSSecureData dataWithCapacity:[entries count] * 128 + 16];
+   CSEntrySerializer *serializer = [[CSEntrySerializer alloc] initWithMutableData:serializedData];
+   NSEnumerator *entryEnumerator = [entries objectEnumerator];
+   id oneEntry;
+   BOOL appendedAll = YES;
+   while(appendedAll && (oneEntry = [entryEnumerator nextObject]) != nil)
+      appendedAll = [serializer appendEntry:oneEntry];
+   [serializer release];
+
+   return (appendedAll ? serializedData : nil);
+}
+
+
++ (NSMutableArray *) entriesFromData:(NSData *)data
+{
+   if([CSEntrySerializer isSerializedData:data])
+      return [self entriesFromSerializedData:data];
+
+   return [self entriesFromArchivedData:data];
+}
+
+
+#pragma mark -
+#pragma mark Decoding
+/*
+ * Walk the records, making each value straight from its bytes; anything
+ * which runs past its record, or a string which isn't UTF-8, fails the lot
+ */
++ (NSMutableArray *) entriesFromSerializedData:(NSData *)data
+{
+   const unsigned char *bytes = [data bytes];
+   NSUInteger length = [data length];
+   NSUInteger offset = sizeof(serializerMagic);
+   uint64_t version;
+   if(!CSEntrySerializerReadVarint(bytes, length, &offset, &version) || version > CSEntrySerializerVersion)
+   {
+#if defined(DEBUG)
+      NSLog(@"CSEntrySerializer entriesFromSerializedData: bad or newer version");
+#endif
+      return nil;
+   }
+
+   NSMutableArray *entries = [NSMutableArray arrayWithCapacity:25];
+   while(offset < length)
+   {
+      uint64_t recordLength;
+      if(!CSEntrySerializerReadVarint(bytes, length, &offset, &recordLength) || recordLength > length - offset)
+         return nil;
+
+      NSUInteger recordEnd = offset + (NSUInteger) recordLength;
+      NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithCapacity:CSENTRYSERIALIZER_FIELD_COUNT];
+      while(offset < recordEnd)
+      {
+         uint64_t tag, fieldLength;
+         if(!CSEntrySerializerReadVarint(bytes, recordEnd, &offset, &tag)
+            || !CSEntrySerializerReadVarint(bytes, recordEnd, &offset, &fieldLength)
+            || fieldLength > recordEnd - offset)
+            return nil;
+
+         id value = nil;
+         if(tag == CSEntrySerializerTag_Notes)
+            value = [NSData dataWithBytes:bytes + offset length:(NSUInteger) fieldLength];
+         else if(tag > 0 && tag <= CSENTRYSERIALIZER_FIELD_COUNT)
+         {
+            value = [[[NSString alloc] initWithBytes:bytes + offset
+                                              length:(NSUInteger) fieldLength
+                                            encoding:NSUTF8StringEncoding] autorelease];
+            if(value == nil)
+               return nil;
+         }
+         if(value != nil)
+            [entry setObject:value forKey:fieldKeys[tag]];
+         offset += (NSUInteger) fieldLength;
+      }
+      if([entry objectForKey:CSDocModelKey_Name] == nil)
+         return nil;
+      [entries addObject:entry];
+   }
+
+   return entries;
+}
+
+
+/*
+ * Older documents and pasteboards hold an archived array of entries
+ */
++ (NSMutableArray *) entriesFromArchivedData:(NSData *)data
+{
+   NSMutableArray *entries = nil;
+   NS_DURING
+      entries = [NSUnarchiver unarchiveObjectWithData:data];
+   NS_HANDLER
+#if defined(DEBUG)
+      NSLog(@"CSEntrySerializer entriesFromArchivedData: exception %@", localException);
+#endif
+      entries = nil;
+   NS_ENDHANDLER
+   if(entries != nil && ![entries isKindOfClass:[NSMutableArray class]])
+   {
+#if defined(DEBUG)
+      NSLog(@"CSEntrySerializer entriesFromArchivedData: archive holds a %@", [entries class]);
+#endif
+      entries = nil;
+   }
+
+   return entries;
+}
+
+
+#pragma mark -
+#pragma mark Encoding
+- (id) initWithMutableData:(NSMutableData *)data
+{
+   self = [super init];
+   if(self != nil)
+   {
+      outputData = [data retain];
+      [outputData appendBytes:serializerMagic length:sizeof(serializerMagic)];
+      CSEntrySerializerAppendVarint(outputData, CSEntrySerializerVersion);
+   }
+
+   return self;
+}
+
+
+/*
+ * Bytes the value takes up, UTF-8 for strings; NSNotFound for a string UTF-8
+ * can't hold (one with a lone surrogate, say), which comes back as a length
+ * of 0, just like an empty string
+ */
++ (NSUInteger) encodedLengthOfValue:(id)value
+{
+   if([value isKindOfClass:[NSData class]])
+      return [value length];
+
+   NSUInteger length = [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+   if(length == 0 && [value length] > 0)
+      return NSNotFound;
+
+   return length;
+}
+
+
+/*
+ * The record's length comes first, so it's worked out from the values'
+ * lengths before any of them are written; a value which can't be encoded
+ * stops things there, with nothing written
+ */
+- (BOOL) appendEntry:(NSDictionary *)entry
+{
+   NSUInteger valueLengths[CSENTRYSERIALIZER_FIELD_COUNT + 1];
+   uint64_t recordLength = 0;
+   NSUInteger tag;
+   for(tag = 1; tag <= CSENTRYSERIALIZER_FIELD_COUNT; tag++)
+   {
+      id value = [entry objectForKey:fieldKeys[tag]];
+      if(value != nil)
+      {
+         valueLengths[tag] = [CSEntrySerializer encodedLengthOfValue:value];
+         if(valueLengths[tag] == NSNotFound)
+         {
+#if defined(DEBUG)
+            NSLog(@"CSEntrySerializer appendEntry: %@ can't be encoded as UTF-8", fieldKeys[tag]);
+#endif
+            return NO;
+         }
+         recordLength += CSEntrySerializerVarintLength(tag) + CSEntrySerializerVarintLength(valueLengths[tag])
+                         + valueLengths[tag];
+      }
+   }
+
+   CSEntrySerializerAppendVarint(outputData, recordLength);
+   for(tag = 1; tag <= CSENTRYSERIALIZER_FIELD_COUNT; tag++)
+   {
+      id value = [entry objectForKey:fieldKeys[tag]];
+      if(value != nil)
+      {
+         CSEntrySerializerAppendVarint(outputData, tag);
+         CSEntrySerializerAppendVarint(outputData, valueLengths[tag]);
+         [self appendValue:value withLength:valueLengths[tag]];
+      }
+   }
+
+   return YES;
+}
+
+
+/*
+ * Strings are converted right into the output, never into a buffer of their own
+ */
+- (void) appendValue:(id)value withLength:(NSUInteger)valueLength
+{
+   if([value isKindOfClass:[NSData class]])
+   {
+      [outputData appendData:value];
+      return;
+   }
+
+   NSUInteger offset = [outputData length];
+   [outputData setLength:offset + valueLength];
+   NSUInteger usedLength = 0;
+   [value getBytes:(unsigned char *) [outputData mutableBytes] + offset
+         maxLength:valueLength
+        usedLength:&usedLength
+          encoding:NSUTF8StringEncoding
+           options:0
+             range:NSMakeRange(0, [value length])
+    remainingRange:NULL];
+   NSAssert(usedLength == valueLength, @"UTF-8 length changed");
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [outputData release];
+   [super dealloc];
+}
+
+@end
+
+
+static NSUInteger CSEntrySerializerVarintLength(uint64_t value)
+{
+   NSUInteger varintLength = 1;
+   while(value >= 0x80)
+   {
+      value >>= 7;
+      varintLength++;
+   }
+
+   return varintLength;
+}
+
+
+/*
+ * Seven bits at a time, low bits first, the high bit set on all but the last byte
+ */
+static void CSEntrySerializerAppendVarint(NSMutableData *data, uint64_t value)
+{
+   unsigned char varintBytes[CSENTRYSERIALIZER_MAX_VARINT_LENGTH];
+   NSUInteger varintLength = 0;
+   while(value >= 0x80)
+   {
+      varintBytes[varintLength++] = (unsigned char) (value | 0x80);
+      value >>= 7;
+   }
+   varintBytes[varintLength++] = (unsigned char) value;
+   [data appendBytes:varintBytes length:varintLength];
+}
+
+
+static BOOL CSEntrySerializerReadVarint(const unsigned char *bytes, NSUInteger length,
+                                        NSUInteger *offset, uint64_t *value)
+{
+   uint64_t result = 0;
+   NSUInteger shift;
+   for(shift = 0; shift < 7 * CSENTRYSERIALIZER_MAX_VARINT_LENGTH && *offset < length; shift += 7)
+   {
+      unsigned char oneByte = bytes[(*offset)++];
+      result |= (uint64_t) (oneByte & 0x7f) << shift;
+      if((oneByte & 0x80) == 0)
+      {
+         *value = result;
+         return YES;
+      }
+   }
+
+   return NO;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSPrefixIndex.h */
+
+#import <Foundation/Foundation.h>
+
+/*
+ * A read-only index over one column of strings (one per row) for finding the
+ * first row whose string starts with a given prefix, ignoring case, in
+ * O(log n).  The strings are case folded as for search (see CSTextArena) and
+ * sorted, so all those sharing a prefix sit together; a segment tree over
+ * their rows then gives the lowest row among them.  Build a new index
+ * whenever the rows change.
+ */
+@interface CSPrefixIndex : NSObject
+{
+   NSArray *foldedStrings;   // Sorted
+   NSInteger *rows;          // rows[i] is the row foldedStrings[i] came from
+   NSInteger *minRowTree;    // Segment tree over rows, leaves at [count, 2 * count)
+   NSUInteger count;
+}
+
+// The string at index i belongs to row i
+- (id) initWithStrings:(NSArray *)strings;
+
+// First row starting with the given prefix (ignoring case), -1 if none
+- (NSInteger) firstRowWithPrefix:(NSString *)prefix;
+
+/*
+ * Range of sorted indexes whose strings start with the given prefix (ignoring
+ * case), and the row for any of those indexes, for callers wanting to filter
+ * the candidates further
+ */
+- (NSRange) rangeOfIndexesWithPrefix:(NSString *)prefix;
+- (NSInteger) rowAtIndex:(NSUInteger)index;
+
+@end
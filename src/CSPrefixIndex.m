@@ -0,0 +1,239 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSPrefixIndex.m */
+
+#import "CSPrefixIndex.h"
+#import "CSTextArena.h"
+#include <stdlib.h>
+
+// One slot while building, sorted by folded string then row
+typedef struct
+{
+   NSString *folded;
+   NSInteger row;
+} CSPrefixIndexSlot;
+
+static int comparePrefixIndexSlots(const void *slot1, const void *slot2);
+
+
+@interface CSPrefixIndex (InternalMethods)
+- (NSUInteger) firstIndexNotBelow:(NSString *)prefix;
+- (NSUInteger) firstIndexAbove:(NSString *)prefix;
+- (NSInteger) lowestRowInRange:(NSRange)indexRange;
+@end
+
+
+@implementation CSPrefixIndex
+
+/*
+ * Fold and sort the given strings, then build the segment tree of their rows;
+ * they're folded as search folds them (see CSTextArena), and every comparison
+ * in here is a literal one against folded strings, so strings sharing a prefix
+ * always sort together
+ */
+- (id) initWithStrings:(NSArray *)strings
+{
+   self = [super init];
+   if(self != nil)
+   {
+      count = [strings count];
+      CSPrefixIndexSlot *slots = malloc(count * sizeof(CSPrefixIndexSlot) + 1);
+      rows = malloc(count * sizeof(NSInteger) + 1);
+      minRowTree = malloc(2 * count * sizeof(NSInteger) + 1);
+      if(slots == NULL || rows == NULL || minRowTree == NULL)
+      {
+         free(slots);
+         [self release];
+         return nil;
+      }
+
+      NSUInteger index;
+      for(index = 0; index < count; index++)
+      {
+         slots[index].folded = [CSTextArena foldedString:[strings objectAtIndex:index]];
+         slots[index].row = index;
+      }
+      qsort(slots, count, sizeof(CSPrefixIndexSlot), comparePrefixIndexSlots);
+      NSMutableArray *sortedStrings = [[NSMutableArray alloc] initWithCapacity:count];
+      for(index = 0; index < count; index++)
+      {
+         [sortedStrings addObject:slots[index].folded];
+         rows[index] = slots[index].row;
+         minRowTree[count + index] = slots[index].row;
+      }
+      free(slots);
+      foldedStrings = sortedStrings;
+      for(index = count; index > 1; index--)
+         minRowTree[index - 1] = MIN(minRowTree[2 * index - 2], minRowTree[2 * index - 1]);
+   }
+
+   return self;
+}
+
+
+/*
+ * The lowest row starting with the given prefix
+ */
+- (NSInteger) firstRowWithPrefix:(NSString *)prefix
+{
+   return [self lowestRowInRange:[self rangeOfIndexesWithPrefix:prefix]];
+}
+
+
+/*
+ * All indexes from the first not sorting below the prefix to the first
+ * sorting above everything starting with it
+ */
+- (NSRange) rangeOfIndexesWithPrefix:(NSString *)prefix
+{
+   NSString *foldedPrefix = [CSTextArena foldedString:prefix];
+   NSUInteger first = [self firstIndexNotBelow:foldedPrefix];
+   NSUInteger last = [self firstIndexAbove:foldedPrefix];
+   if(last < first)
+      last = first;
+
+   return NSMakeRange(first, last - first);
+}
+
+
+- (NSInteger) rowAtIndex:(NSUInteger)index
+{
+   return rows[index];
+}
+
+
+#pragma mark -
+#pragma mark Searching
+/*
+ * Lower bound: the first index whose string is not less than the prefix
+ */
+- (NSUInteger) firstIndexNotBelow:(NSString *)prefix
+{
+   NSUInteger low = 0;
+   NSUInteger high = count;
+   while(low < high)
+   {
+      NSUInteger middle = low + (high - low) / 2;
+      if([[foldedStrings objectAtIndex:middle] compare:prefix options:NSLiteralSearch] == NSOrderedAscending)
+         low = middle + 1;
+      else
+         high = middle;
+   }
+
+   return low;
+}
+
+
+/*
+ * Upper bound: the first index whose string, cut to the prefix's length,
+ * sorts after the prefix (so it doesn't start with it and neither does anything
+ * after it)
+ */
+- (NSUInteger) firstIndexAbove:(NSString *)prefix
+{
+   NSUInteger prefixLength = [prefix length];
+   NSUInteger low = 0;
+   NSUInteger high = count;
+   while(low < high)
+   {
+      NSUInteger middle = low + (high - low) / 2;
+      NSString *middleString = [foldedStrings objectAtIndex:middle];
+      NSRange headRange = NSMakeRange(0, MIN([middleString length], prefixLength));
+      if([middleString compare:prefix options:NSLiteralSearch range:headRange] == NSOrderedDescending)
+         high = middle;
+      else
+         low = middle + 1;
+   }
+
+   return low;
+}
+
+
+/*
+ * Walk the segment tree for the lowest row among the given indexes, -1 for an
+ * empty range
+ */
+- (NSInteger) lowestRowInRange:(NSRange)indexRange
+{
+   NSInteger lowestRow = -1;
+   NSUInteger left = indexRange.location + count;
+   NSUInteger right = NSMaxRange(indexRange) + count;
+   while(left < right)
+   {
+      if(left & 1)
+      {
+         if(lowestRow < 0 || minRowTree[left] < lowestRow)
+            lowestRow = minRowTree[left];
+         left++;
+      }
+      if(right & 1)
+      {
+         right--;
+         if(lowestRow < 0 || minRowTree[right] < lowestRow)
+            lowestRow = minRowTree[right];
+      }
+      left /= 2;
+      right /= 2;
+   }
+
+   return lowestRow;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [foldedStrings release];
+   free(rows);
+   free(minRowTree);
+   [super dealloc];
+}
+
+@end
+
+
+/*
+ * Order slots by folded string, literally, then by row
+ */
+static int comparePrefixIndexSlots(const void *slot1, const void *slot2)
+{
+   const CSPrefixIndexSlot *first = slot1;
+   const CSPrefixIndexSlot *second = slot2;
+   NSComparisonResult result = [first->folded compare:second->folded options:NSLiteralSearch];
+   if(result == NSOrderedSame)
+      result = (first->row < second->row) ? NSOrderedAscending : NSOrderedDescending;
+
+   return (int) result;
+}
@@ -53,6 +53,10 @@ extern NSString * const CSPrefDictKey_TableAltBackground;
 extern NSString * const CSPrefDictKey_IncludeDefaultCategories;
 extern NSString * const CSPrefDictKey_CurrentSearchKey;
 extern NSString * const CSPrefDictKey_CloseAfterTimeoutSaveOption;
+extern NSString * const CSPrefDictKey_CompressionCodec;
+extern NSString * const CSPrefDictKey_CompressionLevel;
+extern NSString * const CSPrefDictKey_CompressionLongRange;
+extern NSString * const CSPrefDictKey_BackupGenerations;
 
 // Possible values for CloseAfterTimeoutSaveOption preference
 extern const NSInteger CSPrefCloseAfterTimeoutSaveOption_Save;
@@ -73,6 +77,7 @@ extern const NSInteger CSPrefCellSpacingOption_Large;
    IBOutlet NSView *generalView;
    IBOutlet NSView *appearanceView;
    IBOutlet NSView *securityView;
+   NSView *savingView;   // Built in code, not in the nib
 }
 
 // Return the one controller
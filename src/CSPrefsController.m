@@ -33,6 +33,7 @@
 /* CSPrefsController.m */
 
 #import "CSPrefsController.h"
+#import "NSData_compress.h"
 
 
 NSString * const CSPrefDictKey_SaveBackup = @"CSPrefDictKey_SaveBackup";
@@ -52,6 +53,10 @@ NSString * const CSPrefDictKey_TableAltBackground = @"CSPrefDictKey_TableAltBack
 NSString * const CSPrefDictKey_IncludeDefaultCategories = @"CSPrefDictKey_IncludeDefaultCategories";
 NSString * const CSPrefDictKey_CurrentSearchKey = @"CSPrefDictKey_CurrentSearchKey";
 NSString * const CSPrefDictKey_CloseAfterTimeoutSaveOption = @"CSPrefDictKey_CloseAfterTimeoutSaveOption";
+NSString * const CSPrefDictKey_CompressionCodec = @"CSPrefDictKey_CompressionCodec";
+NSString * const CSPrefDictKey_CompressionLevel = @"CSPrefDictKey_CompressionLevel";
+NSString * const CSPrefDictKey_CompressionLongRange = @"CSPrefDictKey_CompressionLongRange";
+NSString * const CSPrefDictKey_BackupGenerations = @"CSPrefDictKey_BackupGenerations";
 
 // Values should match the tag values in IB
 const NSInteger CSPrefCloseAfterTimeoutSaveOption_Save = 0;
@@ -65,11 +70,19 @@ const NSInteger CSPrefCellSpacingOption_Large = 2;
 NSString * const CSPrefsControllerToolbarID_General = @"General";
 NSString * const CSPrefsControllerToolbarID_Appearance = @"Appearance";
 NSString * const CSPrefsControllerToolbarID_Security = @"Security";
+NSString * const CSPrefsControllerToolbarID_Saving = @"Saving";
 
 
 @interface CSPrefsController (InternalMethods)
 - (NSToolbarItem *) createToolbarItemWithID:(NSString *)itemID imageNamed:(NSString *)imageName;
 - (void) setWindowContentToView:(NSView *)newView;
+- (NSView *) createSavingView;
+- (NSTextField *) addLabel:(NSString *)label atY:(CGFloat)y toView:(NSView *)view;
+- (NSTextField *) addNumberFieldFrom:(NSInteger)minimum
+                                  to:(NSInteger)maximum
+                              forKey:(NSString *)key
+                                 atY:(CGFloat)y
+                              toView:(NSView *)view;
 @end
 
 
@@ -110,10 +123,18 @@ static CSPrefsController *sharedPrefsController = nil;
       && timeoutSaveOption != CSPrefCloseAfterTimeoutSaveOption_Ask)
       [userDefaults setInteger:CSPrefCloseAfterTimeoutSaveOption_Save
                         forKey:CSPrefDictKey_CloseAfterTimeoutSaveOption];
+   // -1 is the codec's default; 22 is the highest any codec (zstd) accepts
+   if([userDefaults integerForKey:CSPrefDictKey_CompressionLevel] < -1
+      || [userDefaults integerForKey:CSPrefDictKey_CompressionLevel] > 22)
+      [userDefaults setInteger:-1 forKey:CSPrefDictKey_CompressionLevel];
+   if([userDefaults integerForKey:CSPrefDictKey_BackupGenerations] < 1
+      || [userDefaults integerForKey:CSPrefDictKey_BackupGenerations] > 1000)
+      [userDefaults setInteger:10 forKey:CSPrefDictKey_BackupGenerations];
 
    toolbarItemIDs = [[NSArray alloc] initWithObjects:CSPrefsControllerToolbarID_General,
                                                      CSPrefsControllerToolbarID_Appearance,
                                                      CSPrefsControllerToolbarID_Security,
+                                                     CSPrefsControllerToolbarID_Saving,
                                                      nil];
 }
 
@@ -144,19 +165,25 @@ static CSPrefsController *sharedPrefsController = nil;
                                                       imageNamed:@"mini window ciphsafe"];
    NSToolbarItem *securityItem = [self createToolbarItemWithID:CSPrefsControllerToolbarID_Security
                                                     imageNamed:@"padlock caution behind"];
+   NSToolbarItem *savingItem = [self createToolbarItemWithID:CSPrefsControllerToolbarID_Saving
+                                                  imageNamed:@"CiphSafe"];
    toolbarItems = [[NSDictionary alloc] initWithObjectsAndKeys:
                                            generalItem, CSPrefsControllerToolbarID_General,
                                            appearanceItem, CSPrefsControllerToolbarID_Appearance,
                                            securityItem, CSPrefsControllerToolbarID_Security,
+                                           savingItem, CSPrefsControllerToolbarID_Saving,
                                            nil];
    [generalItem release];
    [appearanceItem release];
    [securityItem release];
+   [savingItem release];
    
+   savingView = [self createSavingView];
    toolbarViews = [[NSDictionary alloc] initWithObjectsAndKeys:
                                            generalView, CSPrefsControllerToolbarID_General,
                                            appearanceView, CSPrefsControllerToolbarID_Appearance,
                                            securityView, CSPrefsControllerToolbarID_Security,
+                                           savingView, CSPrefsControllerToolbarID_Saving,
                                            nil];
    
    NSToolbar *toolbar = [[NSToolbar alloc] initWithIdentifier:@"PreferencesToolbar"];
@@ -237,6 +264,105 @@ static CSPrefsController *sharedPrefsController = nil;
 }
 
 
+#pragma mark -
+#pragma mark Saving Pane
+/*
+ * The saving prefs (compression and backups) came after the nib, so their
+ * pane is put together here, bound to the shared defaults like the others;
+ * the codec menu only lists what this build was compiled with
+ */
+- (NSView *) createSavingView
+{
+   NSView *newView = [[NSView alloc] initWithFrame:NSMakeRect(0, 0, 440, 178)];
+   NSUserDefaultsController *defaultsController = [NSUserDefaultsController sharedUserDefaultsController];
+
+   [self addLabel:NSLocalizedString(@"Compression:", @"") atY:136 toView:newView];
+   NSPopUpButton *codecPopUp = [[NSPopUpButton alloc] initWithFrame:NSMakeRect(190, 130, 140, 26)
+                                                          pullsDown:NO];
+   [codecPopUp addItemsWithTitles:[NSData availableCompressionCodecs]];
+   [codecPopUp bind:@"selectedValue"
+           toObject:defaultsController
+        withKeyPath:[@"values." stringByAppendingString:CSPrefDictKey_CompressionCodec]
+            options:nil];
+   [newView addSubview:codecPopUp];
+   [codecPopUp release];
+
+   [self addLabel:NSLocalizedString(@"Compression level:", @"") atY:104 toView:newView];
+   [self addNumberFieldFrom:-1
+                         to:22
+                     forKey:CSPrefDictKey_CompressionLevel
+                        atY:102
+                     toView:newView];
+
+   NSButton *longRangeBox = [[NSButton alloc] initWithFrame:NSMakeRect(188, 72, 240, 18)];
+   [longRangeBox setButtonType:NSSwitchButton];
+   [longRangeBox setTitle:NSLocalizedString(@"Long range matching (zstd)", @"")];
+   [longRangeBox bind:NSValueBinding
+             toObject:defaultsController
+          withKeyPath:[@"values." stringByAppendingString:CSPrefDictKey_CompressionLongRange]
+              options:nil];
+   [newView addSubview:longRangeBox];
+   [longRangeBox release];
+
+   [self addLabel:NSLocalizedString(@"Backups to keep:", @"") atY:32 toView:newView];
+   [self addNumberFieldFrom:1
+                         to:1000
+                     forKey:CSPrefDictKey_BackupGenerations
+                        atY:30
+                     toView:newView];
+
+   return newView;
+}
+
+
+/*
+ * Right-aligned label ending just left of the controls
+ */
+- (NSTextField *) addLabel:(NSString *)label atY:(CGFloat)y toView:(NSView *)view
+{
+   NSTextField *labelField = [[NSTextField alloc] initWithFrame:NSMakeRect(17, y, 168, 17)];
+   [labelField setStringValue:label];
+   [labelField setAlignment:NSRightTextAlignment];
+   [labelField setEditable:NO];
+   [labelField setSelectable:NO];
+   [labelField setBezeled:NO];
+   [labelField setDrawsBackground:NO];
+   [view addSubview:labelField];
+   [labelField release];
+
+   return labelField;
+}
+
+
+/*
+ * Integer field bound to the given pref, its formatter holding it to the same
+ * range +initialize enforces
+ */
+- (NSTextField *) addNumberFieldFrom:(NSInteger)minimum
+                                  to:(NSInteger)maximum
+                              forKey:(NSString *)key
+                                 atY:(CGFloat)y
+                              toView:(NSView *)view
+{
+   NSNumberFormatter *formatter = [[NSNumberFormatter alloc] init];
+   [formatter setFormatterBehavior:NSNumberFormatterBehavior10_4];
+   [formatter setAllowsFloats:NO];
+   [formatter setMinimum:[NSNumber numberWithInteger:minimum]];
+   [formatter setMaximum:[NSNumber numberWithInteger:maximum]];
+   NSTextField *numberField = [[NSTextField alloc] initWithFrame:NSMakeRect(190, y, 60, 22)];
+   [numberField setFormatter:formatter];
+   [formatter release];
+   [numberField bind:NSValueBinding
+            toObject:[NSUserDefaultsController sharedUserDefaultsController]
+         withKeyPath:[@"values." stringByAppendingString:key]
+             options:nil];
+   [view addSubview:numberField];
+   [numberField release];
+
+   return numberField;
+}
+
+
 #pragma mark -
 #pragma mark Help Display Actions
 /*
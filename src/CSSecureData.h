@@ -0,0 +1,62 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSSecureData.h */
+
+#import <Foundation/Foundation.h>
+
+/*
+ * An NSMutableData whose bytes live in locked (never paged out) memory taken
+ * from a pool shared by all instances; the bytes are zeroed whenever the
+ * buffer is released or outgrown, and the buffer goes back to the pool for
+ * reuse.  Buffers are handed out in power-of-two size classes, small ones
+ * carved out of whole pages.
+ */
+@interface CSSecureData : NSMutableData
+{
+   void *secureBytes;
+   NSUInteger secureLength;
+   NSUInteger secureCapacity;
+}
+
+// Most memory kept in the pool's free lists; anything beyond it is unmapped
++ (void) setPoolLimit:(NSUInteger)newLimit;
++ (NSUInteger) poolLimit;
+
+// Unmap everything sitting in the free lists
++ (void) drainPool;
+
+@end
+
+
+// Zero the given bytes in a way the compiler won't optimize away
+void CSSecureZero(void *bytes, size_t length);
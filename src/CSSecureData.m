@@ -0,0 +1,412 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSSecureData.m */
+
+#import "CSSecureData.h"
+#include <sys/mman.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+// Smallest and largest size classes, as powers of two (64 bytes to 64MB)
+#define CSSECUREDATA_MIN_SHIFT 6
+#define CSSECUREDATA_MAX_SHIFT 26
+#define CSSECUREDATA_CLASS_COUNT (CSSECUREDATA_MAX_SHIFT - CSSECUREDATA_MIN_SHIFT + 1)
+
+// Default for the most memory kept around in the free lists
+static const NSUInteger CSSecureDataDefaultPoolLimit = 16 * 1024 * 1024;
+
+/*
+ * A free buffer, linked through its own (zeroed) bytes
+ */
+typedef struct CSSecureBlock
+{
+   struct CSSecureBlock *next;
+} CSSecureBlock;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static CSSecureBlock *freeLists[ CSSECUREDATA_CLASS_COUNT ];
+static NSUInteger pooledBytes = 0;
+static NSUInteger poolLimit = CSSecureDataDefaultPoolLimit;
+static size_t pageSize = 0;
+
+/*
+ * Calling memset through a volatile pointer keeps the compiler from dropping
+ * the call as a dead store
+ */
+static void *(* volatile CSSecureMemset)(void *, int, size_t) = memset;
+
+void CSSecureZero(void *bytes, size_t length)
+{
+   if(bytes != NULL && length > 0)
+      CSSecureMemset(bytes, 0, length);
+}
+
+
+/*
+ * Map and lock a region; failure to lock (RLIMIT_MEMLOCK, for instance) isn't
+ * fatal, the memory is still zeroed on release
+ */
+static void * CSSecureMapRegion(size_t length)
+{
+   void *region = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+   if(region == MAP_FAILED)
+      return NULL;
+   if(mlock(region, length) != 0)
+   {
+#if defined(DEBUG)
+      NSLog(@"CSSecureData: unable to lock %lu bytes", (unsigned long) length);
+#endif
+   }
+
+   return region;
+}
+
+
+static void CSSecureUnmapRegion(void *region, size_t length)
+{
+   munlock(region, length);
+   munmap(region, length);
+}
+
+
+/*
+ * Size class index for a capacity, or -1 if it's too large to pool
+ */
+static NSInteger CSSecureClassForCapacity(NSUInteger capacity)
+{
+   NSInteger shift = CSSECUREDATA_MIN_SHIFT;
+   while(shift <= CSSECUREDATA_MAX_SHIFT && ((NSUInteger) 1 << shift) < capacity)
+      shift++;
+
+   return (shift <= CSSECUREDATA_MAX_SHIFT ? shift - CSSECUREDATA_MIN_SHIFT : -1);
+}
+
+
+/*
+ * Get a zeroed buffer of at least the given capacity; the actual capacity is
+ * returned through blockCapacity
+ */
+static void * CSSecureAllocate(NSUInteger capacity, NSUInteger *blockCapacity)
+{
+   NSInteger sizeClass = CSSecureClassForCapacity(capacity);
+   if(sizeClass < 0)
+   {
+      // Too large to pool, map it directly, rounded up to whole pages
+      size_t length = (capacity + pageSize - 1) & ~(pageSize - 1);
+      *blockCapacity = length;
+      return CSSecureMapRegion(length);
+   }
+
+   NSUInteger classSize = (NSUInteger) 1 << (sizeClass + CSSECUREDATA_MIN_SHIFT);
+   *blockCapacity = classSize;
+   CSSecureBlock *block = NULL;
+   pthread_mutex_lock(&poolLock);
+   if(freeLists[ sizeClass ] == NULL)
+   {
+      if(classSize < pageSize)
+      {
+         // Carve a whole page into blocks of this class
+         char *page = CSSecureMapRegion(pageSize);
+         if(page != NULL)
+         {
+            size_t offset;
+            for(offset = 0; offset < pageSize; offset += classSize)
+            {
+               CSSecureBlock *newBlock = (CSSecureBlock *) (page + offset);
+               newBlock->next = freeLists[ sizeClass ];
+               freeLists[ sizeClass ] = newBlock;
+            }
+            pooledBytes += pageSize;
+         }
+      }
+      else
+      {
+         pthread_mutex_unlock(&poolLock);
+         return CSSecureMapRegion(classSize);
+      }
+   }
+   block = freeLists[ sizeClass ];
+   if(block != NULL)
+   {
+      freeLists[ sizeClass ] = block->next;
+      block->next = NULL;
+      pooledBytes -= classSize;
+   }
+   pthread_mutex_unlock(&poolLock);
+
+   return block;
+}
+
+
+/*
+ * Zero a buffer and return it to the pool, or unmap it if it's too large or the
+ * pool is full; blocks carved from pages always go back on their free list.
+ * Bytes past usedLength are known to be zero already, so a large buffer which
+ * was barely used doesn't get touched page by page.
+ */
+static void CSSecureRelease(void *bytes, NSUInteger usedLength, NSUInteger blockCapacity)
+{
+   if(bytes == NULL)
+      return;
+
+   CSSecureZero(bytes, MAX(usedLength, sizeof(CSSecureBlock)));
+   NSInteger sizeClass = CSSecureClassForCapacity(blockCapacity);
+   if(sizeClass >= 0 && ((NSUInteger) 1 << (sizeClass + CSSECUREDATA_MIN_SHIFT)) != blockCapacity)
+      sizeClass = -1;
+   if(sizeClass < 0)
+   {
+      CSSecureUnmapRegion(bytes, blockCapacity);
+      return;
+   }
+
+   pthread_mutex_lock(&poolLock);
+   if(blockCapacity < pageSize || pooledBytes + blockCapacity <= poolLimit)
+   {
+      CSSecureBlock *block = bytes;
+      block->next = freeLists[ sizeClass ];
+      freeLists[ sizeClass ] = block;
+      pooledBytes += blockCapacity;
+      bytes = NULL;
+   }
+   pthread_mutex_unlock(&poolLock);
+   if(bytes != NULL)
+      CSSecureUnmapRegion(bytes, blockCapacity);
+}
+
+
+@interface CSSecureData (InternalMethods)
+- (BOOL) ensureCapacity:(NSUInteger)capacity;
+@end
+
+
+@implementation CSSecureData
+
++ (void) initialize
+{
+   if(self == [CSSecureData class] && pageSize == 0)
+      pageSize = (size_t) getpagesize();
+}
+
+
+#pragma mark -
+#pragma mark Pool Management
++ (void) setPoolLimit:(NSUInteger)newLimit
+{
+   pthread_mutex_lock(&poolLock);
+   poolLimit = newLimit;
+   pthread_mutex_unlock(&poolLock);
+}
+
+
++ (NSUInteger) poolLimit
+{
+   return poolLimit;
+}
+
+
+/*
+ * Unmap the page-sized and larger free blocks; blocks carved from pages stay,
+ * as their pages may be partly in use
+ */
++ (void) drainPool
+{
+   pthread_mutex_lock(&poolLock);
+   NSInteger sizeClass;
+   for(sizeClass = 0; sizeClass < CSSECUREDATA_CLASS_COUNT; sizeClass++)
+   {
+      NSUInteger classSize = (NSUInteger) 1 << (sizeClass + CSSECUREDATA_MIN_SHIFT);
+      if(classSize < pageSize)
+         continue;
+      while(freeLists[ sizeClass ] != NULL)
+      {
+         CSSecureBlock *block = freeLists[ sizeClass ];
+         freeLists[ sizeClass ] = block->next;
+         pooledBytes -= classSize;
+         CSSecureUnmapRegion(block, classSize);
+      }
+   }
+   pthread_mutex_unlock(&poolLock);
+}
+
+
+#pragma mark -
+#pragma mark Initialization
+- (id) initWithCapacity:(NSUInteger)capacity
+{
+   self = [super init];
+   if(self != nil)
+   {
+      secureBytes = NULL;
+      secureLength = 0;
+      secureCapacity = 0;
+      if(![self ensureCapacity:(capacity > 0 ? capacity : 1)])
+      {
+         [self release];
+         self = nil;
+      }
+   }
+
+   return self;
+}
+
+
+- (id) initWithLength:(NSUInteger)length
+{
+   self = [self initWithCapacity:length];
+   if(self != nil)
+      secureLength = length;
+
+   return self;
+}
+
+
+- (id) init
+{
+   return [self initWithCapacity:0];
+}
+
+
+- (id) initWithBytes:(const void *)bytes length:(NSUInteger)length
+{
+   self = [self initWithLength:length];
+   if(self != nil && length > 0)
+      memcpy(secureBytes, bytes, length);
+
+   return self;
+}
+
+
+- (id) initWithData:(NSData *)data
+{
+   return [self initWithBytes:[data bytes] length:[data length]];
+}
+
+
+/*
+ * Copies stay in secure memory too
+ */
+- (id) copyWithZone:(NSZone *)zone
+{
+   return [[CSSecureData allocWithZone:zone] initWithData:self];
+}
+
+
+- (id) mutableCopyWithZone:(NSZone *)zone
+{
+   return [[CSSecureData allocWithZone:zone] initWithData:self];
+}
+
+
+/*
+ * Archive as plain data; anything archived has left secure memory anyway
+ */
+- (Class) classForCoder
+{
+   return [NSMutableData class];
+}
+
+
+#pragma mark -
+#pragma mark Primitives
+- (NSUInteger) length
+{
+   return secureLength;
+}
+
+
+- (const void *) bytes
+{
+   return secureBytes;
+}
+
+
+- (void *) mutableBytes
+{
+   return secureBytes;
+}
+
+
+/*
+ * Growing past the current buffer moves the bytes to the next size class up and
+ * clears the old buffer; shrinking clears the bytes dropped off the end
+ */
+- (void) setLength:(NSUInteger)length
+{
+   if(length > secureLength)
+   {
+      if(![self ensureCapacity:length])
+         [NSException raise:NSMallocException
+                     format:@"CSSecureData: unable to allocate %lu bytes", (unsigned long) length];
+   }
+   else
+      CSSecureZero((char *) secureBytes + length, secureLength - length);
+   secureLength = length;
+}
+
+
+/*
+ * Make sure the buffer holds at least the given number of bytes; everything past
+ * secureLength is always kept zeroed
+ */
+- (BOOL) ensureCapacity:(NSUInteger)capacity
+{
+   if(capacity <= secureCapacity)
+      return YES;
+
+   NSUInteger newCapacity;
+   void *newBytes = CSSecureAllocate(capacity, &newCapacity);
+   if(newBytes == NULL)
+      return NO;
+   if(secureBytes != NULL)
+   {
+      memcpy(newBytes, secureBytes, secureLength);
+      CSSecureRelease(secureBytes, secureLength, secureCapacity);
+   }
+   secureBytes = newBytes;
+   secureCapacity = newCapacity;
+
+   return YES;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   CSSecureRelease(secureBytes, secureLength, secureCapacity);
+   [super dealloc];
+}
+
+@end
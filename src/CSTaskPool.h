@@ -0,0 +1,91 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSTaskPool.h */
+
+#import <Foundation/Foundation.h>
+#include <pthread.h>
+
+/*
+ * Work on the items [start, end) of a range; worker is this participant's
+ * number, below the pool's workerCount, for keeping results apart without
+ * locking.  Runs on any thread, inside its own autorelease pool, and must not
+ * raise.
+ */
+typedef void (*CSTaskPoolFunction)(NSUInteger start, NSUInteger end, NSUInteger worker, void *context);
+
+// One participant's share of the range being worked on, stolen from when idle
+typedef struct
+{
+   pthread_mutex_t lock;
+   NSUInteger next;
+   NSUInteger end;
+} CSTaskPoolShare;
+
+/*
+ * A thread for each processor, kept around between jobs, which split a range
+ * of items among themselves and the calling thread: each starts on an even
+ * share, taking grainSize items at a time, and once its own share is done
+ * takes half of whatever is left of the biggest share still going.  One job
+ * runs at a time; a job started from within a job just runs on the calling
+ * thread.
+ */
+@interface CSTaskPool : NSObject
+{
+   NSUInteger workerCount;   // Including the calling thread
+   BOOL threadsStarted;
+   pthread_mutex_t jobLock;
+   pthread_mutex_t stateLock;
+   pthread_cond_t workCondition;
+   pthread_cond_t doneCondition;
+   NSUInteger jobGeneration;
+   NSUInteger workersBusy;
+   CSTaskPoolFunction jobFunction;
+   void *jobContext;
+   NSUInteger jobGrainSize;
+   CSTaskPoolShare *shares;
+}
+
+// The pool shared by the whole application, one worker per active processor
++ (CSTaskPool *) sharedPool;
+
+- (id) initWithWorkerCount:(NSUInteger)count;
+
+- (NSUInteger) workerCount;
+
+// Run the function over the range, returning once every item is done
+- (void) applyFunction:(CSTaskPoolFunction)function
+               toRange:(NSRange)range
+             grainSize:(NSUInteger)grainSize
+               context:(void *)context;
+
+@end
@@ -0,0 +1,304 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSTaskPool.m */
+
+#import "CSTaskPool.h"
+#include <stdlib.h>
+
+// Most workers a pool will have, however many processors there are
+static const NSUInteger CSTaskPoolMaxWorkers = 64;
+
+static CSTaskPool *sharedPool = nil;
+
+// Set on a thread while it's taking part in a job, so a job within a job can tell
+static pthread_key_t jobThreadKey;
+
+
+@interface CSTaskPool (InternalMethods)
+- (void) startThreads;
+- (void) workerThread:(NSNumber *)workerNumber;
+- (void) workAsWorker:(NSUInteger)worker;
+- (BOOL) takeItemsForWorker:(NSUInteger)worker start:(NSUInteger *)start end:(NSUInteger *)end;
+@end
+
+
+@implementation CSTaskPool
+
++ (void) initialize
+{
+   if(self == [CSTaskPool class])
+   {
+      pthread_key_create(&jobThreadKey, NULL);
+      sharedPool = [[CSTaskPool alloc] initWithWorkerCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+   }
+}
+
+
++ (CSTaskPool *) sharedPool
+{
+   return sharedPool;
+}
+
+
+/*
+ * The threads aren't started until the first job that needs them
+ */
+- (id) initWithWorkerCount:(NSUInteger)count
+{
+   self = [super init];
+   if(self != nil)
+   {
+      workerCount = MAX(MIN(count, CSTaskPoolMaxWorkers), 1);
+      shares = calloc(workerCount, sizeof(CSTaskPoolShare));
+      if(shares == NULL)
+      {
+         [self release];
+         return nil;
+      }
+      NSUInteger worker;
+      for(worker = 0; worker < workerCount; worker++)
+         pthread_mutex_init(&shares[worker].lock, NULL);
+      threadsStarted = NO;
+      pthread_mutex_init(&jobLock, NULL);
+      pthread_mutex_init(&stateLock, NULL);
+      pthread_cond_init(&workCondition, NULL);
+      pthread_cond_init(&doneCondition, NULL);
+      jobGeneration = 0;
+      workersBusy = 0;
+   }
+
+   return self;
+}
+
+
+- (NSUInteger) workerCount
+{
+   return workerCount;
+}
+
+
+/*
+ * Hand out even shares, wake the threads, and work alongside them; ranges no
+ * bigger than a grain aren't worth waking anyone for
+ */
+- (void) applyFunction:(CSTaskPoolFunction)function
+               toRange:(NSRange)range
+             grainSize:(NSUInteger)grainSize
+               context:(void *)context
+{
+   if(range.length == 0)
+      return;
+   if(grainSize == 0)
+      grainSize = 1;
+
+   if(workerCount == 1 || range.length <= grainSize || pthread_getspecific(jobThreadKey) != NULL)
+   {
+      NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+      function(range.location, NSMaxRange(range), 0, context);
+      [pool release];
+      return;
+   }
+
+   pthread_mutex_lock(&jobLock);
+   pthread_setspecific(jobThreadKey, self);
+   if(!threadsStarted)
+      [self startThreads];
+
+   // The workers are all waiting on the next job, so the shares are ours to set
+   NSUInteger next = range.location;
+   NSUInteger worker;
+   for(worker = 0; worker < workerCount; worker++)
+   {
+      shares[worker].next = next;
+      next += range.length / workerCount + (worker < range.length % workerCount ? 1 : 0);
+      shares[worker].end = next;
+   }
+
+   pthread_mutex_lock(&stateLock);
+   jobFunction = function;
+   jobContext = context;
+   jobGrainSize = grainSize;
+   workersBusy = workerCount - 1;
+   jobGeneration++;
+   pthread_cond_broadcast(&workCondition);
+   pthread_mutex_unlock(&stateLock);
+
+   [self workAsWorker:0];
+
+   pthread_mutex_lock(&stateLock);
+   while(workersBusy > 0)
+      pthread_cond_wait(&doneCondition, &stateLock);
+   pthread_mutex_unlock(&stateLock);
+   pthread_setspecific(jobThreadKey, NULL);
+   pthread_mutex_unlock(&jobLock);
+}
+
+
+#pragma mark -
+#pragma mark Workers
+/*
+ * Worker 0 is whichever thread started the job; NSThread (rather than bare
+ * pthreads) so Cocoa knows it's multithreaded.  The threads retain the pool,
+ * so once started it's around for good.
+ */
+- (void) startThreads
+{
+   NSUInteger worker;
+   for(worker = 1; worker < workerCount; worker++)
+      [NSThread detachNewThreadSelector:@selector(workerThread:)
+                               toTarget:self
+                             withObject:[NSNumber numberWithUnsignedInteger:worker]];
+   threadsStarted = YES;
+}
+
+
+/*
+ * Wait for a job, do what of it can be had, check in, and wait again; threads
+ * start before the first job, so the first generation to wait past is zero
+ */
+- (void) workerThread:(NSNumber *)workerNumber
+{
+   NSUInteger worker = [workerNumber unsignedIntegerValue];
+   NSUInteger seenGeneration = 0;
+   pthread_setspecific(jobThreadKey, self);
+   while(YES)
+   {
+      pthread_mutex_lock(&stateLock);
+      while(jobGeneration == seenGeneration)
+         pthread_cond_wait(&workCondition, &stateLock);
+      seenGeneration = jobGeneration;
+      pthread_mutex_unlock(&stateLock);
+
+      [self workAsWorker:worker];
+
+      pthread_mutex_lock(&stateLock);
+      workersBusy--;
+      if(workersBusy == 0)
+         pthread_cond_signal(&doneCondition);
+      pthread_mutex_unlock(&stateLock);
+   }
+}
+
+
+- (void) workAsWorker:(NSUInteger)worker
+{
+   NSUInteger start, end;
+   while([self takeItemsForWorker:worker start:&start end:&end])
+   {
+      NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+      jobFunction(start, end, worker, jobContext);
+      [pool release];
+   }
+}
+
+
+/*
+ * Take the next grain from the worker's own share; with that gone, steal the
+ * back half of the biggest share left (all of it, if no more than a grain)
+ * and carry on from there.  NO once there's nothing left anywhere.  Only one
+ * share's lock is ever held at a time.
+ */
+- (BOOL) takeItemsForWorker:(NSUInteger)worker start:(NSUInteger *)start end:(NSUInteger *)end
+{
+   CSTaskPoolShare *ownShare = &shares[worker];
+   while(YES)
+   {
+      pthread_mutex_lock(&ownShare->lock);
+      NSUInteger left = ownShare->end - ownShare->next;
+      if(left > 0)
+      {
+         *start = ownShare->next;
+         *end = (left > jobGrainSize ? ownShare->next + jobGrainSize : ownShare->end);
+         ownShare->next = *end;
+         pthread_mutex_unlock(&ownShare->lock);
+         return YES;
+      }
+      pthread_mutex_unlock(&ownShare->lock);
+
+      NSUInteger victim = worker;
+      NSUInteger mostLeft = 0;
+      NSUInteger other;
+      for(other = 0; other < workerCount; other++)
+      {
+         if(other == worker)
+            continue;
+         pthread_mutex_lock(&shares[other].lock);
+         left = shares[other].end - shares[other].next;
+         pthread_mutex_unlock(&shares[other].lock);
+         if(left > mostLeft)
+         {
+            victim = other;
+            mostLeft = left;
+         }
+      }
+      if(victim == worker)
+         return NO;
+
+      // It may have shrunk since the look above, possibly to nothing, in which case look again
+      CSTaskPoolShare *victimShare = &shares[victim];
+      pthread_mutex_lock(&victimShare->lock);
+      left = victimShare->end - victimShare->next;
+      NSUInteger stolenEnd = victimShare->end;
+      NSUInteger stolenStart = (left > jobGrainSize ? stolenEnd - left / 2 : victimShare->next);
+      victimShare->end = stolenStart;
+      pthread_mutex_unlock(&victimShare->lock);
+
+      pthread_mutex_lock(&ownShare->lock);
+      ownShare->next = stolenStart;
+      ownShare->end = stolenEnd;
+      pthread_mutex_unlock(&ownShare->lock);
+   }
+}
+
+
+/*
+ * Cleanup; only reached by a pool whose threads never started (or which
+ * couldn't be set up)
+ */
+- (void) dealloc
+{
+   if(shares != NULL)
+   {
+      NSUInteger worker;
+      for(worker = 0; worker < workerCount; worker++)
+         pthread_mutex_destroy(&shares[worker].lock);
+      free(shares);
+      pthread_mutex_destroy(&jobLock);
+      pthread_mutex_destroy(&stateLock);
+      pthread_cond_destroy(&workCondition);
+      pthread_cond_destroy(&doneCondition);
+   }
+   [super dealloc];
+}
+
+@end
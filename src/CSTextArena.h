@@ -0,0 +1,69 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSTextArena.h */
+
+#import <Foundation/Foundation.h>
+
+@class CSSecureData;
+
+/*
+ * All the strings of one column (or of whole entries), case folded and packed
+ * end to end as UTF-8 in a single buffer, each followed by a NUL, with the
+ * offset of each row's string kept alongside.  Searching it is a straight
+ * byte scan: a filter on the first and last bytes of the search string (16
+ * positions at a time with SSE2), then a check of the candidates, with big
+ * arenas split across the processors (see CSTaskPool).  Build a new arena
+ * whenever the rows change.
+ */
+@interface CSTextArena : NSObject
+{
+   CSSecureData *text;
+   NSUInteger *rowOffsets;   // rowOffsets[row] is where the row starts; one extra for the end
+   NSUInteger rowCount;
+}
+
+// The form in which strings are kept and compared
++ (NSString *) foldedString:(NSString *)string;
+
+// The string at index i belongs to row i
+- (id) initWithStrings:(NSArray *)strings;
+
+- (NSUInteger) rowCount;
+
+/*
+ * Rows containing the given string, ignoring case; nil if the string can't be
+ * searched for in the arena (it holds a NUL)
+ */
+- (NSIndexSet *) rowsContainingString:(NSString *)findString;
+
+@end
@@ -0,0 +1,308 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSTextArena.m */
+
+#import "CSTextArena.h"
+#import "CSSecureData.h"
+#import "CSTaskPool.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Arenas smaller than this are scanned on the calling thread alone
+static const NSUInteger CSTextArenaParallelThreshold = 1024 * 1024;
+
+// Roughly how many bytes of the arena each piece of a split scan covers
+static const NSUInteger CSTextArenaScanGrainBytes = 64 * 1024;
+
+// Rows folded per piece when there are enough strings to fold them across the processors
+static const NSUInteger CSTextArenaFoldGrainRows = 512;
+
+/*
+ * A scan for the needle, setting rowMatches[row] for each row containing it
+ */
+typedef struct
+{
+   const unsigned char *text;
+   const NSUInteger *rowOffsets;
+   const unsigned char *needle;
+   size_t needleLength;
+   unsigned char *rowMatches;
+} CSTextArenaScan;
+
+// Folding strings[row] into foldedStrings[row], each retained
+typedef struct
+{
+   NSArray *strings;
+   NSString **foldedStrings;
+} CSTextArenaFold;
+
+static size_t CSTextArenaFind(const unsigned char *haystack, size_t haystackLength,
+                              const unsigned char *needle, size_t needleLength);
+static void CSTextArenaScanRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *scanInfo);
+static void CSTextArenaFoldRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *foldInfo);
+
+
+@implementation CSTextArena
+
+/*
+ * Case fold the given string, after composing characters so the same text
+ * always ends up as the same bytes
+ */
++ (NSString *) foldedString:(NSString *)string
+{
+   if(string == nil)
+      return @"";
+
+   return [[string precomposedStringWithCanonicalMapping] stringByFoldingWithOptions:NSCaseInsensitiveSearch
+                                                                              locale:nil];
+}
+
+
+/*
+ * Fold the given strings (across the processors, when there are enough) and
+ * pack them into the arena; the buffer is sized up front and the strings
+ * converted straight into it, so no other copies of the UTF-8 are made
+ *
+ * XXX The arena holds whatever columns it was built from, passwords included
+ * for an arena over whole entries, hence the secure buffer
+ */
+- (id) initWithStrings:(NSArray *)strings
+{
+   self = [super init];
+   if(self != nil)
+   {
+      rowCount = [strings count];
+      rowOffsets = malloc((rowCount + 1) * sizeof(NSUInteger));
+      if(rowOffsets == NULL)
+      {
+         [self release];
+         return nil;
+      }
+
+      NSMutableData *foldedStringData = [NSMutableData dataWithLength:rowCount * sizeof(NSString *)];
+      NSString **foldedStrings = [foldedStringData mutableBytes];
+      CSTextArenaFold fold = { strings, foldedStrings };
+      [[CSTaskPool sharedPool] applyFunction:CSTextArenaFoldRows
+                                     toRange:NSMakeRange(0, rowCount)
+                                   grainSize:CSTextArenaFoldGrainRows
+                                     context:&fold];
+      NSUInteger textLength = 0;
+      NSUInteger row;
+      for(row = 0; row < rowCount; row++)
+      {
+         rowOffsets[row] = textLength;
+         textLength += [foldedStrings[row] lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 1;
+      }
+      rowOffsets[rowCount] = textLength;
+
+      text = [[CSSecureData alloc] initWithLength:textLength];
+      unsigned char *textBytes = [text mutableBytes];
+      for(row = 0; row < rowCount; row++)
+      {
+         NSString *folded = foldedStrings[row];
+         NSUInteger usedLength = 0;
+         [folded getBytes:textBytes + rowOffsets[row]
+                maxLength:rowOffsets[row + 1] - rowOffsets[row] - 1
+               usedLength:&usedLength
+                 encoding:NSUTF8StringEncoding
+                  options:0
+                    range:NSMakeRange(0, [folded length])
+           remainingRange:NULL];
+         // The buffer came zeroed, so the NUL after each string is already there
+         [folded release];
+      }
+   }
+
+   return self;
+}
+
+
+- (NSUInteger) rowCount
+{
+   return rowCount;
+}
+
+
+/*
+ * Scan for the folded string, splitting the rows across the processors (see
+ * CSTaskPool) when the arena is big enough to be worth it; each piece covers
+ * about CSTextArenaScanGrainBytes, going by the average row
+ */
+- (NSIndexSet *) rowsContainingString:(NSString *)findString
+{
+   NSString *foldedFind = [CSTextArena foldedString:findString];
+   NSUInteger needleLength = [foldedFind lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+   CSSecureData *needle = [CSSecureData dataWithLength:needleLength];
+   [foldedFind getBytes:[needle mutableBytes]
+              maxLength:needleLength
+             usedLength:NULL
+               encoding:NSUTF8StringEncoding
+                options:0
+                  range:NSMakeRange(0, [foldedFind length])
+         remainingRange:NULL];
+   if(memchr([needle bytes], 0, needleLength) != NULL)
+      return nil;
+
+   NSMutableIndexSet *matchingRows = [NSMutableIndexSet indexSet];
+   if(needleLength == 0 || rowCount == 0)
+      return matchingRows;
+
+   NSMutableData *rowMatches = [NSMutableData dataWithLength:rowCount];
+   CSTextArenaScan scan = { [text bytes], rowOffsets, [needle bytes], needleLength, [rowMatches mutableBytes] };
+   NSUInteger textLength = [text length];
+   if(textLength >= CSTextArenaParallelThreshold)
+      [[CSTaskPool sharedPool] applyFunction:CSTextArenaScanRows
+                                     toRange:NSMakeRange(0, rowCount)
+                                   grainSize:MAX(rowCount / (textLength / CSTextArenaScanGrainBytes), 1)
+                                     context:&scan];
+   else
+      CSTextArenaScanRows(0, rowCount, 0, &scan);
+
+   const unsigned char *matchBytes = [rowMatches bytes];
+   NSUInteger index;
+   for(index = 0; index < rowCount; index++)
+   {
+      if(matchBytes[index])
+         [matchingRows addIndex:index];
+   }
+
+   return matchingRows;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [text release];
+   free(rowOffsets);
+   [super dealloc];
+}
+
+@end
+
+
+/*
+ * Return the offset of the first occurrence of the needle in the haystack, or
+ * haystackLength if there is none; needleLength must be at least one
+ */
+static size_t CSTextArenaFind(const unsigned char *haystack, size_t haystackLength,
+                              const unsigned char *needle, size_t needleLength)
+{
+   if(needleLength > haystackLength)
+      return haystackLength;
+
+   size_t lastStart = haystackLength - needleLength;
+   size_t position = 0;
+#if defined(__SSE2__)
+   /*
+    * Compare 16 starting positions at once against the needle's first byte,
+    * and the 16 matching end positions against its last, only checking the
+    * whole needle where both agree
+    */
+   __m128i firstByte = _mm_set1_epi8((char) needle[0]);
+   __m128i lastByte = _mm_set1_epi8((char) needle[needleLength - 1]);
+   while(position + 16 <= lastStart + 1)
+   {
+      __m128i startBlock = _mm_loadu_si128((const __m128i *) (haystack + position));
+      __m128i endBlock = _mm_loadu_si128((const __m128i *) (haystack + position + needleLength - 1));
+      unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(startBlock, firstByte),
+                                                                _mm_cmpeq_epi8(endBlock, lastByte)));
+      while(candidates != 0)
+      {
+         unsigned int bit = __builtin_ctz(candidates);
+         if(memcmp(haystack + position + bit, needle, needleLength) == 0)
+            return position + bit;
+         candidates &= candidates - 1;
+      }
+      position += 16;
+   }
+#endif
+   // Whatever is left (or everything, without SSE2)
+   while(position <= lastStart)
+   {
+      const unsigned char *candidate = memchr(haystack + position, needle[0], lastStart - position + 1);
+      if(candidate == NULL)
+         break;
+      position = candidate - haystack;
+      if(haystack[position + needleLength - 1] == needle[needleLength - 1]
+         && memcmp(haystack + position, needle, needleLength) == 0)
+         return position;
+      position++;
+   }
+
+   return haystackLength;
+}
+
+
+/*
+ * Scan the rows [firstRow, endRow); a match can't run across rows since the
+ * needle holds no NUL, and once a row matches the scan moves on to the next row
+ */
+static void CSTextArenaScanRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *scanInfo)
+{
+   CSTextArenaScan *scan = scanInfo;
+   NSUInteger position = scan->rowOffsets[firstRow];
+   NSUInteger end = scan->rowOffsets[endRow];
+   NSUInteger row = firstRow;
+   while(position < end)
+   {
+      size_t found = CSTextArenaFind(scan->text + position, end - position, scan->needle, scan->needleLength);
+      if(found == end - position)
+         break;
+      position += found;
+      // Rows are visited in order, so the matching row is just ahead
+      while(scan->rowOffsets[row + 1] <= position)
+         row++;
+      scan->rowMatches[row] = 1;
+      row++;
+      position = scan->rowOffsets[row];
+   }
+}
+
+
+/*
+ * Fold the strings for the rows [firstRow, endRow), keeping each folded copy
+ * for the arena to release once it's packed
+ */
+static void CSTextArenaFoldRows(NSUInteger firstRow, NSUInteger endRow, NSUInteger worker, void *foldInfo)
+{
+   CSTextArenaFold *fold = foldInfo;
+   NSUInteger row;
+   for(row = firstRow; row < endRow; row++)
+      fold->foldedStrings[row] = [[CSTextArena foldedString:[fold->strings objectAtIndex:row]] retain];
+}
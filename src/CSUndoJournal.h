@@ -0,0 +1,110 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSUndoJournal.h */
+
+#import <Foundation/Foundation.h>
+
+// Types of records kept in the journal
+extern const NSInteger CSUndoJournalRecordType_Add;
+extern const NSInteger CSUndoJournalRecordType_Change;
+extern const NSInteger CSUndoJournalRecordType_Delete;
+
+// Default cap on the memory held by a journal
+extern const NSUInteger CSUndoJournalDefaultByteLimit;
+
+
+/*
+ * One undoable model mutation; for adds, only the names are kept, for changes,
+ * only the old values of fields which actually changed, and for deletes, the
+ * complete entries
+ */
+@interface CSUndoJournalRecord : NSObject
+{
+   NSInteger recordType;
+   NSNumber *recordID;
+   NSString *entryName;
+   id payload;
+   NSUInteger byteCost;
+   BOOL sealed;
+}
+
+- (NSInteger) recordType;
+- (NSNumber *) recordID;
+
+// For change records, the current name of the changed entry
+- (NSString *) entryName;
+
+/*
+ * Add: NSArray of names
+ * Change: NSDictionary of old values, keyed by CSDocModelKey_*
+ * Delete: NSArray of entry dictionaries
+ */
+- (id) payload;
+
+@end
+
+
+@interface CSUndoJournal : NSObject
+{
+   NSMutableArray *records;   // Oldest first
+   NSUInteger nextRecordID;
+   NSUInteger byteCount;
+   NSUInteger byteLimit;
+}
+
+// Memory accounting
+- (void) setByteLimit:(NSUInteger)newLimit;
+- (NSUInteger) byteLimit;
+- (NSUInteger) byteCount;
+
+/*
+ * Recording; each returns the ID to hand to the undo manager, or nil when
+ * nothing new needs to be registered (no change, or coalesced into the
+ * previous record)
+ */
+- (NSNumber *) recordAddOfNames:(NSArray *)names;
+- (NSNumber *) recordChangeOfEntry:(NSDictionary *)entry
+                        withValues:(NSDictionary *)newValues
+                      canCoalesce:(BOOL)canCoalesce;
+- (NSNumber *) recordDeleteOfEntries:(NSArray *)entries;
+
+// Stop coalescing into any existing records (ie, the undo group closed)
+- (void) sealRecords;
+
+// Remove and return the record with the given ID, nil if it has been dropped
+- (CSUndoJournalRecord *) takeRecordWithID:(NSNumber *)recordID;
+
+// Drop (and clear) everything
+- (void) removeAllRecords;
+
+@end
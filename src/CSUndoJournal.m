@@ -0,0 +1,477 @@
+/*
+ * Copyright  2026, Bryan L Blackburn.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the names Bryan L Blackburn, Withay.com, nor the names of
+ *    any contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRYAN L BLACKBURN ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/* CSUndoJournal.m */
+
+#import "CSUndoJournal.h"
+#import "CSDocModel.h"
+
+const NSInteger CSUndoJournalRecordType_Add = 0;
+const NSInteger CSUndoJournalRecordType_Change = 1;
+const NSInteger CSUndoJournalRecordType_Delete = 2;
+
+const NSUInteger CSUndoJournalDefaultByteLimit = 8 * 1024 * 1024;
+
+// Rough bookkeeping overhead for each record and for each value in a record
+static const NSUInteger CSUndoJournalRecordOverhead = 64;
+static const NSUInteger CSUndoJournalValueOverhead = 32;
+
+
+@interface CSUndoJournalRecord (InternalMethods)
+- (id) initWithType:(NSInteger)type recordID:(NSNumber *)newID payload:(id)newPayload;
+- (void) setEntryName:(NSString *)newName;
+- (NSUInteger) byteCost;
+- (void) setByteCost:(NSUInteger)newCost;
+- (BOOL) isSealed;
+- (void) seal;
+- (void) clearPayload;
+@end
+
+
+@interface CSUndoJournal (InternalMethods)
+- (NSNumber *) appendRecordOfType:(NSInteger)type payload:(id)payload entryName:(NSString *)name;
+- (void) trimToByteLimit;
+@end
+
+
+/*
+ * Approximate memory used by one value held in a record
+ */
+static NSUInteger CSUndoJournalCostOfValue(id value)
+{
+   NSUInteger cost = CSUndoJournalValueOverhead;
+   if([value isKindOfClass:[NSString class]])
+      cost += [value length] * sizeof(unichar);
+   else if([value isKindOfClass:[NSData class]])
+      cost += [value length];
+
+   return cost;
+}
+
+
+/*
+ * Copy a value for keeping in a record; data gets copied into a mutable buffer
+ * we own, so it can be cleared once the record goes away
+ */
+static id CSUndoJournalCopyOfValue(id value)
+{
+   if([value isKindOfClass:[NSData class]])
+      return [NSMutableData dataWithData:value];
+   else if(value != nil)
+      return [[value copy] autorelease];
+   else
+      return @"";
+}
+
+
+/*
+ * Clear out a value held by a dropped record
+ *
+ * XXX Strings can't be cleared (see the note in -[CSDocModel dealloc]), only
+ * data we copied ourselves
+ */
+static void CSUndoJournalClearValue(id value)
+{
+   if([value isKindOfClass:[NSMutableData class]])
+      [value resetBytesInRange:NSMakeRange(0, [value length])];
+}
+
+
+@implementation CSUndoJournalRecord
+
+/*
+ * Setup the record, with a payload appropriate for the type
+ */
+- (id) initWithType:(NSInteger)type recordID:(NSNumber *)newID payload:(id)newPayload
+{
+   self = [super init];
+   if(self != nil)
+   {
+      recordType = type;
+      recordID = [newID retain];
+      payload = [newPayload retain];
+      entryName = nil;
+      byteCost = 0;
+      sealed = NO;
+   }
+
+   return self;
+}
+
+
+- (NSInteger) recordType
+{
+   return recordType;
+}
+
+
+- (NSNumber *) recordID
+{
+   return recordID;
+}
+
+
+- (NSString *) entryName
+{
+   return entryName;
+}
+
+
+- (void) setEntryName:(NSString *)newName
+{
+   if(newName != entryName)
+   {
+      [entryName release];
+      entryName = [newName copy];
+   }
+}
+
+
+- (id) payload
+{
+   return payload;
+}
+
+
+- (NSUInteger) byteCost
+{
+   return byteCost;
+}
+
+
+- (void) setByteCost:(NSUInteger)newCost
+{
+   byteCost = newCost;
+}
+
+
+- (BOOL) isSealed
+{
+   return sealed;
+}
+
+
+- (void) seal
+{
+   sealed = YES;
+}
+
+
+/*
+ * Clear whatever we can in the payload; used when the record is dropped without
+ * ever being applied
+ */
+- (void) clearPayload
+{
+   if(recordType == CSUndoJournalRecordType_Change)
+      CSUndoJournalClearValue([payload objectForKey:CSDocModelKey_Notes]);
+   else if(recordType == CSUndoJournalRecordType_Delete)
+   {
+      NSEnumerator *entryEnumerator = [payload objectEnumerator];
+      id oneEntry;
+      while((oneEntry = [entryEnumerator nextObject]) != nil)
+         CSUndoJournalClearValue([oneEntry objectForKey:CSDocModelKey_Notes]);
+   }
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [recordID release];
+   [entryName release];
+   [payload release];
+   [super dealloc];
+}
+
+@end
+
+
+@implementation CSUndoJournal
+
+#pragma mark -
+#pragma mark Initialization
+- (id) init
+{
+   self = [super init];
+   if(self != nil)
+   {
+      records = [[NSMutableArray alloc] initWithCapacity:25];
+      nextRecordID = 0;
+      byteCount = 0;
+      byteLimit = CSUndoJournalDefaultByteLimit;
+   }
+
+   return self;
+}
+
+
+#pragma mark -
+#pragma mark Memory Accounting
+/*
+ * Set the most memory the journal should hold on to; the newest record is
+ * always kept, regardless of its size
+ */
+- (void) setByteLimit:(NSUInteger)newLimit
+{
+   byteLimit = newLimit;
+   [self trimToByteLimit];
+}
+
+
+- (NSUInteger) byteLimit
+{
+   return byteLimit;
+}
+
+
+- (NSUInteger) byteCount
+{
+   return byteCount;
+}
+
+
+/*
+ * Drop the oldest records until we're under the limit, clearing what they held
+ */
+- (void) trimToByteLimit
+{
+   while(byteCount > byteLimit && [records count] > 1)
+   {
+      CSUndoJournalRecord *oldestRecord = [records objectAtIndex:0];
+      byteCount -= [oldestRecord byteCost];
+      [oldestRecord clearPayload];
+      [records removeObjectAtIndex:0];
+   }
+}
+
+
+#pragma mark -
+#pragma mark Recording
+/*
+ * Add a new record to the end of the journal, returning its ID
+ */
+- (NSNumber *) appendRecordOfType:(NSInteger)type payload:(id)payload entryName:(NSString *)name
+{
+   NSNumber *recordID = [NSNumber numberWithUnsignedInteger:nextRecordID++];
+   CSUndoJournalRecord *newRecord = [[CSUndoJournalRecord alloc] initWithType:type
+                                                                      recordID:recordID
+                                                                       payload:payload];
+   [newRecord setEntryName:name];
+   NSUInteger cost = CSUndoJournalRecordOverhead;
+   if(type == CSUndoJournalRecordType_Delete)
+   {
+      NSEnumerator *entryEnumerator = [payload objectEnumerator];
+      id oneEntry;
+      while((oneEntry = [entryEnumerator nextObject]) != nil)
+      {
+         NSEnumerator *valueEnumerator = [oneEntry objectEnumerator];
+         id oneValue;
+         while((oneValue = [valueEnumerator nextObject]) != nil)
+            cost += CSUndoJournalCostOfValue(oneValue);
+      }
+   }
+   else
+   {
+      NSEnumerator *valueEnumerator = [payload objectEnumerator];
+      id oneValue;
+      while((oneValue = [valueEnumerator nextObject]) != nil)
+         cost += CSUndoJournalCostOfValue(oneValue);
+   }
+   [newRecord setByteCost:cost];
+   byteCount += cost;
+   [records addObject:newRecord];
+   [newRecord release];
+   [self trimToByteLimit];
+
+   return recordID;
+}
+
+
+/*
+ * Record that the given names were added; undoing means deleting them
+ */
+- (NSNumber *) recordAddOfNames:(NSArray *)names
+{
+   [self sealRecords];
+
+   return [self appendRecordOfType:CSUndoJournalRecordType_Add
+                           payload:[[names copy] autorelease]
+                         entryName:nil];
+}
+
+
+/*
+ * Record that the given entry is about to take on the given values (nil values
+ * are simply absent from newValues); only the fields which actually differ are
+ * kept.  When canCoalesce is set and the most recent record is an unsealed
+ * change of this same entry, the old values are folded into it instead, keeping
+ * the oldest value for each field.
+ */
+- (NSNumber *) recordChangeOfEntry:(NSDictionary *)entry
+                        withValues:(NSDictionary *)newValues
+                      canCoalesce:(BOOL)canCoalesce
+{
+   NSString *currentName = [entry objectForKey:CSDocModelKey_Name];
+   NSString *resultingName = [newValues objectForKey:CSDocModelKey_Name];
+   if(resultingName == nil)
+      resultingName = currentName;
+
+   CSUndoJournalRecord *lastRecord = [records lastObject];
+   BOOL coalesce = (canCoalesce && lastRecord != nil && ![lastRecord isSealed]
+                    && [lastRecord recordType] == CSUndoJournalRecordType_Change
+                    && [[lastRecord entryName] isEqualToString:currentName]);
+   NSMutableDictionary *oldValues;
+   if(coalesce)
+      oldValues = [lastRecord payload];
+   else
+      oldValues = [NSMutableDictionary dictionaryWithCapacity:[newValues count]];
+
+   NSUInteger addedCost = 0;
+   NSEnumerator *keyEnumerator = [newValues keyEnumerator];
+   id oneKey;
+   while((oneKey = [keyEnumerator nextObject]) != nil)
+   {
+      id oldValue = [entry objectForKey:oneKey];
+      if([oldValues objectForKey:oneKey] == nil && ![oldValue isEqual:[newValues objectForKey:oneKey]])
+      {
+         id keptValue;
+         if(oldValue == nil && [oneKey isEqualToString:CSDocModelKey_Notes])
+            keptValue = [NSMutableData data];
+         else
+            keptValue = CSUndoJournalCopyOfValue(oldValue);
+         [oldValues setObject:keptValue forKey:oneKey];
+         addedCost += CSUndoJournalCostOfValue(keptValue);
+      }
+   }
+
+   NSNumber *recordID = nil;
+   if(coalesce)
+   {
+      [lastRecord setEntryName:resultingName];
+      [lastRecord setByteCost:[lastRecord byteCost] + addedCost];
+      byteCount += addedCost;
+      [self trimToByteLimit];
+   }
+   else if([oldValues count] > 0)
+      recordID = [self appendRecordOfType:CSUndoJournalRecordType_Change
+                                  payload:oldValues
+                                entryName:resultingName];
+
+   return recordID;
+}
+
+
+/*
+ * Record that the given entries were deleted; undoing means adding them back
+ */
+- (NSNumber *) recordDeleteOfEntries:(NSArray *)entries
+{
+   [self sealRecords];
+   NSMutableArray *keptEntries = [NSMutableArray arrayWithCapacity:[entries count]];
+   NSEnumerator *entryEnumerator = [entries objectEnumerator];
+   id oneEntry;
+   while((oneEntry = [entryEnumerator nextObject]) != nil)
+   {
+      NSMutableDictionary *keptEntry = [NSMutableDictionary dictionaryWithDictionary:oneEntry];
+      id notes = [oneEntry objectForKey:CSDocModelKey_Notes];
+      if(notes != nil)
+         [keptEntry setObject:CSUndoJournalCopyOfValue(notes) forKey:CSDocModelKey_Notes];
+      [keptEntries addObject:keptEntry];
+   }
+
+   return [self appendRecordOfType:CSUndoJournalRecordType_Delete payload:keptEntries entryName:nil];
+}
+
+
+/*
+ * No further coalescing into existing records
+ */
+- (void) sealRecords
+{
+   [[records lastObject] seal];
+}
+
+
+#pragma mark -
+#pragma mark Retrieval
+/*
+ * Remove the record with the given ID and hand it back for applying; records are
+ * almost always taken from the end, so search backwards
+ */
+- (CSUndoJournalRecord *) takeRecordWithID:(NSNumber *)recordID
+{
+   CSUndoJournalRecord *foundRecord = nil;
+   NSInteger index;
+   for(index = [records count] - 1; index >= 0 && foundRecord == nil; index--)
+   {
+      CSUndoJournalRecord *oneRecord = [records objectAtIndex:index];
+      if([[oneRecord recordID] isEqualToNumber:recordID])
+      {
+         foundRecord = [[oneRecord retain] autorelease];
+         byteCount -= [oneRecord byteCost];
+         [records removeObjectAtIndex:index];
+      }
+   }
+   [self sealRecords];
+
+   return foundRecord;
+}
+
+
+/*
+ * Drop all records, clearing them out
+ */
+- (void) removeAllRecords
+{
+   NSEnumerator *recordEnumerator = [records objectEnumerator];
+   id oneRecord;
+   while((oneRecord = [recordEnumerator nextObject]) != nil)
+      [oneRecord clearPayload];
+   [records removeAllObjects];
+   byteCount = 0;
+}
+
+
+/*
+ * Cleanup
+ */
+- (void) dealloc
+{
+   [self removeAllRecords];
+   [records release];
+   [super dealloc];
+}
+
+@end
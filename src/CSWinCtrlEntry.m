@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -107,7 +107,7 @@ static const char *genAll      = "aAbBcCdDeEfFgGhHiIjJkKlLmMnNoOpPqQrRsStTuUvVwW
    for(index = 0; index < genSize; index++)
       [randomString appendFormat:@"%c", genString[randomBytes[index] % genStringLength]];
    [passwordText setStringValue:randomString];
-   // XXX - randomData can be zeroed here
+   // randomData is a CSSecureData, cleared once released
    /*
     * XXX deleteCharactersInRange: probably just changes its length; strings are
     * a pain in the ass in Cocoa from a security point of view
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -92,6 +92,13 @@ extern const NSInteger CSWinCtrlMainExportType_XML;
 // Refresh the window and contents
 - (void) refreshWindow;
 
+// Update the window for a change set posted by the model
+- (void) applyRowChanges:(NSDictionary *)changeInfo;
+
+// Show progress while the document loads (see CSDocLoader), and go back to normal
+- (void) setLoadingPhase:(NSInteger)phase progress:(double)progress;
+- (void) loadingDidEnd;
+
 // Search field stuff
 - (IBAction) limitSearch:(id)sender;
 
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -36,6 +36,7 @@
 #import "CSAppController.h"
 #import "CSPrefsController.h"
 #import "CSDocument.h"
+#import "CSDocLoader.h"
 #import "CSDocModel.h"
 
 
@@ -156,6 +157,8 @@ static NSArray *searchWhatArray;
    
    [self setTableViewSpacing];
    [self refreshWindow];
+   if([[self document] isLoading])
+      [self setLoadingPhase:CSDocLoaderPhase_Decrypt progress:0.0];
    
    // Load last-used search key from prefs, or All if none
    NSUserDefaults *stdDefaults = [NSUserDefaults standardUserDefaults];
@@ -300,6 +303,19 @@ static NSArray *searchWhatArray;
 }
 
 
+/*
+ * Return the key currently being searched, nil for all
+ */
+- (NSString *) currentSearchKey
+{
+   NSString *searchKey = [searchWhatArray objectAtIndex:currentSearchCategory];
+   if([searchKey isEqualToString:CSWinCtrlMainSearch_All])   // For all, use a nil key
+      searchKey = nil;
+
+   return searchKey;
+}
+
+
 /*
  * Filter the view of the document based on the search string
  */
@@ -308,12 +324,9 @@ static NSArray *searchWhatArray;
    NSString *searchString = [searchField stringValue];
    if(searchString != nil && [searchString length] > 0)
    {
-      NSString *searchKey = [searchWhatArray objectAtIndex:currentSearchCategory];
-      if([searchKey isEqualToString:CSWinCtrlMainSearch_All])   // For all, use a nil key
-         searchKey = nil;
       [self setSearchResultList:[[self document] rowsMatchingString:searchString
                                                          ignoreCase:YES
-                                                             forKey:searchKey]];
+                                                             forKey:[self currentSearchKey]]];
    }
    else
       [self setSearchResultList:nil];
@@ -333,17 +346,25 @@ static NSArray *searchWhatArray;
 
 
 /*
- * Return the original row number for a filtered row number
+ * Return the filtered row number for an original row number, -1 if it's filtered out; the
+ * search list is in row order, so this can be a binary search
  */
 - (NSInteger) filteredRowForRow:(NSInteger)row
 {
    if(searchResultList != nil)
    {
-      NSInteger index;
-      for(index = 0; index < [searchResultList count]; index++)
+      NSInteger low = 0;
+      NSInteger high = [searchResultList count] - 1;
+      while(low <= high)
       {
-         if([[searchResultList objectAtIndex:index] integerValue] == row)
-            return index;
+         NSInteger middle = (low + high) / 2;
+         NSInteger middleRow = [[searchResultList objectAtIndex:middle] integerValue];
+         if(middleRow == row)
+            return middle;
+         else if(middleRow < row)
+            low = middle + 1;
+         else
+            high = middle - 1;
       }
       return -1;
    }
@@ -410,7 +431,8 @@ static NSArray *searchWhatArray;
  */
 - (IBAction) addEntry:(id)sender
 {
-   [[self document] openAddEntryWindow];
+   if(![[self document] isLoading])
+      [[self document] openAddEntryWindow];
 }
 
 
@@ -656,7 +678,7 @@ static NSArray *searchWhatArray;
                     proposedRow:(NSInteger)row
                     proposedDropOperation:(NSTableViewDropOperation)op
 {
-   if(tableIsDragging)
+   if(tableIsDragging || [[self document] isLoading])
       return NSDragOperationNone;
    else if([info draggingSourceOperationMask] == NSDragOperationGeneric)
       return NSDragOperationMove;
@@ -857,7 +879,9 @@ static NSArray *searchWhatArray;
 - (BOOL) validateMenuItem:(NSMenuItem *)menuItem
 {
    SEL menuItemAction = [menuItem action];
-   if(menuItemAction == @selector(copy:) || menuItemAction == @selector(cut:)
+   if([[self document] isLoading])
+      return NO;
+   else if(menuItemAction == @selector(copy:) || menuItemAction == @selector(cut:)
       || menuItemAction == @selector(setCategory:) || menuItemAction == @selector(delete:))
       return ([documentView numberOfSelectedRows] > 0);
    else if(menuItemAction == @selector(paste:))
@@ -964,6 +988,138 @@ static NSArray *searchWhatArray;
 }
 
 
+/*
+ * Update the window for a change set from the model (see CSDocModelDidChangeRowsNotification);
+ * rows which were already there keep their place in the search results and the selection, so
+ * only inserted and updated rows need testing against the search.  Only table rows now showing
+ * a different or updated entry are redrawn.
+ */
+- (void) applyRowChanges:(NSDictionary *)changeInfo
+{
+   NSData *rowMap = [changeInfo objectForKey:CSDocModelNotificationInfoKey_RowMap];
+   const NSInteger *newRowForOldRow = [rowMap bytes];
+   NSInteger oldRowCount = [rowMap length] / sizeof(NSInteger);
+   NSIndexSet *insertedRows = [changeInfo objectForKey:CSDocModelNotificationInfoKey_InsertedRows];
+   NSIndexSet *updatedRows = [changeInfo objectForKey:CSDocModelNotificationInfoKey_UpdatedRows];
+   NSIndexSet *removedRows = [changeInfo objectForKey:CSDocModelNotificationInfoKey_RemovedRows];
+
+   // Carry the selection over, as model rows, before the search list changes underneath it
+   NSMutableIndexSet *selectedRows = [NSMutableIndexSet indexSet];
+   NSIndexSet *oldSelection = [documentView selectedRowIndexes];
+   NSInteger rowIndex;
+   for(rowIndex = [oldSelection firstIndex];
+       rowIndex != NSNotFound;
+       rowIndex = [oldSelection indexGreaterThanIndex:rowIndex])
+   {
+      NSInteger oldRow = [self rowForFilteredRow:rowIndex];
+      if(oldRow < oldRowCount && newRowForOldRow[oldRow] >= 0)
+         [selectedRows addIndex:newRowForOldRow[oldRow]];
+   }
+
+   // What each table row showed, as a row of the model now (-1 if it's gone)
+   NSInteger oldDisplayCount = [documentView numberOfRows];
+   NSMutableData *displayMap = [NSMutableData dataWithLength:oldDisplayCount * sizeof(NSInteger)];
+   NSInteger *newRowForDisplayRow = [displayMap mutableBytes];
+   for(rowIndex = 0; rowIndex < oldDisplayCount; rowIndex++)
+   {
+      NSInteger oldRow = [self rowForFilteredRow:rowIndex];
+      newRowForDisplayRow[rowIndex] = (oldRow < oldRowCount ? newRowForOldRow[oldRow] : -1);
+   }
+
+   if(searchResultList != nil)
+   {
+      NSMutableIndexSet *matchingRows = [NSMutableIndexSet indexSet];
+      NSEnumerator *resultEnumerator = [searchResultList objectEnumerator];
+      id oneResult;
+      while((oneResult = [resultEnumerator nextObject]) != nil)
+      {
+         NSInteger oldRow = [oneResult integerValue];
+         if(oldRow < oldRowCount && newRowForOldRow[oldRow] >= 0
+            && ![updatedRows containsIndex:newRowForOldRow[oldRow]])
+            [matchingRows addIndex:newRowForOldRow[oldRow]];
+      }
+      NSMutableIndexSet *rowsToTest = [NSMutableIndexSet indexSet];
+      [rowsToTest addIndexes:insertedRows];
+      [rowsToTest addIndexes:updatedRows];
+      NSString *searchString = [searchField stringValue];
+      NSString *searchKey = [self currentSearchKey];
+      for(rowIndex = [rowsToTest firstIndex];
+          rowIndex != NSNotFound;
+          rowIndex = [rowsToTest indexGreaterThanIndex:rowIndex])
+      {
+         if([[self document] entryAtRow:rowIndex matchesString:searchString ignoreCase:YES forKey:searchKey])
+            [matchingRows addIndex:rowIndex];
+      }
+      NSMutableArray *newResultList = [NSMutableArray arrayWithCapacity:[matchingRows count]];
+      for(rowIndex = [matchingRows firstIndex];
+          rowIndex != NSNotFound;
+          rowIndex = [matchingRows indexGreaterThanIndex:rowIndex])
+         [newResultList addObject:[NSNumber numberWithInteger:rowIndex]];
+      [self setSearchResultList:newResultList];
+   }
+
+   NSMutableIndexSet *newSelection = [NSMutableIndexSet indexSet];
+   for(rowIndex = [selectedRows firstIndex];
+       rowIndex != NSNotFound;
+       rowIndex = [selectedRows indexGreaterThanIndex:rowIndex])
+   {
+      NSInteger filteredRow = [self filteredRowForRow:rowIndex];
+      if(filteredRow >= 0)
+         [newSelection addIndex:filteredRow];
+   }
+   NSInteger newDisplayCount = [self numberOfRowsInTableView:documentView];
+   if(newDisplayCount != oldDisplayCount)
+      [documentView noteNumberOfRowsChanged];
+   for(rowIndex = 0; rowIndex < newDisplayCount; rowIndex++)
+   {
+      NSInteger newRow = [self rowForFilteredRow:rowIndex];
+      if(rowIndex >= oldDisplayCount || newRowForDisplayRow[rowIndex] != newRow
+         || [updatedRows containsIndex:newRow])
+         [documentView setNeedsDisplayInRect:[documentView rectOfRow:rowIndex]];
+   }
+   [documentView selectRowIndexes:newSelection byExtendingSelection:NO];
+
+   // A pure re-sort can't change the categories
+   if([insertedRows count] > 0 || [updatedRows count] > 0 || [removedRows count] > 0)
+   {
+      NSArray *categories = [[self document] valueForKey:@"categories"];
+      [[NSApp delegate] updateSetCategoryMenuWithCategories:categories action:@selector(setCategory:)];
+   }
+   [self updateStatusField];
+}
+
+
+/*
+ * While the document loads, the table and search are off and the status field
+ * shows how far along it is
+ */
+- (void) setLoadingPhase:(NSInteger)phase progress:(double)progress
+{
+   NSString *phaseName;
+   if(phase == CSDocLoaderPhase_Decrypt)
+      phaseName = NSLocalizedString(@"Decrypting", @"");
+   else if(phase == CSDocLoaderPhase_Inflate)
+      phaseName = NSLocalizedString(@"Decompressing", @"");
+   else if(phase == CSDocLoaderPhase_Unarchive)
+      phaseName = NSLocalizedString(@"Reading entries", @"");
+   else
+      phaseName = NSLocalizedString(@"Sorting", @"");
+   [documentView setEnabled:NO];
+   [searchField setEnabled:NO];
+   [documentStatus setStringValue:[NSString stringWithFormat:NSLocalizedString(@"Loading: %@ (%ld%%)", @""),
+                                                             phaseName,
+                                                             (long) (progress * 100.0)]];
+}
+
+
+- (void) loadingDidEnd
+{
+   [documentView setEnabled:YES];
+   [searchField setEnabled:YES];
+   [self updateStatusField];
+}
+
+
 #pragma mark -
 #pragma mark Miscellaneous
 /*
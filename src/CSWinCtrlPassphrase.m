@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006-2007,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006-2007,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -35,6 +35,7 @@
 
 #import "CSWinCtrlPassphrase.h"
 #import "CSPrefsController.h"
+#import "CSSecureData.h"
 #import "NSData_crypto.h"
 
 
@@ -130,7 +131,7 @@ static const NSInteger CSWinCtrlPassphrase_ShortPassPhrase = 8;
    {
       [NSApp endSheet:[self window]];
       [[self window] orderOut:self];
-      // XXX - data from generateKeyUsingConfirmationTab should be cleared
+      // The unused key is a CSSecureData, so it is cleared once released
       [self generateKeyUsingConfirmationTab:YES];  // Called for the side-effects (clearing fields)
       [modalDelegate performSelector:sheetEndSelector withObject:nil];
    }
@@ -154,7 +155,7 @@ static const NSInteger CSWinCtrlPassphrase_ShortPassPhrase = 8;
             contextInfo:NULL];
    else   // Cancel all together
    {
-      // XXX - data from generateKeyUsingConfirmationTab should be cleared
+      // The unused key is a CSSecureData, so it is cleared once released
       [self generateKeyUsingConfirmationTab:YES];   // Called for the side-effects
       [modalDelegate performSelector:sheetEndSelector withObject:nil];
    }
@@ -230,8 +231,12 @@ static const NSInteger CSWinCtrlPassphrase_ShortPassPhrase = 8;
       [passphrasePhrase1 setStringValue:@""];
    }
    
-   NSData *passphraseData = [passphrase dataUsingEncoding:NSUnicodeStringEncoding];
-   const unsigned char *dataBytes = [passphraseData bytes];
+   /*
+    * XXX The data from dataUsingEncoding: can't be cleared, so it's copied into
+    * secure memory right away and everything derived from it stays there
+    */
+   NSMutableData *passphraseData = [CSSecureData dataWithData:[passphrase dataUsingEncoding:NSUnicodeStringEncoding]];
+   unsigned char *dataBytes = [passphraseData mutableBytes];
    /*
     * When CiphSafe was originally written, and PowerPC was the only architecture, this innocent-looking
     * use of dataUsingEncoding: above was safe.  Now, however, with Intel-based Macs, this returns a
@@ -240,33 +245,28 @@ static const NSInteger CSWinCtrlPassphrase_ShortPassPhrase = 8;
     */
    if(dataBytes[0] == 0xFF && dataBytes[1] == 0xFE)
    {
-      NSMutableData *newData = [NSMutableData dataWithLength:[passphraseData length]];
-      unsigned char *newBytes = [newData mutableBytes];
       NSInteger position;
       for(position = 0; position < [passphraseData length]; position += 2)
       {
-         newBytes[position] = dataBytes[position + 1];
-         newBytes[position + 1] = dataBytes[position];
+         unsigned char swapByte = dataBytes[position];
+         dataBytes[position] = dataBytes[position + 1];
+         dataBytes[position + 1] = swapByte;
       }
-      // XXX - old passphraseData should be cleared here
-      passphraseData = newData;
    }
    NSInteger pdLen = [passphraseData length];
-   NSData *dataFirst = [passphraseData subdataWithRange:NSMakeRange(0, pdLen / 2)];
-   NSData *dataSecond = [passphraseData subdataWithRange:NSMakeRange(pdLen / 2, pdLen - pdLen / 2)];
+   NSData *dataFirst = [CSSecureData dataWithBytes:dataBytes length:pdLen / 2];
+   NSData *dataSecond = [CSSecureData dataWithBytes:dataBytes + pdLen / 2 length:pdLen - pdLen / 2];
    /*
-    * XXX At this point, passphrase and passphraseData should be cleared, however,
-    * there is no way, that I've yet found, to do that...here's hoping it gets released
-    * and the memory reused soon...
+    * XXX At this point, passphrase should be cleared, however, there is no way,
+    * that I've yet found, to do that...here's hoping it gets released and the
+    * memory reused soon...
     */
    passphrase = nil;
    
+   // passphraseData, dataFirst, dataSecond, and tmpData are cleared when released
    NSMutableData *keyData = [dataFirst SHA1Hash];
-   // XXX - dataFirst should now be cleared...
    NSMutableData *tmpData = [dataSecond SHA1Hash];
-   // XXX - dataSecond should now be cleared...
    [keyData appendData:tmpData];
-   // XXX - tmpData should now be cleared...
    
    return keyData;
 }
@@ -295,7 +295,7 @@ static const NSInteger CSWinCtrlPassphrase_ShortPassPhrase = 8;
    NSMutableData *keyData = [self generateKeyUsingConfirmationTab:NO];
    if(windowReturn == NSRunAbortedResponse)
    {
-      // XXX - keyData should be sanitized here
+      [keyData resetBytesInRange:NSMakeRange(0, [keyData length])];
       keyData = nil;
    }
    
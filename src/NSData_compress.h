@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -32,10 +32,21 @@
  */
 /*
  * Compresses/decompresses data using zlib (see RFC 1950 and /usr/include/zlib.h)
+ * and, optionally, zstd and LZ4
  *
  * Be sure to add /usr/lib/libz.dylib to the linked frameworks, or add "-lz" to
  * 'Other Linker Flags' in the 'Linker Settings' section of the target's
  * 'Build Settings'
+ *
+ * zstd and LZ4 are only built in when HAVE_ZSTD and/or HAVE_LZ4 are defined
+ * (in 'Preprocessor Macros'), with -lzstd and/or -llz4 added to the linker
+ * flags; codecs not built in are reported as unavailable.
+ *
+ * zlib output is the original format: the zlib stream followed by the original
+ * size (4 bytes, big-endian).  Other codecs write a tag first: the bytes 'C',
+ * 'S', 'c', the codec ID, then the original size (4 bytes, big-endian), then
+ * the codec's own stream.  A 'C' can never start a zlib stream, so the two are
+ * always told apart.
  */
 /* NSData_compress.h */
 
@@ -47,12 +58,29 @@ extern const int NSDataCompressionLevelLow;
 extern const int NSDataCompressionLevelMedium;
 extern const int NSDataCompressionLevelHigh;
 
+// Codec names, as stored in preferences
+extern NSString * const NSDataCompressionCodecZlib;
+extern NSString * const NSDataCompressionCodecZstd;
+extern NSString * const NSDataCompressionCodecLZ4;
+
 @interface NSData (withay_compress)
 
 + (void) setCompressLogging:(BOOL)logEnabled;
++ (NSArray *) availableCompressionCodecs;
++ (BOOL) isCompressionCodecAvailable:(NSString *)codec;
 - (NSMutableData *) compressedData;
 - (NSMutableData *) compressedDataAtLevel:(int)level;
+/*
+ * Levels are handed to the codec as-is, except NSDataCompressionLevelDefault,
+ * which gives the codec's own default
+ */
+- (NSMutableData *) compressedDataWithCodec:(NSString *)codec level:(int)level;
+- (NSMutableData *) compressedDataWithCodec:(NSString *)codec
+                                      level:(int)level
+                       longDistanceMatching:(BOOL)useLongMode;
 - (NSMutableData *) uncompressedData;
+- (NSString *) compressionCodec;
 - (BOOL) isCompressedFormat;
+- (NSString *) compressionBenchmarkReport;
 
 @end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -40,7 +40,15 @@
 /* NSData_compress.m */
 
 #import "NSData_compress.h"
+#import "CSSecureData.h"
 #include <zlib.h>
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 
 const int NSDataCompressionLevelNone = Z_NO_COMPRESSION;
 const int NSDataCompressionLevelDefault = Z_DEFAULT_COMPRESSION;
@@ -48,6 +56,36 @@ const int NSDataCompressionLevelLow = Z_BEST_SPEED;
 const int NSDataCompressionLevelMedium = 5;
 const int NSDataCompressionLevelHigh = Z_BEST_COMPRESSION;
 
+NSString * const NSDataCompressionCodecZlib = @"zlib";
+NSString * const NSDataCompressionCodecZstd = @"zstd";
+NSString * const NSDataCompressionCodecLZ4 = @"lz4";
+
+// Tag written before data from codecs other than zlib, then codec ID and size
+static const unsigned char codecTagMagic[] = { 'C', 'S', 'c' };
+#define NSDATA_COMPRESS_TAG_LENGTH (sizeof(codecTagMagic) + 1 + sizeof(uint32_t))
+
+// Codec IDs as written in the tag; these must never change
+enum
+{
+   NSDataCodecID_Zstd = 1,
+   NSDataCodecID_LZ4 = 2
+};
+
+/*
+ * A codec other than zlib; compress returns the number of bytes written (0 on
+ * failure), decompress whether it produced exactly destLength bytes.  longMode
+ * asks for long distance matching, where the codec has it.
+ */
+typedef struct
+{
+   NSString * const *name;
+   unsigned char codecID;
+   int defaultLevel;
+   size_t (*bound)(size_t sourceLength);
+   size_t (*compress)(void *dest, size_t destLength, const void *source, size_t sourceLength, int level,
+                      BOOL longMode);
+   BOOL (*decompress)(void *dest, size_t destLength, const void *source, size_t sourceLength);
+} NSDataCompressionCodecInfo;
 
 // Localized strings
 #define NSDATA_COMPRESS_LOC_MEMERR NSLocalizedString(@"memory error", @"")
@@ -82,6 +120,165 @@ static BOOL compressLoggingEnabled = YES;
 }
 
 
+/*
+ * XXX The codecs' own working memory isn't cleared after use; that's out of our
+ * hands, though the input and output buffers are CSSecureData
+ */
+#if defined(HAVE_ZSTD)
+static size_t zstdBound(size_t sourceLength)
+{
+   return ZSTD_compressBound(sourceLength);
+}
+
+
+static size_t zstdCompress(void *dest, size_t destLength, const void *source, size_t sourceLength, int level,
+                           BOOL longMode)
+{
+   ZSTD_CCtx *context = ZSTD_createCCtx();
+   if(context == NULL)
+      return 0;
+   ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+   if(longMode)
+      ZSTD_CCtx_setParameter(context, ZSTD_c_enableLongDistanceMatching, 1);
+   size_t written = ZSTD_compress2(context, dest, destLength, source, sourceLength);
+   ZSTD_freeCCtx(context);
+   if(ZSTD_isError(written))
+   {
+      [NSData logCompressMessage:NSLocalizedString(@"call to ZSTD_compress2() failed: %s", @""),
+                                 ZSTD_getErrorName(written)];
+      written = 0;
+   }
+
+   return written;
+}
+
+
+static BOOL zstdDecompress(void *dest, size_t destLength, const void *source, size_t sourceLength)
+{
+   size_t written = ZSTD_decompress(dest, destLength, source, sourceLength);
+   if(ZSTD_isError(written))
+   {
+      [NSData logCompressMessage:NSLocalizedString(@"call to ZSTD_decompress() failed: %s", @""),
+                                 ZSTD_getErrorName(written)];
+      return NO;
+   }
+
+   return (written == destLength);
+}
+#endif
+
+
+#if defined(HAVE_LZ4)
+static size_t lz4Bound(size_t sourceLength)
+{
+   return (sourceLength <= LZ4_MAX_INPUT_SIZE ? LZ4_compressBound(sourceLength) : 0);
+}
+
+
+/*
+ * Level 1 and below is plain (fastest) LZ4, anything higher is LZ4HC; LZ4 has
+ * no long mode
+ */
+static size_t lz4Compress(void *dest, size_t destLength, const void *source, size_t sourceLength, int level,
+                          BOOL longMode)
+{
+   if(sourceLength > LZ4_MAX_INPUT_SIZE)
+      return 0;
+   int written;
+   if(level <= 1)
+      written = LZ4_compress_default(source, dest, sourceLength, destLength);
+   else
+      written = LZ4_compress_HC(source, dest, sourceLength, destLength, level);
+   if(written <= 0)
+      [NSData logCompressMessage:NSLocalizedString(@"LZ4 compression failed", @"")];
+
+   return (written > 0 ? written : 0);
+}
+
+
+static BOOL lz4Decompress(void *dest, size_t destLength, const void *source, size_t sourceLength)
+{
+   int written = LZ4_decompress_safe(source, dest, sourceLength, destLength);
+   if(written < 0)
+      [NSData logCompressMessage:NSLocalizedString(@"LZ4 decompression failed: %d", @""), written];
+
+   return (written >= 0 && (size_t) written == destLength);
+}
+#endif
+
+
+// The registry of codecs built in, besides zlib
+static const NSDataCompressionCodecInfo codecTable[] =
+{
+#if defined(HAVE_ZSTD)
+   { &NSDataCompressionCodecZstd, NSDataCodecID_Zstd, ZSTD_CLEVEL_DEFAULT, zstdBound, zstdCompress, zstdDecompress },
+#endif
+#if defined(HAVE_LZ4)
+   { &NSDataCompressionCodecLZ4, NSDataCodecID_LZ4, 1, lz4Bound, lz4Compress, lz4Decompress },
+#endif
+   { NULL, 0, 0, NULL, NULL, NULL }
+};
+
+
+/*
+ * Find a built-in codec by name or by ID
+ */
+static const NSDataCompressionCodecInfo * codecInfoNamed(NSString *name)
+{
+   const NSDataCompressionCodecInfo *info;
+   for(info = codecTable; info->name != NULL; info++)
+   {
+      if([*info->name isEqualToString:name])
+         return info;
+   }
+
+   return NULL;
+}
+
+
+static const NSDataCompressionCodecInfo * codecInfoWithID(unsigned char codecID)
+{
+   const NSDataCompressionCodecInfo *info;
+   for(info = codecTable; info->name != NULL; info++)
+   {
+      if(info->codecID == codecID)
+         return info;
+   }
+
+   return NULL;
+}
+
+
+/*
+ * Whether the data starts with a codec tag
+ */
+static BOOL isTaggedFormat(NSData *data)
+{
+   return ([data length] >= NSDATA_COMPRESS_TAG_LENGTH
+           && memcmp([data bytes], codecTagMagic, sizeof(codecTagMagic)) == 0);
+}
+
+
+/*
+ * Names of all codecs built in, zlib first
+ */
++ (NSArray *) availableCompressionCodecs
+{
+   NSMutableArray *codecs = [NSMutableArray arrayWithObject:NSDataCompressionCodecZlib];
+   const NSDataCompressionCodecInfo *info;
+   for(info = codecTable; info->name != NULL; info++)
+      [codecs addObject:*info->name];
+
+   return codecs;
+}
+
+
++ (BOOL) isCompressionCodecAvailable:(NSString *)codec
+{
+   return ([codec isEqualToString:NSDataCompressionCodecZlib] || codecInfoNamed(codec) != NULL);
+}
+
+
 /*
  * Compress the data, default level of compression
  */
@@ -102,7 +299,7 @@ static BOOL compressLoggingEnabled = YES;
     * additional bytes to store the original size (needed for uncompress)
     */
    unsigned long bufferLength = ceil((float) [self length] * 1.001) + 12 + sizeof(uint32_t);
-   NSMutableData *newData = [NSMutableData dataWithLength:bufferLength];
+   NSMutableData *newData = [CSSecureData dataWithLength:bufferLength];
    if(newData != nil)
    {
       int zlibError = compress2([newData mutableBytes],
@@ -132,12 +329,100 @@ static BOOL compressLoggingEnabled = YES;
 
 
 /*
- * Decompress data
+ * Compress the data with the given codec; zlib gives the original format, with
+ * the level capped to what zlib allows
+ */
+- (NSMutableData *) compressedDataWithCodec:(NSString *)codec level:(int)level
+{
+   return [self compressedDataWithCodec:codec level:level longDistanceMatching:NO];
+}
+
+
+/*
+ * As above, asking for long distance matching, which helps large inputs with
+ * repeats far apart at the cost of memory; only zstd has it, and it needs no
+ * special handling when decompressing.  It's a parameter rather than a setting
+ * as saves compress on their own threads.
+ */
+- (NSMutableData *) compressedDataWithCodec:(NSString *)codec
+                                      level:(int)level
+                       longDistanceMatching:(BOOL)useLongMode
+{
+   if(codec == nil || [codec isEqualToString:NSDataCompressionCodecZlib])
+      return [self compressedDataAtLevel:MIN(level, NSDataCompressionLevelHigh)];
+
+   const NSDataCompressionCodecInfo *info = codecInfoNamed(codec);
+   if(info == NULL)
+   {
+      [NSData logCompressMessage:NSLocalizedString(@"codec %@ is not available", @""), codec];
+      return nil;
+   }
+   if([self length] > UINT32_MAX)
+   {
+      [NSData logCompressMessage:NSLocalizedString(@"data is too large to compress", @"")];
+      return nil;
+   }
+   if(level == NSDataCompressionLevelDefault)
+      level = info->defaultLevel;
+
+   size_t bound = info->bound([self length]);
+   NSMutableData *newData = nil;
+   if(bound > 0)
+      newData = [CSSecureData dataWithLength:NSDATA_COMPRESS_TAG_LENGTH + bound];
+   if(newData != nil)
+   {
+      unsigned char *bytes = [newData mutableBytes];
+      memcpy(bytes, codecTagMagic, sizeof(codecTagMagic));
+      bytes[sizeof(codecTagMagic)] = info->codecID;
+      *((uint32_t *) (bytes + sizeof(codecTagMagic) + 1)) = CFSwapInt32HostToBig([self length]);
+      size_t written = info->compress(bytes + NSDATA_COMPRESS_TAG_LENGTH,
+                                      bound,
+                                      [self bytes],
+                                      [self length],
+                                      level,
+                                      useLongMode);
+      if(written > 0)
+         [newData setLength:NSDATA_COMPRESS_TAG_LENGTH + written];
+      else
+         newData = nil;
+   }
+   else
+      [NSData logCompressMessage:NSDATA_COMPRESS_LOC_MEMERR];
+
+   return newData;
+}
+
+
+/*
+ * Decompress data, in either the tagged or original zlib format
  */
 - (NSMutableData *) uncompressedData
 {
    NSMutableData *newData = nil;
-   if([self isCompressedFormat])
+   if(isTaggedFormat(self))
+   {
+      const unsigned char *bytes = [self bytes];
+      const NSDataCompressionCodecInfo *info = codecInfoWithID(bytes[sizeof(codecTagMagic)]);
+      if(info != NULL)
+      {
+         uint32_t originalSize = CFSwapInt32BigToHost(*((uint32_t *) (bytes + sizeof(codecTagMagic) + 1)));
+         newData = [CSSecureData dataWithLength:originalSize];
+         if(newData != nil)
+         {
+            if(!info->decompress([newData mutableBytes],
+                                 originalSize,
+                                 bytes + NSDATA_COMPRESS_TAG_LENGTH,
+                                 [self length] - NSDATA_COMPRESS_TAG_LENGTH))
+               newData = nil;
+         }
+         else
+            [NSData logCompressMessage:NSDATA_COMPRESS_LOC_MEMERR];
+      }
+      else
+         [NSData logCompressMessage:NSLocalizedString(@"data uses codec %d, which is not available", @""),
+                                    bytes[sizeof(codecTagMagic)]];
+   }
+   else if([self isCompressedFormat])
    {
       uint32_t originalSize = CFSwapInt32BigToHost(*((uint32_t *) ([self bytes] + [self length] -
                                                                    sizeof(uint32_t))));
@@ -151,7 +436,7 @@ static BOOL compressLoggingEnabled = YES;
        * in the uncompress() call.
        */
       NS_DURING
-         newData = [NSMutableData dataWithLength:originalSize];
+         newData = [CSSecureData dataWithLength:originalSize];
       NS_HANDLER
          if([[localException name] isEqualToString:NSInvalidArgumentException])
          {
@@ -193,12 +478,38 @@ static BOOL compressLoggingEnabled = YES;
 }
 
 
+/*
+ * Name of the codec the receiver was compressed with, or nil if it doesn't look
+ * compressed; tagged data from a codec not built in still gets its name
+ */
+- (NSString *) compressionCodec
+{
+   if(isTaggedFormat(self))
+   {
+      unsigned char codecID = ((const unsigned char *) [self bytes])[sizeof(codecTagMagic)];
+      if(codecID == NSDataCodecID_Zstd)
+         return NSDataCompressionCodecZstd;
+      else if(codecID == NSDataCodecID_LZ4)
+         return NSDataCompressionCodecLZ4;
+      else
+         return nil;
+   }
+   else if([self isCompressedFormat])
+      return NSDataCompressionCodecZlib;
+
+   return nil;
+}
+
+
 /*
  * Quick check of the data to avoid obviously-not-compressed data (see the
- * RFC for the explanation of these checks)
+ * RFC for the explanation of these checks); this is for the original zlib
+ * format only, tagged data is recognized by its tag
  */
 - (BOOL) isCompressedFormat
 {
+   if([self length] < 2 + sizeof(uint32_t))
+      return NO;
    const unsigned char *bytes = [self bytes];
    /*
     * The checks are:
@@ -220,4 +531,63 @@ static BOOL compressLoggingEnabled = YES;
    return NO;
 }
 
+
+/*
+ * Compress and decompress the receiver with every codec at a few levels,
+ * reporting the ratio and throughput of each; codecs this build left out are
+ * listed as such
+ */
+- (NSString *) compressionBenchmarkReport
+{
+   static const struct
+   {
+      NSString * const *codec;
+      int level;
+   } trials[] =
+   {
+      { &NSDataCompressionCodecZlib, 1 },
+      { &NSDataCompressionCodecZlib, 6 },
+      { &NSDataCompressionCodecZlib, 9 },
+      { &NSDataCompressionCodecZstd, 1 },
+      { &NSDataCompressionCodecZstd, 3 },
+      { &NSDataCompressionCodecZstd, 9 },
+      { &NSDataCompressionCodecZstd, 19 },
+      { &NSDataCompressionCodecLZ4, 1 },
+      { &NSDataCompressionCodecLZ4, 9 },
+      { NULL, 0 }
+   };
+   double megabytes = (double) [self length] / (1024.0 * 1024.0);
+   NSMutableString *report = [NSMutableString stringWithFormat:@"Compression benchmark, %lu bytes\n",
+                                                               (unsigned long) [self length]];
+   NSInteger index;
+   for(index = 0; trials[ index ].codec != NULL; index++)
+   {
+      NSString *codec = *trials[ index ].codec;
+      if(![NSData isCompressionCodecAvailable:codec])
+      {
+         if(index == 0 || *trials[ index - 1 ].codec != codec)
+            [report appendFormat:@"%@: not built in\n", codec];
+         continue;
+      }
+      NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+      CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+      NSData *compressed = [self compressedDataWithCodec:codec level:trials[ index ].level];
+      CFAbsoluteTime compressTime = CFAbsoluteTimeGetCurrent();
+      NSData *uncompressed = [compressed uncompressedData];
+      CFAbsoluteTime uncompressTime = CFAbsoluteTimeGetCurrent();
+      if(compressed == nil || ![uncompressed isEqualToData:self])
+         [report appendFormat:@"%@ level %d: FAILED\n", codec, trials[ index ].level];
+      else
+         [report appendFormat:@"%@ level %d: ratio %.2f, compress %.1f MB/s, decompress %.1f MB/s\n",
+                              codec,
+                              trials[ index ].level,
+                              (double) [self length] / (double) MAX([compressed length], 1),
+                              megabytes / MAX(compressTime - startTime, 1e-6),
+                              megabytes / MAX(uncompressTime - compressTime, 1e-6)];
+      [pool release];
+   }
+
+   return report;
+}
+
 @end
@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -40,12 +40,25 @@
 
 #import <Foundation/Foundation.h>
 
+/*
+ * Called as a long decryption goes along with the fraction done; return NO to
+ * stop (the decryption then returns nil)
+ */
+typedef BOOL (*NSDataCryptoProgressFunction)(double fractionDone, void *context);
+
 @interface NSData (withay_crypto)
 
 + (void) setCryptoLogging:(BOOL)logEnabled;
 + (NSMutableData *) randomDataOfLength:(ssize_t)len;
 - (NSMutableData *) blowfishEncryptedDataWithKey:(NSData *)key iv:(NSData *)iv;
 - (NSMutableData *) blowfishDecryptedDataWithKey:(NSData *)key iv:(NSData *)iv;
+- (NSMutableData *) blowfishDecryptedDataWithKey:(NSData *)key
+                                             iv:(NSData *)iv
+                               progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                                        context:(void *)context;
+- (NSMutableData *) blowfishDecryptedPrefixOfLength:(NSUInteger)length withKey:(NSData *)key iv:(NSData *)iv;
 - (NSMutableData *) SHA1Hash;
+- (NSMutableData *) HMACSHA1WithKey:(NSData *)key;
+- (NSMutableData *) HMACSHA1WithKey:(NSData *)key prefix:(NSData *)prefix;
 
 @end
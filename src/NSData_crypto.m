@@ -1,5 +1,5 @@
 /*
- * Copyright  2003,2006,2011, Bryan L Blackburn.  All rights reserved.
+ * Copyright  2003,2006,2011,2026, Bryan L Blackburn.  All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -39,14 +39,19 @@
 /* NSData_crypto.m */
 
 #import "NSData_crypto.h"
+#import "CSSecureData.h"
 #include <unistd.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 
 
 // Localized strings
 #define NSDATA_CRYPTO_LOC_SETKEYLENFAIL NSLocalizedString(@"EVP_CIPHER_CTX_set_key_length failed", @"")
 #define NSDATA_CRYPTO_LOC_IVBAD         NSLocalizedString(@"iv is %ld bytes, not 8", @"")
 
+// How much to decrypt between progress reports
+#define NSDATA_CRYPTO_CHUNK_SIZE (256 * 1024)
+
 
 @implementation NSData (withay_crypto)
 
@@ -77,8 +82,8 @@ static BOOL cryptoLoggingEnabled = YES;
 
 
 /*
- * Pull out 'len' bytes from /dev/random, returning in a mutable data so
- * they can be overwritten later, if necessary
+ * Pull out 'len' bytes from /dev/random, returning in a CSSecureData so they're
+ * cleared once released
  */
 + (NSMutableData *) randomDataOfLength:(ssize_t)len
 {
@@ -87,7 +92,7 @@ static BOOL cryptoLoggingEnabled = YES;
    NSFileHandle *devRandom = [NSFileHandle fileHandleForReadingAtPath:@"/dev/random"];
    if(devRandom != nil)
    {
-      randomData = [NSMutableData dataWithLength:len];
+      randomData = [CSSecureData dataWithLength:len];
       while(amtRead < len)
       {
          /*
@@ -134,7 +139,7 @@ static BOOL cryptoLoggingEnabled = YES;
             if(EVP_EncryptInit(&cipherContext, NULL, [key bytes], NULL))
             {
                int encLen = [self length] + 8;   // Make sure we have enough space
-               encryptedData = [NSMutableData dataWithLength:encLen];
+               encryptedData = [CSSecureData dataWithLength:encLen];
                if(EVP_EncryptUpdate(&cipherContext,
                                     [encryptedData mutableBytes],
                                     &encLen,
@@ -181,6 +186,19 @@ static BOOL cryptoLoggingEnabled = YES;
  * key and initialization vector; make sure iv is 8 bytes
  */
 - (NSMutableData *) blowfishDecryptedDataWithKey:(NSData *)key iv:(NSData *)iv
+{
+   return [self blowfishDecryptedDataWithKey:key iv:iv progressFunction:NULL context:NULL];
+}
+
+
+/*
+ * As above, but decrypting a chunk at a time, calling progressFunction (if
+ * given) after each; stops and returns nil if it returns NO
+ */
+- (NSMutableData *) blowfishDecryptedDataWithKey:(NSData *)key
+                                             iv:(NSData *)iv
+                               progressFunction:(NSDataCryptoProgressFunction)progressFunction
+                                        context:(void *)context
 {
    NSMutableData *plainData = nil;
    int finalLen = 0;
@@ -194,14 +212,30 @@ static BOOL cryptoLoggingEnabled = YES;
             if(EVP_DecryptInit(&cipherContext, NULL, [key bytes], NULL))
             {
                int decLen = [self length] + 8;   // Make sure there's enough room
-               plainData = [NSMutableData dataWithLength:decLen];
-               if(EVP_DecryptUpdate(&cipherContext,
-                                    [plainData mutableBytes],
-                                    &decLen,
-                                    [self bytes],
-                                    [self length]))
+               plainData = [CSSecureData dataWithLength:decLen];
+               BOOL updateOK = YES;
+               const unsigned char *cipherBytes = [self bytes];
+               NSUInteger cipherOffset = 0;
+               while(updateOK && cipherOffset < [self length])
+               {
+                  int chunkLen = MIN([self length] - cipherOffset, NSDATA_CRYPTO_CHUNK_SIZE);
+                  decLen = [plainData length] - finalLen;
+                  updateOK = EVP_DecryptUpdate(&cipherContext,
+                                               [plainData mutableBytes] + finalLen,
+                                               &decLen,
+                                               cipherBytes + cipherOffset,
+                                               chunkLen);
+                  finalLen += decLen;
+                  cipherOffset += chunkLen;
+                  if(updateOK && progressFunction != NULL
+                     && !progressFunction((double) cipherOffset / (double) [self length], context))
+                  {
+                     EVP_CIPHER_CTX_cleanup(&cipherContext);
+                     return nil;
+                  }
+               }
+               if(updateOK)
                {
-                  finalLen = decLen;
                   decLen = [plainData length] - finalLen;
                   if(EVP_DecryptFinal(&cipherContext,
                                       [plainData mutableBytes] + finalLen,
@@ -236,6 +270,40 @@ static BOOL cryptoLoggingEnabled = YES;
 }
 
 
+/*
+ * Decrypt just enough of the receiver to get the first length bytes of plain
+ * text, without checking the padding at the end; good for a quick look at a
+ * header without decrypting everything
+ */
+- (NSMutableData *) blowfishDecryptedPrefixOfLength:(NSUInteger)length withKey:(NSData *)key iv:(NSData *)iv
+{
+   // CBC holds back the last block it's given, so feed it one more
+   NSUInteger cipherLen = ((length + 7) & ~7) + 8;
+   if([iv length] != 8 || [self length] < cipherLen)
+      return nil;
+
+   NSMutableData *plainData = nil;
+   EVP_CIPHER_CTX cipherContext;
+   if(EVP_DecryptInit(&cipherContext, EVP_bf_cbc(), NULL, [iv bytes]))
+   {
+      if(EVP_CIPHER_CTX_set_key_length(&cipherContext, [key length])
+         && EVP_DecryptInit(&cipherContext, NULL, [key bytes], NULL))
+      {
+         int decLen = cipherLen + 8;
+         plainData = [CSSecureData dataWithLength:decLen];
+         if(EVP_DecryptUpdate(&cipherContext, [plainData mutableBytes], &decLen, [self bytes], cipherLen)
+            && decLen >= (int) length)
+            [plainData setLength:length];
+         else
+            plainData = nil;
+      }
+      EVP_CIPHER_CTX_cleanup(&cipherContext);
+   }
+
+   return plainData;
+}
+
+
 /*
  * Return a SHA1 hash of the receiver's data
  */
@@ -244,7 +312,7 @@ static BOOL cryptoLoggingEnabled = YES;
    EVP_MD_CTX digestContext;
    EVP_DigestInit(&digestContext, EVP_sha1());
    int hashLen = EVP_MD_CTX_size(&digestContext);
-   NSMutableData *hashValue = [NSMutableData dataWithLength:hashLen];
+   NSMutableData *hashValue = [CSSecureData dataWithLength:hashLen];
    EVP_DigestUpdate(&digestContext, [self bytes], [self length]);
    int writtenLen;
    EVP_DigestFinal(&digestContext, [hashValue mutableBytes], (unsigned int *) &writtenLen);
@@ -260,4 +328,52 @@ static BOOL cryptoLoggingEnabled = YES;
    return hashValue;
 }
 
+
+
+/*
+ * Return an HMAC-SHA1 of the receiver's data using the given key
+ */
+- (NSMutableData *) HMACSHA1WithKey:(NSData *)key
+{
+   NSMutableData *hmacValue = [CSSecureData dataWithLength:EVP_MAX_MD_SIZE];
+   unsigned int writtenLen = 0;
+   if(HMAC(EVP_sha1(), [key bytes], [key length], [self bytes], [self length],
+           [hmacValue mutableBytes], &writtenLen) != NULL)
+      [hmacValue setLength:writtenLen];
+   else
+   {
+      [NSData logCryptoMessage:NSLocalizedString(@"HMAC() failed", @"")];
+      hmacValue = nil;
+   }
+
+   return hmacValue;
+}
+
+
+/*
+ * As above, over the prefix followed by the receiver's data, without copying
+ * the two together
+ */
+- (NSMutableData *) HMACSHA1WithKey:(NSData *)key prefix:(NSData *)prefix
+{
+   NSMutableData *hmacValue = [CSSecureData dataWithLength:EVP_MAX_MD_SIZE];
+   unsigned int writtenLen = 0;
+   HMAC_CTX hmacContext;
+   HMAC_CTX_init(&hmacContext);
+   HMAC_Init_ex(&hmacContext, [key bytes], [key length], EVP_sha1(), NULL);
+   HMAC_Update(&hmacContext, [prefix bytes], [prefix length]);
+   HMAC_Update(&hmacContext, [self bytes], [self length]);
+   HMAC_Final(&hmacContext, [hmacValue mutableBytes], &writtenLen);
+   HMAC_CTX_cleanup(&hmacContext);
+   if(writtenLen > 0)
+      [hmacValue setLength:writtenLen];
+   else
+   {
+      [NSData logCryptoMessage:NSLocalizedString(@"HMAC_Final() failed", @"")];
+      hmacValue = nil;
+   }
+
+   return hmacValue;
+}
+
 @end